@@ -12,5 +12,44 @@ typedef void* (*pthread_compatible_routine)(void*);
 #define thrd_join(thread, _ret) \
 	pthread_join((thread), NULL);
 
+typedef pthread_mutex_t mtx_t;
+#define mtx_plain 0
+
+#define mtx_init(mutex, _type) \
+	pthread_mutex_init((mutex), NULL)
+
+#define mtx_lock(mutex) \
+	pthread_mutex_lock((mutex))
+
+#define mtx_unlock(mutex) \
+	pthread_mutex_unlock((mutex))
+
+#define mtx_destroy(mutex) \
+	pthread_mutex_destroy((mutex))
+
+typedef pthread_cond_t cnd_t;
+
+#define cnd_init(condition) \
+	pthread_cond_init((condition), NULL)
+
+#define cnd_wait(condition, mutex) \
+	pthread_cond_wait((condition), (mutex))
+
+#define thrd_success 0
+
+// Return thrd_success if signaled before the deadline, as an absolute
+// TIME_UTC time
+#define cnd_timedwait(condition, mutex, deadline) \
+	pthread_cond_timedwait((condition), (mutex), (deadline))
+
+#define cnd_signal(condition) \
+	pthread_cond_signal((condition))
+
+#define cnd_broadcast(condition) \
+	pthread_cond_broadcast((condition))
+
+#define cnd_destroy(condition) \
+	pthread_cond_destroy((condition))
+
 #endif
 
@@ -0,0 +1,191 @@
+#include "checkpoint.h"
+#include "handy.h"
+#include "devzat_matcher.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// First line of the checkpoint files
+#define CHECKPOINT_MAGIC "mining-devzat-id checkpoint"
+
+// Maximum size of a line of a checkpoint file
+#define MAX_LINE 4096
+
+static const char* const type_names[] = {"ssh-pubkey", "devzat-id"};
+static const char* const position_names[] = {
+	[MATCH_PREFIX] = "prefix",
+	[MATCH_SUFFIX] = "suffix",
+	[MATCH_ANYWHERE] = "anywhere",
+};
+
+void checkpoint_init(checkpoint* state, const uint8_t seed[KEYSPACE_SEED_SIZE], const char* reference, bool devzat_mode, match_position position, bool ignore_case, bool is_pattern, unsigned int worker_number) {
+	memcpy(state->seed, seed, KEYSPACE_SEED_SIZE);
+	state->reference = strdup(reference);
+	state->devzat_mode = devzat_mode;
+	state->position = position;
+	state->ignore_case = ignore_case;
+	state->is_pattern = is_pattern;
+	state->is_metric = false;
+	state->target_score = 0;
+	state->elapsed = 0;
+	state->worker_number = worker_number;
+	state->done = calloc(worker_number, sizeof(uint64_t));
+}
+
+static void write_checkpoint(const checkpoint* state, FILE* f) {
+	fprintf(f, "%s\nseed ", CHECKPOINT_MAGIC);
+	for (int i=0; i<KEYSPACE_SEED_SIZE; i++) {
+		fprintf(f, "%02x", state->seed[i]);
+	}
+	uint64_t attempts = 0;
+	for (unsigned int i=0; i<state->worker_number; i++) {
+		attempts += state->done[i];
+	}
+	fprintf(f, "\nreference %s\n", state->reference);
+	fprintf(f, "type %s\n", type_names[state->devzat_mode]);
+	fprintf(f, "position %s\n", position_names[state->position]);
+	fprintf(f, "ignore-case %d\n", state->ignore_case);
+	fprintf(f, "pattern %d\n", state->is_pattern);
+	fprintf(f, "metric %d\n", state->is_metric);
+	fprintf(f, "target-score %d\n", state->target_score);
+	fprintf(f, "elapsed %llu\n", (unsigned long long) state->elapsed);
+	fprintf(f, "attempts %llu\n", (unsigned long long) attempts);
+	fprintf(f, "workers %u\n", state->worker_number);
+	for (unsigned int i=0; i<state->worker_number; i++) {
+		fprintf(f, "done %u %llu\n", i, (unsigned long long) state->done[i]);
+	}
+}
+
+bool checkpoint_write(const checkpoint* state, const char* path) {
+	char tmp_path[strlen(path) + sizeof(".tmp")];
+	sprintf(tmp_path, "%s.tmp", path);
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	FILE* f = fd < 0 ? NULL : fdopen(fd, "w");
+	if (!f) {
+		fprintf(stderr, "Error, unable to open checkpoint file %s.\n", tmp_path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+	write_checkpoint(state, f);
+	bool ok = fflush(f) == 0 && fsync(fd) == 0;
+	ok &= fclose(f) == 0;
+	if (!ok || rename(tmp_path, path)) {
+		fprintf(stderr, "Error, unable to write checkpoint file %s.\n", path);
+		remove(tmp_path);
+		return false;
+	}
+	return true;
+}
+
+// Index of the name in the list, or -1
+static int find_name(const char* name, const char* const* names, int count) {
+	for (int i=0; i<count; i++) {
+		if (!strcmp(name, names[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Read a number that is 0 or 1
+static bool read_flag(const char* value, bool* flag) {
+	if (strcmp(value, "0") && strcmp(value, "1")) {
+		return false;
+	}
+	*flag = value[0] == '1';
+	return true;
+}
+
+// Read an unsigned decimal number
+static bool read_number(const char* value, uint64_t* number) {
+	char* end;
+	*number = strtoull(value, &end, 10);
+	return end != value && !*end && value[0] != '-';
+}
+
+// Read a line of the checkpoint file, made of a key and its value
+static bool read_line(checkpoint* state, char* key, char* value, bool* seen_seed) {
+	if (!key || !value) {
+		return false;
+	}
+	uint64_t number;
+	if (!strcmp(key, "seed")) {
+		*seen_seed = keyspace_parse_seed(state->seed, value);
+		return *seen_seed;
+	} else if (!strcmp(key, "reference")) {
+		free(state->reference);
+		state->reference = strdup(value);
+		return true;
+	} else if (!strcmp(key, "type")) {
+		int type = find_name(value, type_names, ARRAYCOUNT(type_names));
+		state->devzat_mode = type == 1;
+		return type >= 0;
+	} else if (!strcmp(key, "position")) {
+		int position = find_name(value, position_names, ARRAYCOUNT(position_names));
+		state->position = (match_position) position;
+		return position >= 0;
+	} else if (!strcmp(key, "ignore-case")) {
+		return read_flag(value, &state->ignore_case);
+	} else if (!strcmp(key, "pattern")) {
+		return read_flag(value, &state->is_pattern);
+	} else if (!strcmp(key, "metric")) {
+		return read_flag(value, &state->is_metric);
+	} else if (!strcmp(key, "target-score")) {
+		if (!read_number(value, &number) || number > DEVZAT_ID_DIGITS) {
+			return false;
+		}
+		state->target_score = (int) number;
+		return true;
+	} else if (!strcmp(key, "elapsed")) {
+		return read_number(value, &state->elapsed);
+	} else if (!strcmp(key, "attempts")) {
+		return read_number(value, &number);
+	} else if (!strcmp(key, "workers")) {
+		if (state->done || !read_number(value, &number) || !number || number > KEYSPACE_MAX_WORKERS) {
+			return false;
+		}
+		state->worker_number = number;
+		state->done = calloc(number, sizeof(uint64_t));
+		return true;
+	} else if (!strcmp(key, "done")) {
+		char* done = strtok(NULL, " \n");
+		return state->done && read_number(value, &number) && number < state->worker_number && done && read_number(done, &state->done[number]);
+	}
+	return false;
+}
+
+bool checkpoint_read(checkpoint* state, const char* path) {
+	memset(state, 0, sizeof(checkpoint));
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Error, unable to open checkpoint file %s.\n", path);
+		return false;
+	}
+	char line[MAX_LINE];
+	bool ok = fgets(line, sizeof(line), f) && !strcmp(line, CHECKPOINT_MAGIC "\n");
+	bool seen_seed = false;
+	while (ok && fgets(line, sizeof(line), f)) {
+		char* key = strtok(line, " \n");
+		char* value = strtok(NULL, " \n");
+		ok = read_line(state, key, value, &seen_seed);
+	}
+	mem_clean(line, sizeof(line));
+	fclose(f);
+	if (!ok || !seen_seed || !state->reference || !state->done) {
+		fprintf(stderr, "Error, %s is not a valid checkpoint file.\n", path);
+		checkpoint_free(state);
+		return false;
+	}
+	return true;
+}
+
+void checkpoint_free(checkpoint* state) {
+	free(state->reference);
+	free(state->done);
+	mem_clean(state, sizeof(checkpoint));
+}
+
@@ -0,0 +1,48 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "match_position.h"
+#include "keyspace.h"
+
+// Seconds between two checkpoints of a search
+#define CHECKPOINT_INTERVAL 10
+
+// The state of a search for a single key, enough to continue it without
+// trying again the candidates already tried: worker i has tried the first
+// done[i] candidates of its first generation in the keyspace of the seed. A
+// search for a single key gives out one key, so its workers never move to
+// another generation.
+typedef struct {
+	uint8_t seed[KEYSPACE_SEED_SIZE];
+	char* reference;
+	bool devzat_mode;
+	match_position position;
+	bool ignore_case;
+	bool is_pattern;
+	bool is_metric;   // The reference is the name of the metric that scores the Devzat IDs
+	int target_score; // For a metric, 0 for no target
+	uint64_t elapsed; // Seconds spent mining
+	unsigned int worker_number;
+	uint64_t* done;
+} checkpoint;
+
+// Fill a checkpoint for a new search, with no candidate tried yet. For a
+// search by metric, set is_metric and target_score afterwards.
+void checkpoint_init(checkpoint* state, const uint8_t seed[KEYSPACE_SEED_SIZE], const char* reference, bool devzat_mode, match_position position, bool ignore_case, bool is_pattern, unsigned int worker_number);
+
+// Write the checkpoint to the file, as a text file readable only by its
+// owner as it holds the seed. The file is replaced at once, so that it
+// still holds the previous checkpoint if the program stops while writing
+// it. Print an error and return false on failure.
+bool checkpoint_write(const checkpoint* state, const char* path);
+
+// Read a checkpoint written by checkpoint_write. Print an error and return
+// false if the file is not valid.
+bool checkpoint_read(checkpoint* state, const char* path);
+
+void checkpoint_free(checkpoint* state);
+
+#endif
+
@@ -0,0 +1,365 @@
+#include "devzat_matcher.h"
+#include <string.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) && !defined(NO_SIMD)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Digit i of the ID, from the words of its hash
+static unsigned int hash_digit(const uint32_t hash_words[CF_SHA256_HASHSZ / 4], int i) {
+	return (hash_words[i / 8] >> (28 - 4 * (i % 8))) & 0xF;
+}
+
+// Compile the sets of accepted values of the length digits of the reference
+static void compile_classes(devzat_matcher* matcher, const uint64_t* classes, int length) {
+	matcher->length = length;
+	int first = matcher->position == MATCH_SUFFIX ? DEVZAT_ID_DIGITS - length : 0;
+	for (int i=0; i<length; i++) {
+		uint16_t accepted = classes[i];
+		int d = first + i;
+		int shift = 28 - 4 * (d % 8);
+		matcher->classes[i] = accepted;
+		if (!(accepted & (accepted - 1))) {
+			matcher->value[d / 8] |= (uint32_t) __builtin_ctz(accepted) << shift;
+			matcher->mask[d / 8] |= (uint32_t) 0xF << shift;
+		} else if (accepted != 0xFFFF) {
+			matcher->field[matcher->fields].digit = d;
+			matcher->field[matcher->fields].accepted = accepted;
+			matcher->fields++;
+		}
+	}
+}
+
+// Compile the pattern to digit sets if it is a fixed number of digits, or to
+// DFA otherwise
+static bool compile_pattern(devzat_matcher* matcher, const char* pattern) {
+	// Suffixes are read backward, from the end of the ID
+	int flags = matcher->position == MATCH_SUFFIX ? PATTERN_REVERSE : 0;
+	if (!pattern_compile(&matcher->scan, pattern, PATTERN_HEX, false, flags, DEVZAT_ID_DIGITS)) {
+		return false;
+	}
+	uint64_t classes[DEVZAT_ID_DIGITS];
+	int length = pattern_classes(classes, DEVZAT_ID_DIGITS, &matcher->scan);
+	if (length >= 0) {
+		for (int i=0; matcher->position == MATCH_SUFFIX && i<length/2; i++) {
+			uint64_t tmp = classes[i];
+			classes[i] = classes[length - 1 - i];
+			classes[length - 1 - i] = tmp;
+		}
+		compile_classes(matcher, classes, length);
+		return true;
+	}
+
+	matcher->use_dfa = true;
+	if (matcher->position == MATCH_ANYWHERE) {
+		memcpy(&matcher->anchored, &matcher->scan, sizeof(pattern_dfa));
+		return pattern_compile(&matcher->scan, pattern, PATTERN_HEX, false, PATTERN_UNANCHORED, DEVZAT_ID_DIGITS) &&
+			pattern_compile(&matcher->locate, pattern, PATTERN_HEX, false, PATTERN_REVERSE, DEVZAT_ID_DIGITS);
+	}
+	return true;
+}
+
+bool devzat_matcher_compile(devzat_matcher* matcher, const char* reference, match_position position, bool is_pattern) {
+	memset(matcher, 0, sizeof(devzat_matcher));
+	matcher->position = position;
+	if (is_pattern) {
+		return compile_pattern(matcher, reference);
+	}
+
+	size_t len = strlen(reference);
+	uint64_t classes[DEVZAT_ID_DIGITS];
+	for (size_t i=0; i<len && i<DEVZAT_ID_DIGITS; i++) {
+		classes[i] = pattern_symbol_set(reference[i], PATTERN_HEX, false);
+		if (!classes[i]) {
+			len = DEVZAT_ID_DIGITS + 1;
+		}
+	}
+	if (len > DEVZAT_ID_DIGITS) {
+		fprintf(stderr, "Error, reference should be a valid hex number of at most %d digits.\n", DEVZAT_ID_DIGITS);
+		return false;
+	}
+	compile_classes(matcher, classes, len);
+	return true;
+}
+
+static const char* const metric_names[] = {
+	[ID_METRIC_LEADING_ZEROS] = "leading-zeros",
+	[ID_METRIC_REPEAT] = "repeat",
+	[ID_METRIC_DIGITS] = "digits",
+};
+
+bool devzat_matcher_compile_metric(devzat_matcher* matcher, const char* metric_name, int target_score) {
+	memset(matcher, 0, sizeof(devzat_matcher));
+	for (size_t i=ID_METRIC_NONE + 1; i<sizeof(metric_names) / sizeof(metric_names[0]); i++) {
+		if (!strcmp(metric_name, metric_names[i])) {
+			matcher->metric = (id_metric) i;
+			matcher->target_score = target_score;
+			return true;
+		}
+	}
+	fprintf(stderr, "Error, the metric should be leading-zeros, repeat or digits.\n");
+	return false;
+}
+
+// Number of 0 digits at the start of the ID
+static int leading_zeros(const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	for (int i=0; i<CF_SHA256_HASHSZ / 4; i++) {
+		if (hash_words[i]) {
+			return 8 * i + __builtin_clz(hash_words[i]) / 4;
+		}
+	}
+	return DEVZAT_ID_DIGITS;
+}
+
+// Length of the longest run of a single digit in the ID. The ID is read as 4
+// 64-bit chunks where bit 3 of each digit is set if the next digit is the
+// same. Each round keeps the bits whose next digit also has its bit set, so
+// the number of rounds is the length of the longest run.
+static int longest_repeat(const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	uint64_t chunk[4];
+	for (int k=0; k<4; k++) {
+		chunk[k] = (uint64_t) hash_words[2 * k] << 32 | hash_words[2 * k + 1];
+	}
+	uint64_t same[4];
+	for (int k=0; k<4; k++) {
+		// The last digit is followed by one that is different
+		uint64_t next = k < 3 ? chunk[k + 1] >> 60 : ~chunk[3] & 0xF;
+		uint64_t diff = chunk[k] ^ (chunk[k] << 4 | next);
+		same[k] = ~(((diff & 0x7777777777777777) + 0x7777777777777777) | diff) & 0x8888888888888888;
+	}
+	int run = 1;
+	while (same[0] | same[1] | same[2] | same[3]) {
+		for (int k=0; k<4; k++) {
+			same[k] &= same[k] << 4 | (k < 3 ? same[k + 1] >> 60 : 0);
+		}
+		run++;
+	}
+	return run;
+}
+
+// Number of digits of the ID from 0 to 9. Bit 3 of a digit from a to f is
+// set with bit 2 or 1.
+static int decimal_digits(const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	int letters = 0;
+	for (int i=0; i<CF_SHA256_HASHSZ / 4; i++) {
+		letters += __builtin_popcount(hash_words[i] & (hash_words[i] << 1 | hash_words[i] << 2) & 0x88888888);
+	}
+	return DEVZAT_ID_DIGITS - letters;
+}
+
+static int metric_score(id_metric metric, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	switch (metric) {
+		case ID_METRIC_LEADING_ZEROS:
+			return leading_zeros(hash_words);
+		case ID_METRIC_REPEAT:
+			return longest_repeat(hash_words);
+		case ID_METRIC_DIGITS:
+			return decimal_digits(hash_words);
+		default:
+			return 0;
+	}
+}
+
+#ifdef USE_SSE2
+
+// Bit p is set if digit p of the ID, whose digits are split one per byte in
+// 4 vectors, is equal to value
+static uint64_t digit_positions(const __m128i digits[4], uint8_t value) {
+	__m128i broadcast = _mm_set1_epi8(value);
+	uint64_t ret = 0;
+	for (int i=0; i<4; i++) {
+		ret |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(digits[i], broadcast)) << (16 * i);
+	}
+	return ret;
+}
+
+// Bit p is set if digit p of the ID is in the set of values. The positions of
+// each value of the larger sets are only computed once, when they are first
+// needed, and the sets with more than 8 values are computed from the values
+// they do not have.
+static uint64_t class_positions(const __m128i digits[4], uint16_t values, uint64_t value_positions[16], uint16_t* known) {
+	if (!(values & (values - 1))) {
+		return digit_positions(digits, __builtin_ctz(values));
+	}
+	bool complement = __builtin_popcount(values) > 8;
+	uint64_t ret = 0;
+	for (unsigned int left=complement ? (uint16_t) ~values : values; left; left&=left-1) {
+		int value = __builtin_ctz(left);
+		if (!((*known >> value) & 1)) {
+			value_positions[value] = digit_positions(digits, value);
+			*known |= 1 << value;
+		}
+		ret |= value_positions[value];
+	}
+	return complement ? ~ret : ret;
+}
+
+// Look for the reference at the 64 offsets at once: the offsets of the
+// matches are those o where digit o + k of the ID is in the set k of the
+// reference for all k, so the positions of the values of each set are shifted
+// by k and intersected. The sets of all values are skipped.
+// It is kept out of devzat_matcher_match so that the prefix and suffix checks
+// do not pay for its stack frame.
+static __attribute__((noinline)) int find_classes(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	const __m128i low_nibbles = _mm_set1_epi8(0x0F);
+	__m128i digits[4];
+	for (int i=0; i<2; i++) {
+		// Read the words in big endian, as the bytes of the hash
+		__m128i words = _mm_loadu_si128((const __m128i*) hash_words + i);
+		words = _mm_shufflehi_epi16(_mm_shufflelo_epi16(words, 0xB1), 0xB1);
+		__m128i bytes = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+		__m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibbles);
+		__m128i low = _mm_and_si128(bytes, low_nibbles);
+		digits[2 * i] = _mm_unpacklo_epi8(high, low);
+		digits[2 * i + 1] = _mm_unpackhi_epi8(high, low);
+	}
+
+	uint64_t value_positions[16];
+	uint16_t known = 0;
+	uint64_t offsets = ~(uint64_t) 0;
+	for (int k=0; k<matcher->length && offsets; k++) {
+		if (matcher->classes[k] != 0xFFFF) {
+			offsets &= class_positions(digits, matcher->classes[k], value_positions, &known) >> k;
+		}
+	}
+	// The offsets where the reference would go past the end have been
+	// removed by the shifts, unless the reference ends with all values
+	offsets &= ~(uint64_t) 0 >> (matcher->length - 1);
+	return offsets ? __builtin_ctzll(offsets) : -1;
+}
+
+#else
+
+static int find_classes(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	uint8_t digits[DEVZAT_ID_DIGITS];
+	for (int i=0; i<DEVZAT_ID_DIGITS; i++) {
+		digits[i] = hash_digit(hash_words, i);
+	}
+	for (int offset=0; offset<=DEVZAT_ID_DIGITS - matcher->length; offset++) {
+		int k = 0;
+		while (k < matcher->length && ((matcher->classes[k] >> digits[offset + k]) & 1)) {
+			k++;
+		}
+		if (k == matcher->length) {
+			return offset;
+		}
+	}
+	return -1;
+}
+
+#endif
+
+// Check the digits with several accepted values. About half the hashes pass
+// each of them, so they are all checked without branches.
+static bool fields_match(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	unsigned int accepted = 1;
+	for (int i=0; i<matcher->fields; i++) {
+		accepted &= matcher->field[i].accepted >> hash_digit(hash_words, matcher->field[i].digit);
+	}
+	return accepted;
+}
+
+// Run the DFA on the digits of the ID from digit first, going forward or
+// backward, and return the number of digits read when it finds a match, or -1
+static int run_dfa(const pattern_dfa* dfa, const uint32_t hash_words[CF_SHA256_HASHSZ / 4], int first, int direction) {
+	int state = dfa->start;
+	int d = first;
+	while (state > PATTERN_ACCEPT && 0 <= d && d < DEVZAT_ID_DIGITS) {
+		state = pattern_dfa_step(dfa, state, hash_digit(hash_words, d));
+		d += direction;
+	}
+	return state == PATTERN_ACCEPT ? (d - first) * direction : -1;
+}
+
+static __attribute__((noinline)) int match_dfa(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	switch (matcher->position) {
+		case MATCH_PREFIX:
+			return run_dfa(&matcher->scan, hash_words, 0, 1) < 0 ? -1 : 0;
+		case MATCH_SUFFIX: {
+			int length = run_dfa(&matcher->scan, hash_words, DEVZAT_ID_DIGITS - 1, -1);
+			return length < 0 ? -1 : DEVZAT_ID_DIGITS - length;
+		}
+		default: {
+			int end = run_dfa(&matcher->scan, hash_words, 0, 1);
+			return end < 0 ? -1 : end - run_dfa(&matcher->locate, hash_words, end - 1, -1);
+		}
+	}
+}
+
+int devzat_matcher_match(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	if (matcher->use_dfa) {
+		return match_dfa(matcher, hash_words);
+	}
+	if (matcher->metric) {
+		return matcher->target_score && metric_score(matcher->metric, hash_words) >= matcher->target_score ? 0 : -1;
+	}
+
+	if (matcher->position != MATCH_ANYWHERE) {
+		for (int i=0; i<CF_SHA256_HASHSZ / 4; i++) {
+			if ((hash_words[i] & matcher->mask[i]) != matcher->value[i]) {
+				return -1;
+			}
+		}
+		if (matcher->fields && !fields_match(matcher, hash_words)) {
+			return -1;
+		}
+		return matcher->position == MATCH_SUFFIX ? DEVZAT_ID_DIGITS - matcher->length : 0;
+	}
+
+	if (!matcher->length) {
+		return 0;
+	}
+	return find_classes(matcher, hash_words);
+}
+
+// Score of a reference matched anywhere: the most digits that match it from
+// its start, at any offset
+static int anywhere_score(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	int best = 0;
+	for (int offset=0; offset<DEVZAT_ID_DIGITS - best; offset++) {
+		int score = 0;
+		if (matcher->use_dfa) {
+			int state = matcher->anchored.start;
+			while (offset + score < DEVZAT_ID_DIGITS && (state = pattern_dfa_step(&matcher->anchored, state, hash_digit(hash_words, offset + score))) != PATTERN_DEAD) {
+				score++;
+			}
+		} else {
+			while (score < matcher->length && offset + score < DEVZAT_ID_DIGITS && ((matcher->classes[score] >> hash_digit(hash_words, offset + score)) & 1)) {
+				score++;
+			}
+		}
+		best = score > best ? score : best;
+	}
+	return best;
+}
+
+int devzat_matcher_score(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	if (matcher->metric) {
+		return metric_score(matcher->metric, hash_words);
+	}
+	if (matcher->position == MATCH_ANYWHERE) {
+		return anywhere_score(matcher, hash_words);
+	}
+	// Suffixes are read backward, from the end of the ID
+	int direction = matcher->position == MATCH_SUFFIX ? -1 : 1;
+	int d = direction > 0 ? 0 : DEVZAT_ID_DIGITS - 1;
+	int score = 0;
+	if (matcher->use_dfa) {
+		int state = matcher->scan.start;
+		while (score < DEVZAT_ID_DIGITS && (state = pattern_dfa_step(&matcher->scan, state, hash_digit(hash_words, d))) != PATTERN_DEAD) {
+			score++;
+			d += direction;
+		}
+		return score;
+	}
+	int k = direction > 0 ? 0 : matcher->length - 1;
+	while (score < matcher->length && ((matcher->classes[k] >> hash_digit(hash_words, d)) & 1)) {
+		score++;
+		d += direction;
+		k += direction;
+	}
+	return score;
+}
+
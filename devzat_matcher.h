@@ -0,0 +1,75 @@
+#ifndef _DEVZAT_MATCHER_H_
+#define _DEVZAT_MATCHER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sha2.h"
+#include "match_position.h"
+#include "pattern.h"
+
+// Number of hex digits of a Devzat ID, the SHA-256 of the public key blob
+#define DEVZAT_ID_DIGITS (CF_SHA256_HASHSZ * 2)
+
+// Metrics that score the Devzat IDs without a reference, from the words of
+// their hash
+typedef enum {
+	ID_METRIC_NONE,
+	ID_METRIC_LEADING_ZEROS, // Number of 0 digits at the start of the ID
+	ID_METRIC_REPEAT,        // Length of the longest run of a single digit
+	ID_METRIC_DIGITS,        // Number of decimal digits, from 0 to 9
+} id_metric;
+
+// A Devzat ID reference or pattern, compiled once so that the candidates are
+// checked on the words of their hash, read in big endian.
+// Most patterns, as the references, are a fixed number of digits with a set
+// of accepted values each:
+// - At a fixed position, a hash matches if (word & mask) == value for all its
+//   words. The masks only cover the digits with a single accepted value, so
+//   that the reference can start or end with half a byte. The digits with
+//   more values are fields checked one by one.
+// - Anywhere, the digits of the hash are scanned for the sets of the
+//   reference.
+// The other patterns are checked by running their DFA on the digits.
+// With a metric instead of a reference, the IDs that score at least the
+// target score match.
+typedef struct {
+	match_position position;
+	uint32_t value[CF_SHA256_HASHSZ / 4];
+	uint32_t mask[CF_SHA256_HASHSZ / 4];
+	int fields;
+	struct {
+		uint8_t  digit;    // Index of the digit in the ID
+		uint16_t accepted; // Bit v is set if the digit can have the value v
+	} field[DEVZAT_ID_DIGITS];
+	uint16_t classes[DEVZAT_ID_DIGITS];
+	int length;
+	bool use_dfa;
+	pattern_dfa scan;   // Read forward from the start, backward from the end for MATCH_SUFFIX, or forward from anywhere for MATCH_ANYWHERE
+	pattern_dfa locate; // For MATCH_ANYWHERE, read backward from the end of a match found by scan to find its start
+	pattern_dfa anchored; // For MATCH_ANYWHERE, read forward from an offset to score the IDs that do not match
+	id_metric metric;
+	int target_score;   // 0 if no ID matches the metric
+} devzat_matcher;
+
+// Compile the reference, or the pattern if is_pattern is true. Print an error
+// and return false if the reference is not a hex number of at most
+// DEVZAT_ID_DIGITS digits, in upper or lower case, or if the pattern is not
+// valid.
+bool devzat_matcher_compile(devzat_matcher* matcher, const char* reference, match_position position, bool is_pattern);
+
+// Compile the metric of the given name: "leading-zeros", "repeat" or
+// "digits". Print an error and return false if there is none of that name.
+bool devzat_matcher_compile_metric(devzat_matcher* matcher, const char* metric_name, int target_score);
+
+// Return the offset in hex digits where the reference is found in the ID of
+// the hash, or -1 if it does not match
+int devzat_matcher_match(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]);
+
+// Return how close the ID of the hash is to matching: the number of digits
+// that match the reference from its start, or from its end for MATCH_SUFFIX,
+// or its score for a metric. For MATCH_ANYWHERE, it is the most digits that
+// match the reference from its start at any offset.
+int devzat_matcher_score(const devzat_matcher* matcher, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]);
+
+#endif
+
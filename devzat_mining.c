@@ -1,143 +1,451 @@
+#ifdef __linux__
+// For the CPU affinity of the pool workers
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
 #include "openssh_formatter.h"
 #include "curve25519.h"
 #include <stdbool.h>
 #include "threads.h"
-#include <unistd.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
-#include "base64.h"
+#include "pubkey_matcher.h"
+#include "devzat_matcher.h"
+#include "target_index.h"
+#include "result_queue.h"
+#include "keyspace.h"
+#include "checkpoint.h"
+#include "reservoir.h"
+#include "devzat_mining.h"
 #include <stdio.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "sha2.h"
-
-// Check that a string contains only valid hex numbers
-static bool valid_hex(const char* str) {
-	for (size_t i=0; i<strlen(str); i++) {
-		char c = str[i];
-		if (!('0' <= c && c <= '9') && !('a' <= c && c <= 'f') && !('A' <= c && c <= 'F')) {
-			return false;
-		}
-	}
-	return true;
-}
-
-// Compare an array of bytes to a representation of in in hexadecimal
-// {0xca, 0xfe} and "Cafe" would match
-// {0x10, 0x12} and "101" would match
-// {0x10} and "11" would not match
-// It is assume that the string is valid and that the array is long enough
-static bool compare_hex_and_array(const uint8_t* array, const char* str) {
-	for (size_t i=0; i<strlen(str)/2; i++) { // As /2 rounds down, we only cover full bytes here
-		char byte_hex[3] = {0};
-		memcpy(byte_hex, str + (2 * i), 2);
-		uint8_t hex_convert;
-		sscanf(byte_hex, "%hhx", &hex_convert);
-		if (array[i] != hex_convert) {
-			return false;
-		}
-	}
-	if (strlen(str) % 2) { // If the length of the string is odd, we still have a nibble to check
-		char nibble_hex[2] = {str[strlen(str)-1], 0};
-		uint8_t hex_convert;
-		sscanf(nibble_hex, "%hhx", &hex_convert);
-		if (((array[strlen(str)/2] >> 4) & 0x0F) != hex_convert) {
-			return false;
-		}
-	}
-	return true;
-}
+#include "handy.h"
 
 // Compile with the CFLAGS=-DQUIET_MATCHING to suppress printing the ID when found
 #ifndef QUIET_MATCHING
-static char* format_hash(const uint8_t* hash) {
+static char* format_hash(const uint32_t* hash_words) {
 	char* ret = malloc(CF_SHA256_HASHSZ * 2 + 1);
 	ret[0] = 0;
-	for (int i=0; i<CF_SHA256_HASHSZ; i++) {
-		snprintf(ret + (2 * i), 3, "%02x", hash[i]);
+	for (int i=0; i<CF_SHA256_HASHSZ / 4; i++) {
+		snprintf(ret + (8 * i), 9, "%08x", hash_words[i]);
 	}
 	return ret;
 }
 #endif
 
-// Compare the few first bytes of the hash of the public key (Devzat's method)
-// to the given reference string and see if they match
-static bool is_key_hash_matching_for_devzat(const uint8_t* message, size_t formated_key_size, const char* reference) {
-	cf_sha256_context ctx;
-	cf_sha256_init(&ctx);
-	cf_sha256_update(&ctx, message, formated_key_size);
-	uint8_t hash[CF_SHA256_HASHSZ];
-	cf_sha256_digest_final(&ctx, hash);
+// The public key blob of the candidates. Only the public key at its end
+// changes, so the blob is formated once and the hash rounds that only read its
+// constant start are done once too. Both are set by init_pubkey_blob before
+// the workers start and are only read afterward.
+static uint8_t pubkey_blob_template[OPENSSH_PUBKEY_SIZE];
+static cf_sha256_prefix_context pubkey_blob_hash;
 
-	bool matching = compare_hex_and_array(hash, reference);
-#ifndef QUIET_MATCHING
-	if (matching) {
-		char* hash_str = format_hash(hash);
-		fprintf(stderr, "Found key giving the ID %s.\n", hash_str);
-		free(hash_str);
-	}
-#endif
-	return matching;
+static void init_pubkey_blob(void) {
+	const uint8_t dummy_pubkey[CURVE_25519_PUBLIC_KEY_SIZE] = {0};
+	openssh_format_pubkey(pubkey_blob_template, dummy_pubkey);
+	cf_sha256_prefix_init(&pubkey_blob_hash, pubkey_blob_template, OPENSSH_PUBKEY_SIZE);
+}
+
+// Write the public key blob of pubkey in message
+static void format_pubkey_blob(uint8_t* message, const uint8_t* pubkey) {
+	memcpy(message, pubkey_blob_template, OPENSSH_PUBKEY_OFFSET);
+	memcpy(message + OPENSSH_PUBKEY_OFFSET, pubkey, CURVE_25519_PUBLIC_KEY_SIZE);
 }
 
-static bool is_public_key_matching(const void* message, size_t formated_key_size, const char* reference) {
-	char base64_data[b64e_size(formated_key_size)];
-	b64_encode(message, formated_key_size, base64_data);
-	return !strcmp(base64_data + strlen(base64_data) - strlen(reference), reference);
+// Compare the hash of the public key (Devzat's method) to the compiled
+// reference and see if they match
+static bool is_hash_matching_for_devzat(const uint32_t* hash_words, const devzat_matcher* matcher) {
+	return devzat_matcher_match(matcher, hash_words) >= 0;
 }
 
-static bool is_key_matching(const uint8_t* privkey, const char* reference, bool devzat_mode) {
+#ifndef QUIET_MATCHING
+// Print the Devzat ID of a key that is kept, and where it matches the
+// reference, or its score for a metric. Only the keys actually given out are
+// printed, not every match that a worker sees.
+static void print_found_key(const devzat_matcher* matcher, const uint8_t* privkey) {
 	uint8_t pubkey[CURVE_25519_PUBLIC_KEY_SIZE];
+	uint8_t message[OPENSSH_PUBKEY_SIZE];
+	uint8_t hash[CF_SHA256_HASHSZ];
+	uint32_t hash_words[CF_SHA256_HASHSZ / 4];
 	ed25519_public_key(pubkey, privkey);
-	size_t formated_key_size = openssh_format_pubkey(NULL, pubkey);
-	uint8_t message[formated_key_size];
-	openssh_format_pubkey(message, pubkey);
-	if (devzat_mode) {
-		return is_key_hash_matching_for_devzat(message, formated_key_size, reference);
+	format_pubkey_blob(message, pubkey);
+	cf_sha256_prefix_digest(&pubkey_blob_hash, message + CF_SHA256_PREFIXSZ, hash);
+	for (int i=0; i<CF_SHA256_HASHSZ / 4; i++) {
+		hash_words[i] = (uint32_t) hash[4 * i] << 24 | (uint32_t) hash[4 * i + 1] << 16 | (uint32_t) hash[4 * i + 2] << 8 | hash[4 * i + 3];
+	}
+	char* hash_str = format_hash(hash_words);
+	if (matcher->metric) {
+		fprintf(stderr, "Found key giving the ID %s, which scores %d.\n", hash_str, devzat_matcher_score(matcher, hash_words));
 	} else {
-		return is_public_key_matching(message, formated_key_size, reference);
+		fprintf(stderr, "Found key giving the ID %s, matching at offset %d.\n", hash_str, devzat_matcher_match(matcher, hash_words));
 	}
+	free(hash_str);
 }
+#endif
 
-// Generate a new random private key
-static void random_privkey(uint8_t* privkey) {
-	for (int i=0; i<CURVE_25519_PRIVATE_KEY_SIZE; i++) {
-		privkey[i] = (uint8_t) random(); // A bit inefficient but as this operation is not done a lot, I don't care
+// Number of public keys whose Devzat ID are computed at once
+#define DEVZAT_CHECK_BATCH 8
+
+// Compute the Devzat IDs of DEVZAT_CHECK_BATCH public keys together, as the
+// words of their hash
+static void devzat_ids(const uint8_t pubkeys[][CURVE_25519_PUBLIC_KEY_SIZE], uint32_t hashes[DEVZAT_CHECK_BATCH][CF_SHA256_HASHSZ / 4]) {
+	uint8_t messages[DEVZAT_CHECK_BATCH][OPENSSH_PUBKEY_SIZE];
+	const uint8_t* rests[DEVZAT_CHECK_BATCH];
+	for (int i=0; i<DEVZAT_CHECK_BATCH; i++) {
+		format_pubkey_blob(messages[i], pubkeys[i]);
+		rests[i] = messages[i] + CF_SHA256_PREFIXSZ;
 	}
+	cf_sha256_prefix_digest_words_x8(&pubkey_blob_hash, rests, hashes);
 }
 
-// Increment a private key
-static void increase_privkey(uint8_t* privkey) {
-	for (int i=0; i<CURVE_25519_PRIVATE_KEY_SIZE; i++) {
-		privkey[i] = privkey[i] + 1;
-		if (privkey[i] != 0) {
-			break;
+// The candidate closest to matching that a worker has tried, by the number
+// of digits of the reference that its Devzat ID matches, or of characters of
+// the reference that its public key matches
+typedef struct {
+	int score;
+	uint64_t generation;
+	uint64_t counter;
+} near_miss;
+
+// Number of candidates that a worker can offer to the reservoir before the
+// reservoir writer takes them. It must be a power of 2.
+#define RESERVOIR_OFFERS 64
+
+// The candidates that a worker offers to the reservoir, without waiting: a
+// ring written by the worker and read by the reservoir writer. A key offered
+// must not share its prefix with any other key given out, so the worker
+// chooses at most one candidate of each batch, and offers it at the end of
+// the batch if no other key of its generation may be given out.
+typedef struct {
+	const reservoir* store;
+	const ed25519_counter_ctx* candidates; // The current candidates of the worker
+	bool chosen; // A candidate of the current batch is chosen
+	uint64_t chosen_counter;
+	uint32_t chosen_id[CF_SHA256_HASHSZ / 4];
+	_Atomic uint64_t head; // Next offer to write, by the worker
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail; // Next offer to read, by the reservoir writer
+	struct {
+		uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+		uint32_t id[CF_SHA256_HASHSZ / 4];
+	} offer[RESERVOIR_OFFERS];
+} reservoir_offers;
+
+// Choose the candidate at counter, whose Devzat ID has these words, if no
+// candidate of the batch is chosen yet and its bucket in the reservoir has
+// room
+static void choose_candidate(reservoir_offers* offers, uint64_t counter, const uint32_t* hash_words) {
+	if (offers->chosen || !reservoir_wants(offers->store, hash_words)) {
+		return;
+	}
+	offers->chosen = true;
+	offers->chosen_counter = counter;
+	memcpy(offers->chosen_id, hash_words, CF_SHA256_HASHSZ);
+}
+
+// Offer the chosen candidate to the reservoir, unless the ring is full.
+// Return true if it is offered, after which the worker must move to its next
+// generation.
+static bool offer_chosen_candidate(reservoir_offers* offers) {
+	uint64_t head = atomic_load_explicit(&offers->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&offers->tail, memory_order_acquire) >= RESERVOIR_OFFERS) {
+		return false;
+	}
+	ed25519_counter_secret_key(offers->offer[head % RESERVOIR_OFFERS].privkey, offers->candidates, offers->chosen_counter);
+	memcpy(offers->offer[head % RESERVOIR_OFFERS].id, offers->chosen_id, CF_SHA256_HASHSZ);
+	atomic_store_explicit(&offers->head, head + 1, memory_order_release);
+	return true;
+}
+
+// Hash DEVZAT_CHECK_BATCH public keys together and return the index of the
+// first one that matches the reference as a Devzat ID, or -1.
+// If best is not NULL, update it with the scores of the keys that do not
+// match, the first one being the candidate at counter. If offers is not
+// NULL, choose one of them for the reservoir, except the new best ones,
+// which may be given out as near misses.
+static int first_key_hash_matching_for_devzat(const uint8_t pubkeys[][CURVE_25519_PUBLIC_KEY_SIZE], const devzat_matcher* id_matcher, near_miss* best, reservoir_offers* offers, uint64_t counter) {
+	uint32_t hashes[DEVZAT_CHECK_BATCH][CF_SHA256_HASHSZ / 4];
+	devzat_ids(pubkeys, hashes);
+	for (int i=0; i<DEVZAT_CHECK_BATCH; i++) {
+		if (is_hash_matching_for_devzat(hashes[i], id_matcher)) {
+			return i;
+		}
+		if (best) {
+			int score = devzat_matcher_score(id_matcher, hashes[i]);
+			if (score > best->score) {
+				best->score = score;
+				best->counter = counter + i;
+				continue;
+			}
+		}
+		if (offers) {
+			choose_candidate(offers, counter + i, hashes[i]);
+		}
+	}
+	return -1;
+}
+
+// Return the index of the first of the count public keys that matches the
+// compiled Devzat ID or ssh-pubkey reference, or -1. If best is not NULL, it
+// is updated with the scores of the keys that do not match, the first key
+// being the candidate at counter. In Devzat mode, count must be a
+// multiple of DEVZAT_CHECK_BATCH, and offers are updated as in
+// first_key_hash_matching_for_devzat.
+static int first_key_matching(const uint8_t pubkeys[][CURVE_25519_PUBLIC_KEY_SIZE], int count, const devzat_matcher* id_matcher, const pubkey_matcher* key_matcher, bool devzat_mode, near_miss* best, reservoir_offers* offers, uint64_t counter) {
+	if (devzat_mode) {
+		for (int i=0; i<count; i+=DEVZAT_CHECK_BATCH) {
+			int match = first_key_hash_matching_for_devzat(pubkeys + i, id_matcher, best, offers, counter + i);
+			if (match >= 0) {
+				return i + match;
+			}
+		}
+	} else {
+		for (int i=0; i<count; i++) {
+			if (pubkey_matcher_match(key_matcher, pubkeys[i])) {
+				return i;
+			}
+			if (best) {
+				int score = pubkey_matcher_score(key_matcher, pubkeys[i]);
+				if (score > best->score) {
+					best->score = score;
+					best->counter = counter + i;
+				}
+			}
 		}
 	}
+	return -1;
 }
 
+// Number of candidate keys derived at once by a worker. The public keys of
+// a batch share a single field inversion. It must be a multiple of
+// DEVZAT_CHECK_BATCH.
+#define MINING_BATCH_SIZE 128
+
+// Set by devzat_mining_interrupt. The workers check it after each batch of
+// candidates.
+static atomic_bool interrupted = false;
+
+// Set by devzat_mining_feed_reservoir
+static reservoir* fed_reservoir = NULL;
+
+// State shared by the workers mining for the same reference
 typedef struct {
-	const char* reference;
-	volatile bool finished;
-	volatile bool stop_force;
-	uint8_t working_privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	const devzat_matcher* id_matcher;
+	const pubkey_matcher* key_matcher;
+	result_queue* results;
 	bool devzat_mode;
+	bool vartime;
+	bool track_best; // Keep the near misses of the workers
+	keyspace space;
+	// Set when a worker finishes or when the search is cancelled. The
+	// workers check it after each batch of candidates.
+	atomic_bool stop;
+	_Alignas(CACHE_LINE_SIZE) mtx_t lock;
+	cnd_t changed; // Signaled when a key is pushed or when stop is set by a worker
+	int winner;    // Index of the first worker to find a key, or -1. Protected by lock.
+	int running;   // Number of workers still mining. Protected by lock.
+	// The reservoir fed with the candidates that the workers offer, or NULL,
+	// and the thread that writes them to it
+	reservoir* store;
+	struct worker_arguments* workers;
+	unsigned int worker_number;
+	atomic_bool workers_stopped;
+	thrd_t store_writer;
+} mining_job;
+
+// The arguments of each worker are on their own cache lines
+typedef struct worker_arguments {
+	_Alignas(CACHE_LINE_SIZE) mining_job* job;
+	int index;
+	_Atomic uint64_t done; // Number of candidates of its range tried, updated after each batch
+	uint64_t max_done;     // Stop once done reaches it, 0 for no limit
+	near_miss best;        // Written when the worker stops
+	uint8_t working_privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	_Alignas(CACHE_LINE_SIZE) reservoir_offers offers;
 } worker_arguments;
 
-// Generate a random starting private key, use it as a base to generate new
-// private keys until one's hash matches with the reference.
-// Once it is done, set the finished argument to true.
-// If the stop_force argument is set to true, finish even without a result
+void devzat_mining_interrupt(void) {
+	atomic_store(&interrupted, true);
+}
+
+void devzat_mining_feed_reservoir(reservoir* store) {
+	fed_reservoir = store;
+}
+
+static void mining_job_init(mining_job* job, const devzat_matcher* id_matcher, const pubkey_matcher* key_matcher, result_queue* results, bool devzat_mode, bool vartime, const uint8_t* seed) {
+	job->id_matcher = id_matcher;
+	job->key_matcher = key_matcher;
+	job->results = results;
+	job->devzat_mode = devzat_mode;
+	job->vartime = vartime;
+	job->track_best = false;
+	keyspace_init(&job->space, seed);
+	atomic_init(&job->stop, false);
+	mtx_init(&job->lock, mtx_plain);
+	cnd_init(&job->changed);
+	job->winner = -1;
+	job->running = 0;
+	// Only the Devzat IDs of the candidates are hashed by the workers
+	job->store = devzat_mode ? fed_reservoir : NULL;
+	atomic_init(&job->workers_stopped, false);
+}
+
+static void mining_job_destroy(mining_job* job) {
+	mem_clean(&job->space, sizeof(keyspace));
+	cnd_destroy(&job->changed);
+	mtx_destroy(&job->lock);
+}
+
+// Stop all the workers of the job and wake up the threads waiting on it.
+// The lock must be held.
+static void mining_job_stop_locked(mining_job* job) {
+	atomic_store_explicit(&job->stop, true, memory_order_release);
+	cnd_broadcast(&job->changed);
+}
+
+static void mining_job_stop(mining_job* job) {
+	mtx_lock(&job->lock);
+	mining_job_stop_locked(job);
+	mtx_unlock(&job->lock);
+}
+
+// Record that a worker stopped mining, with a key if index is not -1. Stop
+// the job if the worker found a key, if it was the last worker or if the
+// program is interrupted.
+static void mining_job_leave(mining_job* job, int index) {
+	mtx_lock(&job->lock);
+	job->running--;
+	if (index >= 0 && job->winner < 0) {
+		job->winner = index;
+	}
+	if (index >= 0 || !job->running || atomic_load(&interrupted)) {
+		mining_job_stop_locked(job);
+	}
+	mtx_unlock(&job->lock);
+}
+
+// Block until the job is stopped
+static void mining_job_wait(mining_job* job) {
+	mtx_lock(&job->lock);
+	while (!atomic_load_explicit(&job->stop, memory_order_relaxed)) {
+		cnd_wait(&job->changed, &job->lock);
+	}
+	mtx_unlock(&job->lock);
+}
+
+// Same as mining_job_wait, but return false if the job is still running at
+// the deadline
+static bool mining_job_wait_until(mining_job* job, const struct timespec* deadline) {
+	mtx_lock(&job->lock);
+	while (!atomic_load_explicit(&job->stop, memory_order_relaxed)) {
+		if (cnd_timedwait(&job->changed, &job->lock, deadline) != thrd_success) {
+			break;
+		}
+	}
+	bool stopped = atomic_load_explicit(&job->stop, memory_order_relaxed);
+	mtx_unlock(&job->lock);
+	return stopped;
+}
+
+// Keep the key of the candidate at counter, in working_privkey or pushed to
+// the results queue if there is one. Return true if the worker should go on
+// looking for more keys.
+static bool keep_found_key(worker_arguments* args, const ed25519_counter_ctx* candidates, uint64_t counter) {
+	mining_job* job = args->job;
+	if (!job->results) {
+		ed25519_counter_secret_key(args->working_privkey, candidates, counter);
+		return false;
+	}
+	if (!result_queue_claim(job->results)) {
+		return false;
+	}
+	uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	ed25519_counter_secret_key(privkey, candidates, counter);
+	result_queue_push(job->results, privkey);
+	mem_clean(privkey, sizeof(privkey));
+	mtx_lock(&job->lock);
+	cnd_signal(&job->changed);
+	mtx_unlock(&job->lock);
+	return true;
+}
+
+// Go through the range of the worker in the keyspace of the job, from the
+// done-th candidate, until the hash of a key matches with the reference.
+// Once it is done, put the key in working_privkey and stop the job.
+// If the job has a results queue, push all the matching keys in it instead,
+// until it has all the keys it wants.
+// If the job is stopped by another thread, if the program is interrupted or
+// once max_done candidates are tried, finish after the current batch even
+// without a result. If the job tracks near misses, the closest candidate to
+// matching is then in best.
+// The candidates of a generation share the first
+// CURVE_25519_COUNTER_PREFIX_SIZE bytes and only vary the big endian counter
+// in the last bytes, so that the start of their hash is computed once. They
+// are processed by batches of MINING_BATCH_SIZE keys. Once a key is pushed to
+// the results queue, the rest of its batch is dropped, even if it has other
+// matches, and the worker moves to its next generation, as described in
+// keyspace.h. With a reservoir, it does
+// so too after a batch that offers a key to the reservoir or that has a new
+// near miss.
+// If the vartime field of the job is set to true, the keys are derived with
+// the faster variable-time code, which does not wipe the candidates either.
 static void key_mining_worker(worker_arguments* args) {
-	uint8_t* privkey = malloc(CURVE_25519_PRIVATE_KEY_SIZE);
-	random_privkey(privkey);
-	while((!args->stop_force) && (!args->finished)) {
-		increase_privkey(privkey);
-		if (is_key_matching(privkey, args->reference, args->devzat_mode)) {
-			args->finished = true;
-			memcpy(args->working_privkey, privkey, CURVE_25519_PRIVATE_KEY_SIZE);
+	mining_job* job = args->job;
+	uint8_t (*pubkeys)[CURVE_25519_PUBLIC_KEY_SIZE] = malloc(CURVE_25519_PUBLIC_KEY_SIZE * MINING_BATCH_SIZE);
+	ed25519_counter_ctx candidates;
+	uint64_t generation = 0;
+	uint64_t done = atomic_load_explicit(&args->done, memory_order_relaxed);
+	uint64_t counter = keyspace_worker_candidates(&job->space, args->index, generation, &candidates) + done;
+	args->offers.candidates = &candidates;
+	near_miss best = {.score = 0, .generation = 0, .counter = 0};
+	bool finished = false;
+	while (!finished && !atomic_load_explicit(&job->stop, memory_order_acquire)) {
+		if (atomic_load_explicit(&interrupted, memory_order_relaxed) || (args->max_done && done >= args->max_done)) {
+			break;
+		}
+		if (job->vartime) {
+			ed25519_public_key_counter_batch_vartime(pubkeys, &candidates, counter, MINING_BATCH_SIZE);
+		} else {
+			ed25519_public_key_counter_batch(pubkeys, &candidates, counter, MINING_BATCH_SIZE);
+		}
+		int best_score = best.score;
+		// A key given out leaves its prefix to its recipient: the rest of
+		// the batch is dropped on purpose, even if it has more matches
+		int match = first_key_matching((const uint8_t (*)[CURVE_25519_PUBLIC_KEY_SIZE]) pubkeys, MINING_BATCH_SIZE, job->id_matcher, job->key_matcher, job->devzat_mode, job->track_best ? &best : NULL, job->store ? &args->offers : NULL, counter);
+		bool given = false;
+		if (match >= 0) {
+			finished = !keep_found_key(args, &candidates, counter + match);
+			given = !finished;
+		}
+		// A new near miss may be given out, so nothing else of its generation
+		// can go to the reservoir
+		bool spent = given;
+		if (best.score > best_score) {
+			best.generation = generation;
+			spent |= job->store != NULL;
+		}
+		if (args->offers.chosen && !finished && !spent) {
+			spent = offer_chosen_candidate(&args->offers);
+		}
+		args->offers.chosen = false;
+		done += MINING_BATCH_SIZE;
+		atomic_store_explicit(&args->done, done, memory_order_relaxed);
+		if (spent) {
+			counter = keyspace_worker_candidates(&job->space, args->index, ++generation, &candidates);
+		} else {
+			counter += MINING_BATCH_SIZE;
 		}
 	}
-	free(privkey);
+	args->best = best;
+	mining_job_leave(job, finished ? args->index : -1);
+	mem_clean(&candidates, sizeof(candidates));
+	mem_clean(&counter, sizeof(counter));
+	mem_clean(&best, sizeof(best));
+	free(pubkeys);
 }
 
 // Wrapper for key_mining_worker which is of type thrd_start_t
@@ -146,99 +454,804 @@ static int key_mining_worker_wrap(void* args) {
 	return 0;
 }
 
-// Try to start the C PRNG with a true random seed. If not available, default
-// to using the time
-static void seed_rng() {
-	FILE* f;
-	f = fopen("/dev/urandom", "r");
-	if (f == NULL) {
-		f = fopen("/dev/random", "r");
+// Write the candidates offered by the workers of the job to its reservoir,
+// until the workers are stopped and all their offers are written. Sleep
+// while there are none, so that the workers never wait for the reservoir.
+static void reservoir_writer(mining_job* job) {
+	for (;;) {
+		bool stopped = atomic_load_explicit(&job->workers_stopped, memory_order_acquire);
+		bool written = false;
+		for (unsigned int i=0; i<job->worker_number; i++) {
+			reservoir_offers* offers = &job->workers[i].offers;
+			uint64_t tail = atomic_load_explicit(&offers->tail, memory_order_relaxed);
+			uint64_t head = atomic_load_explicit(&offers->head, memory_order_acquire);
+			for (; tail<head; tail++) {
+				reservoir_store(job->store, offers->offer[tail % RESERVOIR_OFFERS].id, offers->offer[tail % RESERVOIR_OFFERS].privkey);
+				mem_clean(offers->offer[tail % RESERVOIR_OFFERS].privkey, CURVE_25519_PRIVATE_KEY_SIZE);
+				written = true;
+			}
+			atomic_store_explicit(&offers->tail, tail, memory_order_release);
+		}
+		if (stopped) {
+			break;
+		}
+		if (!written) {
+			usleep(10000);
+		}
+	}
+}
+
+// Wrapper for reservoir_writer which is of type thrd_start_t
+static int reservoir_writer_wrap(void* job) {
+	reservoir_writer((mining_job*) job);
+	return 0;
+}
+
+// Start a worker for each of the thread_number arguments of the job, which
+// are allocated on their own cache lines. If done is not NULL, worker i
+// skips the first done[i] candidates of its range. If max_attempts is not 0,
+// each worker stops after trying its share of them. If the job has a
+// reservoir, its writer is started too.
+static worker_arguments* start_workers(mining_job* job, thrd_t* threads, unsigned int thread_number, const uint64_t* done, uint64_t max_attempts) {
+	worker_arguments* args_list = aligned_alloc(CACHE_LINE_SIZE, sizeof(worker_arguments) * thread_number);
+	uint64_t share = (max_attempts + thread_number - 1) / thread_number;
+	job->running = thread_number;
+	for (unsigned int i=0; i<thread_number; i++) {
+		memset(&args_list[i], 0, sizeof(worker_arguments));
+		args_list[i].job = job;
+		args_list[i].index = i;
+		atomic_init(&args_list[i].done, done ? done[i] : 0);
+		args_list[i].max_done = share ? (done ? done[i] : 0) + share : 0;
+		args_list[i].offers.store = job->store;
+		atomic_init(&args_list[i].offers.head, 0);
+		atomic_init(&args_list[i].offers.tail, 0);
 	}
-	if (f == NULL) {
-		fprintf(stderr, "Warning, unable to find a true random source. The generated key will be easy to crack.\n");
-		srand(time(NULL));
-		return;
+	job->workers = args_list;
+	job->worker_number = thread_number;
+	if (job->store) {
+		thrd_create(&job->store_writer, reservoir_writer_wrap, job);
+	}
+	for (unsigned int i=0; i<thread_number; i++) {
+		thrd_create(&threads[i], key_mining_worker_wrap, &args_list[i]);
+	}
+	return args_list;
+}
+
+// Stop the workers started by start_workers and wait for them, then for the
+// reservoir writer to write their last offers
+static void stop_workers(mining_job* job, thrd_t* threads, unsigned int thread_number) {
+	mining_job_stop(job);
+	for (unsigned int i=0; i<thread_number; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	if (job->store) {
+		atomic_store_explicit(&job->workers_stopped, true, memory_order_release);
+		thrd_join(job->store_writer, NULL);
 	}
-	unsigned int seed;
-	if (fread(&seed, sizeof(unsigned int), 1, f) == 1) {
-		srand(seed);
+}
+
+static void free_workers(worker_arguments* args_list, unsigned int thread_number) {
+	mem_clean(args_list, sizeof(worker_arguments) * thread_number);
+	free(args_list);
+}
+
+// Compile the reference in the matcher of the mode and get the shared state
+// of the workers ready. Return false if the reference is not valid.
+static bool setup_mining(devzat_matcher* id_matcher, pubkey_matcher* key_matcher, const char* reference, bool devzat_mode, match_position position, bool ignore_case, bool is_pattern) {
+	if (devzat_mode ? !devzat_matcher_compile(id_matcher, reference, position, is_pattern) : !pubkey_matcher_compile(key_matcher, reference, position, ignore_case, is_pattern)) {
+		return false;
+	}
+	init_pubkey_blob();
+	return true;
+}
+
+// Same as setup_mining for a search that scores the Devzat IDs with the
+// metric
+static bool setup_scoring(devzat_matcher* id_matcher, const char* metric, int target_score) {
+	if (!devzat_matcher_compile_metric(id_matcher, metric, target_score)) {
+		return false;
+	}
+	init_pubkey_blob();
+	return true;
+}
+
+// Format the key of the candidate at counter in the generation of the worker
+// in the keyspace of the job
+static char* format_candidate_key(const mining_job* job, unsigned int index, uint64_t generation, uint64_t counter) {
+	ed25519_counter_ctx candidates;
+	keyspace_worker_candidates(&job->space, index, generation, &candidates);
+	uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	uint8_t pubkey[CURVE_25519_PUBLIC_KEY_SIZE];
+	ed25519_counter_secret_key(privkey, &candidates, counter);
+	ed25519_public_key(pubkey, privkey);
+	char* ret = openssh_format_key(privkey, pubkey);
+	mem_clean(privkey, sizeof(privkey));
+	mem_clean(&candidates, sizeof(candidates));
+	return ret;
+}
+
+// Format the best near miss of the stopped workers, or return NULL if there
+// is none
+static char* format_best_key(const mining_job* job, const worker_arguments* args_list, unsigned int thread_number, mining_limits* limits) {
+	unsigned int best_index = 0;
+	for (unsigned int i=1; i<thread_number; i++) {
+		if (args_list[i].best.score > args_list[best_index].best.score) {
+			best_index = i;
+		}
+	}
+	const near_miss* best = &args_list[best_index].best;
+	if (!best->score) {
+		fprintf(stderr, "Error, the search stopped before finding a key.\n");
+		return NULL;
+	}
+	if (job->devzat_mode && job->id_matcher->metric) {
+		fprintf(stderr, "Warning, the search stopped before reaching the target score. The best key found scores %d.\n", best->score);
 	} else {
-		fprintf(stderr, "Warning, unable to read from the true random source. The generated key will be easy to crack.\n");
-		srand(time(NULL));
+		fprintf(stderr, "Warning, the search stopped before finding a matching key. The best key found matches %d %s of the reference.\n", best->score, job->devzat_mode ? "digits" : "characters");
 	}
-	fclose(f);
+	if (limits) {
+		limits->exhausted = true;
+		limits->best_score = best->score;
+	}
+	return format_candidate_key(job, best_index, best->generation, best->counter);
+}
+
+// Copy how far the workers are in the checkpoint
+static void save_progress(checkpoint* state, const worker_arguments* args_list, uint64_t elapsed) {
+	for (unsigned int i=0; i<state->worker_number; i++) {
+		state->done[i] = atomic_load_explicit(&args_list[i].done, memory_order_relaxed);
+	}
+	state->elapsed = elapsed;
+}
+
+// Run thread_number workers on the job until one finds a key, the limits run
+// out or the program is interrupted, and return the key found, or the best
+// near miss, formatted. Return NULL if there is none.
+// If state is not NULL, the workers continue from its done counts, and every
+// CHECKPOINT_INTERVAL seconds, and when the search stops without a key, it is
+// updated and written to checkpoint_path. The workers only publish how far
+// they are, so the checkpoints do not slow them down.
+static char* run_workers(mining_job* job, unsigned int thread_number, mining_limits* limits, checkpoint* state, const char* checkpoint_path) {
+	uint64_t max_time = limits ? limits->max_time : 0;
+	job->track_best = true;
+	thrd_t threads[thread_number];
+	worker_arguments* args_list = start_workers(job, threads, thread_number, state ? state->done : NULL, limits ? limits->max_attempts : 0);
+
+	// The first worker to find a key, the last to run out of attempts or the
+	// first to see an interruption wakes this thread up
+	time_t start = time(NULL);
+	uint64_t elapsed = state ? state->elapsed : 0;
+	bool stopped = false;
+	while (!stopped) {
+		uint64_t spent = (uint64_t) (time(NULL) - start);
+		if (max_time && spent >= max_time) {
+			mining_job_stop(job);
+		}
+		// Sleep until the next checkpoint or the end of the time budget
+		uint64_t wait = state ? CHECKPOINT_INTERVAL : 0;
+		if (max_time && spent < max_time && (!wait || max_time - spent < wait)) {
+			wait = max_time - spent;
+		}
+		if (wait) {
+			struct timespec deadline;
+			timespec_get(&deadline, TIME_UTC);
+			deadline.tv_sec += wait;
+			stopped = mining_job_wait_until(job, &deadline);
+		} else {
+			mining_job_wait(job);
+			stopped = true;
+		}
+		if (!stopped && state) {
+			save_progress(state, args_list, elapsed + (uint64_t) (time(NULL) - start));
+			checkpoint_write(state, checkpoint_path);
+		}
+	}
+	stop_workers(job, threads, thread_number);
+
+	char* ret;
+	if (job->winner >= 0) {
+		uint8_t pubkey[CURVE_25519_PUBLIC_KEY_SIZE];
+		ed25519_public_key(pubkey, args_list[job->winner].working_privkey);
+		ret = openssh_format_key(args_list[job->winner].working_privkey, pubkey);
+#ifndef QUIET_MATCHING
+		if (job->devzat_mode) {
+			print_found_key(job->id_matcher, args_list[job->winner].working_privkey);
+		}
+#endif
+	} else {
+		ret = format_best_key(job, args_list, thread_number, limits);
+		if (state) {
+			save_progress(state, args_list, elapsed + (uint64_t) (time(NULL) - start));
+			checkpoint_write(state, checkpoint_path);
+		}
+	}
+	free_workers(args_list, thread_number);
+	return ret;
 }
 
 // Generate the content of an openssh key file whose public key matches as a
 // Devzat hash the reference.
 // The data is malloced
-// This is not multi-threaded
-char* devzat_mining_mono(const char* reference, bool devzat_mode) {
-	if (!valid_hex(reference) && devzat_mode) {
-		fprintf(stderr, "Error, reference should be a valid hex number.\n");
+// This only uses one worker thread
+// If vartime is true, the candidates are derived in variable time.
+// The reference must be found at the given position of the Devzat ID or of
+// the base64 public key. In ssh-pubkey mode, its case is ignored if
+// ignore_case is true. If is_pattern is true, the reference is a pattern, as
+// described in pattern.h.
+// The candidates are derived from the KEYSPACE_SEED_SIZE bytes of seed, as
+// described in keyspace.h.
+// If limits is not NULL, the search stops after its maximum time or number of
+// attempts, as it does when devzat_mining_interrupt is called. The key of the
+// candidate with the most digits or characters of the reference, as scored by
+// devzat_matcher_score or pubkey_matcher_score, is then returned and
+// limits->exhausted is set.
+char* devzat_mining_mono(const char* reference, bool devzat_mode, bool vartime, match_position position, bool ignore_case, bool is_pattern, const uint8_t* seed, mining_limits* limits) {
+	return devzat_mining_multi(reference, 1, devzat_mode, vartime, position, ignore_case, is_pattern, seed, limits);
+}
+
+// Same as devzat_mining_mono but multithreaded
+char* devzat_mining_multi(const char* reference, unsigned int thread_number, bool devzat_mode, bool vartime, match_position position, bool ignore_case, bool is_pattern, const uint8_t* seed, mining_limits* limits) {
+	devzat_matcher id_matcher;
+	pubkey_matcher key_matcher;
+	if (!setup_mining(&id_matcher, &key_matcher, reference, devzat_mode, position, ignore_case, is_pattern)) {
 		return NULL;
 	}
-	seed_rng();
+	mining_job job;
+	mining_job_init(&job, &id_matcher, &key_matcher, NULL, devzat_mode, vartime, seed);
+	char* ret = run_workers(&job, thread_number, limits, NULL, NULL);
+	mining_job_destroy(&job);
+	return ret;
+}
+
+// Same as devzat_mining_multi, but continue the search of the checkpoint
+// with one worker per worker of the checkpoint, and update it in
+// checkpoint_path every CHECKPOINT_INTERVAL seconds and when the search stops
+// without a key.
+char* devzat_mining_checkpoint(checkpoint* state, bool vartime, const char* checkpoint_path, mining_limits* limits) {
+	devzat_matcher id_matcher;
+	pubkey_matcher key_matcher;
+	bool ok = state->is_metric ? setup_scoring(&id_matcher, state->reference, state->target_score) : setup_mining(&id_matcher, &key_matcher, state->reference, state->devzat_mode, state->position, state->ignore_case, state->is_pattern);
+	if (!ok) {
+		return NULL;
+	}
+	mining_job job;
+	mining_job_init(&job, &id_matcher, &key_matcher, NULL, state->devzat_mode, vartime, state->seed);
+	char* ret = run_workers(&job, state->worker_number, limits, state, checkpoint_path);
+	mining_job_destroy(&job);
+	return ret;
+}
+
+// Take a key whose Devzat ID matches the reference, or pattern if is_pattern
+// is true, at the given position out of the reservoir. Set keyfile to its
+// formatted key, or to NULL if the reservoir has none. Return false if the
+// reference is not valid.
+bool devzat_mining_take_reserved(reservoir* store, const char* reference, match_position position, bool is_pattern, char** keyfile) {
+	devzat_matcher id_matcher;
+	*keyfile = NULL;
+	if (!devzat_matcher_compile(&id_matcher, reference, position, is_pattern)) {
+		return false;
+	}
+	uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	if (reservoir_take(store, &id_matcher, privkey)) {
+		uint8_t pubkey[CURVE_25519_PUBLIC_KEY_SIZE];
+		ed25519_public_key(pubkey, privkey);
+		*keyfile = openssh_format_key(privkey, pubkey);
+		mem_clean(privkey, sizeof(privkey));
+		fprintf(stderr, "Key taken from the reservoir.\n");
+	}
+	return true;
+}
+
+// Search for the key whose Devzat ID has the best score for the metric, as
+// described in devzat_matcher.h, with thread_number workers that each keep
+// their best key. The search stops at the first key that scores at least
+// target_score, or, if target_score is 0 or is not reached, when the limits
+// run out or devzat_mining_interrupt is called. The best key is then
+// returned with limits->exhausted set and limits->best_score its score.
+// Return NULL if the metric is not valid.
+char* devzat_mining_score(const char* metric, int target_score, unsigned int thread_number, bool vartime, const uint8_t* seed, mining_limits* limits) {
+	devzat_matcher id_matcher;
+	if (!setup_scoring(&id_matcher, metric, target_score)) {
+		return NULL;
+	}
+	mining_job job;
+	mining_job_init(&job, &id_matcher, NULL, NULL, true, vartime, seed);
+	char* ret = run_workers(&job, thread_number, limits, NULL, NULL);
+	mining_job_destroy(&job);
+	return ret;
+}
+
+typedef struct {
+	mining_job* job;
+	const char* output_path;
+	uint64_t written;
+} writer_arguments;
+
+FILE* open_key_file(const char* path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	// An existing file keeps its mode otherwise
+	FILE* f = fd < 0 || fchmod(fd, 0600) ? NULL : fdopen(fd, "w");
+	if (!f && fd >= 0) {
+		close(fd);
+	}
+	return f;
+}
 
-	worker_arguments args = {
-		.reference = reference,
-		.finished = false,
-		.stop_force = false,
-		.devzat_mode = devzat_mode,
+void write_numbered_key(const char* keyfile, const char* output_path, uint64_t number) {
+	if (!output_path) {
+		fprintf(stdout, "%s", keyfile);
+		fflush(stdout);
+		return;
+	}
+	char path[strlen(output_path) + 22];
+	if (number) {
+		snprintf(path, sizeof(path), "%s.%llu", output_path, (unsigned long long) number);
+	} else {
+		snprintf(path, sizeof(path), "%s", output_path);
+	}
+	FILE* f = open_key_file(path);
+	if (!f) {
+		fprintf(stderr, "Error, unable to open output file %s.\n", path);
+		return;
+	}
+	fprintf(f, "%s", keyfile);
+	fclose(f);
+	fprintf(stderr, "Key written to %s.\n", path);
+}
+
+// Pop the keys pushed by the workers of the job as they arrive and write
+// them, until the results queue has all the keys it wants, or forever if it
+// has no limit. Sleep while the queue is empty.
+// If the program is interrupted, write the keys already pushed once all the
+// workers stopped, then return, so that a key file is never left half
+// written.
+static void key_writer(writer_arguments* args) {
+	mining_job* job = args->job;
+	uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	uint8_t pubkey[CURVE_25519_PUBLIC_KEY_SIZE];
+	while (!job->results->wanted || args->written < job->results->wanted) {
+		mtx_lock(&job->lock);
+		bool popped;
+		while (!(popped = result_queue_pop(job->results, privkey)) && !(atomic_load(&interrupted) && !job->running)) {
+			cnd_wait(&job->changed, &job->lock);
+		}
+		mtx_unlock(&job->lock);
+		if (!popped) {
+			break;
+		}
+#ifndef QUIET_MATCHING
+		if (job->devzat_mode) {
+			print_found_key(job->id_matcher, privkey);
+		}
+#endif
+		ed25519_public_key(pubkey, privkey);
+		char* keyfile = openssh_format_key(privkey, pubkey);
+		mem_clean(privkey, sizeof(privkey));
+		write_numbered_key(keyfile, args->output_path, ++args->written);
+		mem_clean(keyfile, strlen(keyfile));
+		free(keyfile);
+	}
+}
+
+// Same as devzat_mining_multi, but the workers keep mining after a match and
+// this thread writes count keys, or keys forever if count is 0, as they
+// are found. They are written to stdout, or to output_path.1,
+// output_path.2... if output_path is not NULL.
+// Return false if the reference is not valid.
+bool devzat_mining_stream(const char* reference, unsigned int thread_number, bool devzat_mode, bool vartime, match_position position, bool ignore_case, bool is_pattern, uint64_t count, const char* output_path, const uint8_t* seed) {
+	devzat_matcher id_matcher;
+	pubkey_matcher key_matcher;
+	if (!setup_mining(&id_matcher, &key_matcher, reference, devzat_mode, position, ignore_case, is_pattern)) {
+		return false;
+	}
+	result_queue results;
+	result_queue_init(&results, count);
+	mining_job job;
+	mining_job_init(&job, &id_matcher, &key_matcher, &results, devzat_mode, vartime, seed);
+	thrd_t threads[thread_number];
+	worker_arguments* args_list = start_workers(&job, threads, thread_number, NULL, 0);
+
+	writer_arguments writer_args = {
+		.job = &job,
+		.output_path = output_path,
+		.written = 0,
 	};
-	key_mining_worker(&args);
+	key_writer(&writer_args);
+
+	stop_workers(&job, threads, thread_number);
+	free_workers(args_list, thread_number);
+	mining_job_destroy(&job);
+	mem_clean(&results, sizeof(results));
+	return true;
+}
+
+typedef struct {
+	target_index* targets;
+	bool vartime;
+	keyspace space;
+	atomic_uint next_index; // Index in the keyspace of the next worker to start
+} batch_worker_arguments;
+
+// Write the key of the candidate at counter to the file of the target, unless
+// another worker already found one for it. Return true if it is written.
+static bool save_target_key(batch_worker_arguments* args, int target_number, const ed25519_counter_ctx* candidates, uint64_t counter, const uint32_t* hash_words) {
+	target* t = &args->targets->targets[target_number];
+	if (atomic_exchange_explicit(&t->found, true, memory_order_relaxed)) {
+		return false;
+	}
 
+	uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
 	uint8_t pubkey[CURVE_25519_PUBLIC_KEY_SIZE];
-	ed25519_public_key(pubkey, args.working_privkey);
+	ed25519_counter_secret_key(privkey, candidates, counter);
+	ed25519_public_key(pubkey, privkey);
+	char* keyfile = openssh_format_key(privkey, pubkey);
+	mem_clean(privkey, sizeof(privkey));
+	FILE* f = open_key_file(t->output);
+	if (f) {
+		fprintf(f, "%s", keyfile);
+		fclose(f);
+	} else {
+		fprintf(stderr, "Error, unable to open output file %s for target %s.\n", t->output, t->reference);
+	}
+	mem_clean(keyfile, strlen(keyfile));
+	free(keyfile);
+#ifndef QUIET_MATCHING
+	char* hash_str = format_hash(hash_words);
+	fprintf(stderr, "Found key giving the ID %s for target %s, written to %s.\n", hash_str, t->reference, t->output);
+	free(hash_str);
+#else
+	(void) hash_words;
+#endif
+	atomic_fetch_sub_explicit(&args->targets->remaining, 1, memory_order_release);
+	return true;
+}
 
-	return openssh_format_key(args.working_privkey, pubkey);
+// Same as key_mining_worker, but check the Devzat ID of each candidate
+// against all the targets not found yet, and save a key for each target
+// that is matched. The targets are meant for different users, so the worker
+// moves to its next generation after each key saved, and skips the rest of
+// its batch. Finish once all the targets are found, or after the current
+// batch if the program is interrupted.
+static void batch_mining_worker(batch_worker_arguments* args) {
+	uint8_t (*pubkeys)[CURVE_25519_PUBLIC_KEY_SIZE] = malloc(CURVE_25519_PUBLIC_KEY_SIZE * MINING_BATCH_SIZE);
+	ed25519_counter_ctx candidates;
+	unsigned int index = atomic_fetch_add_explicit(&args->next_index, 1, memory_order_relaxed);
+	uint64_t generation = 0;
+	uint64_t counter = keyspace_worker_candidates(&args->space, index, generation, &candidates);
+	while (atomic_load_explicit(&args->targets->remaining, memory_order_acquire) && !atomic_load_explicit(&interrupted, memory_order_relaxed)) {
+		if (args->vartime) {
+			ed25519_public_key_counter_batch_vartime(pubkeys, &candidates, counter, MINING_BATCH_SIZE);
+		} else {
+			ed25519_public_key_counter_batch(pubkeys, &candidates, counter, MINING_BATCH_SIZE);
+		}
+		bool saved = false;
+		for (int i=0; i<MINING_BATCH_SIZE && !saved; i+=DEVZAT_CHECK_BATCH) {
+			uint32_t hashes[DEVZAT_CHECK_BATCH][CF_SHA256_HASHSZ / 4];
+			devzat_ids((const uint8_t (*)[CURVE_25519_PUBLIC_KEY_SIZE]) pubkeys + i, hashes);
+			for (int j=0; j<DEVZAT_CHECK_BATCH && !saved; j++) {
+				int target_number = target_index_match(args->targets, hashes[j]);
+				if (target_number >= 0) {
+					saved = save_target_key(args, target_number, &candidates, counter + i + j, hashes[j]);
+				}
+			}
+		}
+		if (saved) {
+			counter = keyspace_worker_candidates(&args->space, index, ++generation, &candidates);
+		} else {
+			counter += MINING_BATCH_SIZE;
+		}
+	}
+	mem_clean(&candidates, sizeof(candidates));
+	mem_clean(&counter, sizeof(counter));
+	free(pubkeys);
 }
 
-#define ever ;;
+// Wrapper for batch_mining_worker which is of type thrd_start_t
+static int batch_mining_worker_wrap(void* args) {
+	batch_mining_worker((batch_worker_arguments*) args);
+	return 0;
+}
 
-// Same as devzat_mining_mono but multithreaded
-char* devzat_mining_multi(const char* reference, unsigned int thread_number, bool devzat_mode) {
-	if (!valid_hex(reference) && devzat_mode) {
-		fprintf(stderr, "Error, reference should be a valid hex number.\n");
-		return NULL;
+// Mine a key for each of the Devzat ID references of the targets file, found
+// at the given position, and write each key in the file given for its
+// target. All the threads derive candidates that are checked against all the
+// targets at once, so that the targets share the cost of the derivation.
+// Return false if the targets file is not valid.
+bool devzat_mining_batch(const char* targets_file, unsigned int thread_number, bool vartime, match_position position, const uint8_t* seed) {
+	target_index targets;
+	if (!target_index_load(&targets, targets_file, position)) {
+		return false;
 	}
-	seed_rng();
-	char* ret = NULL;
+	init_pubkey_blob();
 
-	// Making the threads
+	batch_worker_arguments args = {
+		.targets = &targets,
+		.vartime = vartime,
+	};
+	keyspace_init(&args.space, seed);
+	atomic_init(&args.next_index, 0);
 	thrd_t threads[thread_number];
-	worker_arguments** args_list = malloc(sizeof(worker_arguments*) * thread_number);
-	for (unsigned int i=0; i<thread_number; i++) {
-		args_list[i] = malloc(sizeof(worker_arguments));
-		args_list[i]->reference = reference;
-		args_list[i]->finished = false;
-		args_list[i]->stop_force = false;
-		args_list[i]->devzat_mode = devzat_mode;
-
-		thrd_create(&threads[i], key_mining_worker_wrap, args_list[i]);
-	}
-
-	// Waiting for one thread to finish
-	for(ever) {
-		for (unsigned int i=0; i<thread_number; i++) {
-			if (args_list[i]->finished) {
-				uint8_t pubkey[CURVE_25519_PUBLIC_KEY_SIZE];
-				ed25519_public_key(pubkey, args_list[i]->working_privkey);
-				ret = openssh_format_key(args_list[i]->working_privkey, pubkey);
-				goto end_loop;
+	for (unsigned int i=1; i<thread_number; i++) {
+		thrd_create(&threads[i], batch_mining_worker_wrap, &args);
+	}
+	batch_mining_worker(&args);
+	for (unsigned int i=1; i<thread_number; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	mem_clean(&args.space, sizeof(keyspace));
+	target_index_free(&targets);
+	return true;
+}
+
+// A slot of the pool, mining for one reference. Its fields are set before
+// its bit is set in the active slots of the pool, and are only read by the
+// workers until it is removed and no worker can still see it.
+typedef struct {
+	devzat_matcher id_matcher;
+	pubkey_matcher key_matcher;
+	bool devzat_mode;
+	result_queue results;
+	bool used;               // Protected by the lock of the pool
+	uint64_t retired_version; // Version of the pool when the slot was removed. Protected by the lock of the pool.
+} pool_slot;
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) mining_pool* pool;
+	unsigned int index;
+	// Version of the pool when the worker last read the active slots, or
+	// UINT64_MAX while it waits for a slot
+	_Atomic uint64_t seen;
+} pool_worker_arguments;
+
+struct mining_pool {
+	bool vartime;
+	keyspace space;
+	void (*notify)(void*);
+	void* notify_argument;
+	unsigned int worker_number;
+	thrd_t* threads;
+	pool_worker_arguments* workers;
+	// Bits of the slots being mined, and of those in Devzat ID mode. The
+	// version is incremented after each change, so that the workers tell
+	// when they may still use a removed slot.
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t active;
+	_Atomic uint64_t devzat_slots;
+	_Atomic uint64_t version;
+	atomic_bool stop;
+	mtx_t lock;
+	cnd_t changed; // Signaled when a slot is added or when the pool stops
+	pool_slot slot[MINING_POOL_SLOTS];
+};
+
+// Pin the calling worker to one of the CPUs it is allowed on, so that its
+// caches stay warm between the jobs
+static void pin_worker(unsigned int index) {
+#ifdef __linux__
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		return;
+	}
+	int n = index % CPU_COUNT(&allowed);
+	for (int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed) && !n--) {
+			cpu_set_t pinned;
+			CPU_ZERO(&pinned);
+			CPU_SET(cpu, &pinned);
+			sched_setaffinity(0, sizeof(pinned), &pinned);
+			return;
+		}
+	}
+#else
+	(void) index;
+#endif
+}
+
+// Push the key of the candidate at counter to the results of the slot.
+// Return false if the slot has all the keys it wants or if its results are
+// full, in which case the key is dropped rather than waiting for the server,
+// so that the other slots are not held up.
+static bool keep_pool_key(mining_pool* pool, int slot_index, const ed25519_counter_ctx* candidates, uint64_t counter) {
+	pool_slot* slot = &pool->slot[slot_index];
+	if (!result_queue_claim(&slot->results)) {
+		return false;
+	}
+	uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	ed25519_counter_secret_key(privkey, candidates, counter);
+	bool pushed = result_queue_try_push(&slot->results, privkey);
+	mem_clean(privkey, sizeof(privkey));
+	if (pushed) {
+		pool->notify(pool->notify_argument);
+	} else {
+		result_queue_unclaim(&slot->results);
+	}
+	return pushed;
+}
+
+// First of the active slots after the given one, in circular order. There
+// must be an active slot.
+static int next_active_slot(uint64_t active, int slot) {
+	int shift = (slot + 1) % MINING_POOL_SLOTS;
+	uint64_t rotated = shift ? (active >> shift) | (active << (MINING_POOL_SLOTS - shift)) : active;
+	return (shift + __builtin_ctzll(rotated)) % MINING_POOL_SLOTS;
+}
+
+// Same as key_mining_worker, but check the candidates against all the
+// active slots of the pool. The slots are for different clients, so a batch
+// gives at most one key, after which the worker moves to its next
+// generation, as described in keyspace.h. The slots take turns to be the
+// first to look for a matching candidate in a batch, so that a slot matched
+// by most candidates does not get all the keys.
+// Wait while there is no active slot, until the pool stops.
+static void pool_worker(pool_worker_arguments* args) {
+	mining_pool* pool = args->pool;
+	pin_worker(args->index);
+	uint8_t (*pubkeys)[CURVE_25519_PUBLIC_KEY_SIZE] = malloc(CURVE_25519_PUBLIC_KEY_SIZE * MINING_BATCH_SIZE);
+	uint32_t (*hashes)[CF_SHA256_HASHSZ / 4] = malloc(CF_SHA256_HASHSZ * MINING_BATCH_SIZE);
+	ed25519_counter_ctx candidates;
+	uint64_t generation = 0;
+	uint64_t counter = keyspace_worker_candidates(&pool->space, args->index, generation, &candidates);
+	int first_slot = MINING_POOL_SLOTS - 1;
+	while (!atomic_load_explicit(&pool->stop, memory_order_acquire)) {
+		atomic_store(&args->seen, atomic_load(&pool->version));
+		uint64_t active = atomic_load(&pool->active);
+		if (!active) {
+			mtx_lock(&pool->lock);
+			atomic_store(&args->seen, UINT64_MAX);
+			while (!atomic_load(&pool->active) && !atomic_load(&pool->stop)) {
+				cnd_wait(&pool->changed, &pool->lock);
+			}
+			mtx_unlock(&pool->lock);
+			continue;
+		}
+		bool hash_ids = active & atomic_load(&pool->devzat_slots);
+		if (pool->vartime) {
+			ed25519_public_key_counter_batch_vartime(pubkeys, &candidates, counter, MINING_BATCH_SIZE);
+		} else {
+			ed25519_public_key_counter_batch(pubkeys, &candidates, counter, MINING_BATCH_SIZE);
+		}
+		for (int i=0; hash_ids && i<MINING_BATCH_SIZE; i+=DEVZAT_CHECK_BATCH) {
+			devzat_ids((const uint8_t (*)[CURVE_25519_PUBLIC_KEY_SIZE]) pubkeys + i, hashes + i);
+		}
+		first_slot = next_active_slot(active, first_slot);
+		bool given = false;
+		for (int k=0; k<MINING_POOL_SLOTS && !given; k++) {
+			int s = (first_slot + k) % MINING_POOL_SLOTS;
+			if (!(active & ((uint64_t) 1 << s))) {
+				continue;
 			}
+			// The first candidate that matches goes to the slot, or nowhere if
+			// the slot has no room for it
+			const pool_slot* slot = &pool->slot[s];
+			for (int i=0; i<MINING_BATCH_SIZE; i++) {
+				if (slot->devzat_mode ? devzat_matcher_match(&slot->id_matcher, hashes[i]) >= 0 : pubkey_matcher_match(&slot->key_matcher, pubkeys[i])) {
+					given = keep_pool_key(pool, s, &candidates, counter + i);
+					break;
+				}
+			}
+		}
+		if (given) {
+			counter = keyspace_worker_candidates(&pool->space, args->index, ++generation, &candidates);
+		} else {
+			counter += MINING_BATCH_SIZE;
 		}
-		sleep(1);
 	}
-end_loop:
-	// Closing all threads
+	atomic_store(&args->seen, UINT64_MAX);
+	mem_clean(&candidates, sizeof(candidates));
+	mem_clean(&counter, sizeof(counter));
+	free(hashes);
+	free(pubkeys);
+}
+
+// Wrapper for pool_worker which is of type thrd_start_t
+static int pool_worker_wrap(void* args) {
+	pool_worker((pool_worker_arguments*) args);
+	return 0;
+}
+
+mining_pool* mining_pool_start(unsigned int thread_number, bool vartime, const uint8_t* seed, void (*notify)(void*), void* notify_argument) {
+	init_pubkey_blob();
+	mining_pool* pool = aligned_alloc(CACHE_LINE_SIZE, sizeof(mining_pool));
+	memset(pool, 0, sizeof(mining_pool));
+	pool->vartime = vartime;
+	keyspace_init(&pool->space, seed);
+	pool->notify = notify;
+	pool->notify_argument = notify_argument;
+	atomic_init(&pool->active, 0);
+	atomic_init(&pool->devzat_slots, 0);
+	atomic_init(&pool->version, 0);
+	atomic_init(&pool->stop, false);
+	mtx_init(&pool->lock, mtx_plain);
+	cnd_init(&pool->changed);
+	pool->worker_number = thread_number;
+	pool->threads = malloc(sizeof(thrd_t) * thread_number);
+	pool->workers = aligned_alloc(CACHE_LINE_SIZE, sizeof(pool_worker_arguments) * thread_number);
 	for (unsigned int i=0; i<thread_number; i++) {
-		args_list[i]->stop_force = true;
-		thrd_join(threads[i], NULL);
-		free(args_list[i]);
+		memset(&pool->workers[i], 0, sizeof(pool_worker_arguments));
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+		atomic_init(&pool->workers[i].seen, UINT64_MAX);
+		thrd_create(&pool->threads[i], pool_worker_wrap, &pool->workers[i]);
 	}
-	free(args_list);
+	return pool;
+}
 
-	return ret;
+bool mining_pool_check(const char* reference, bool devzat_mode, match_position position, bool ignore_case, bool is_pattern) {
+	devzat_matcher* id_matcher = malloc(sizeof(devzat_matcher));
+	pubkey_matcher* key_matcher = malloc(sizeof(pubkey_matcher));
+	bool ok = devzat_mode ? devzat_matcher_compile(id_matcher, reference, position, is_pattern) : pubkey_matcher_compile(key_matcher, reference, position, ignore_case, is_pattern);
+	free(id_matcher);
+	free(key_matcher);
+	return ok;
 }
 
+// Return true if no worker can still use the slot
+static bool pool_slot_free(const mining_pool* pool, const pool_slot* slot) {
+	if (slot->used) {
+		return false;
+	}
+	for (unsigned int i=0; i<pool->worker_number; i++) {
+		if (atomic_load(&pool->workers[i].seen) < slot->retired_version) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int mining_pool_add(mining_pool* pool, const char* reference, bool devzat_mode, match_position position, bool ignore_case, bool is_pattern, uint64_t count) {
+	mtx_lock(&pool->lock);
+	int found = -1;
+	for (int i=0; i<MINING_POOL_SLOTS && found < 0; i++) {
+		if (pool_slot_free(pool, &pool->slot[i])) {
+			found = i;
+		}
+	}
+	pool_slot* slot = &pool->slot[found < 0 ? 0 : found];
+	if (found < 0 || !(devzat_mode ? devzat_matcher_compile(&slot->id_matcher, reference, position, is_pattern) : pubkey_matcher_compile(&slot->key_matcher, reference, position, ignore_case, is_pattern))) {
+		mtx_unlock(&pool->lock);
+		return -1;
+	}
+	slot->devzat_mode = devzat_mode;
+	result_queue_init(&slot->results, count);
+	slot->used = true;
+	uint64_t bit = (uint64_t) 1 << found;
+	if (devzat_mode) {
+		atomic_fetch_or(&pool->devzat_slots, bit);
+	} else {
+		atomic_fetch_and(&pool->devzat_slots, ~bit);
+	}
+	atomic_fetch_or(&pool->active, bit);
+	atomic_fetch_add(&pool->version, 1);
+	cnd_broadcast(&pool->changed);
+	mtx_unlock(&pool->lock);
+	return found;
+}
+
+bool mining_pool_pop(mining_pool* pool, int slot, uint8_t* privkey) {
+	return result_queue_pop(&pool->slot[slot].results, privkey);
+}
+
+void mining_pool_remove(mining_pool* pool, int slot) {
+	mtx_lock(&pool->lock);
+	atomic_fetch_and(&pool->active, ~((uint64_t) 1 << slot));
+	pool->slot[slot].retired_version = atomic_fetch_add(&pool->version, 1) + 1;
+	pool->slot[slot].used = false;
+	mtx_unlock(&pool->lock);
+	// The keys found but not given out yet are wiped when the slot is added
+	// again, or when the pool stops
+}
+
+void mining_pool_stop(mining_pool* pool) {
+	mtx_lock(&pool->lock);
+	atomic_store(&pool->stop, true);
+	cnd_broadcast(&pool->changed);
+	mtx_unlock(&pool->lock);
+	for (unsigned int i=0; i<pool->worker_number; i++) {
+		thrd_join(pool->threads[i], NULL);
+	}
+	cnd_destroy(&pool->changed);
+	mtx_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool->workers);
+	mem_clean(pool, sizeof(mining_pool));
+	free(pool);
+}
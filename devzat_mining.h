@@ -2,9 +2,84 @@
 #define _DEVZAT_MINING_H_
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "match_position.h"
+#include "checkpoint.h"
+#include "reservoir.h"
 
-char* devzat_mining_mono(const char* reference, bool devzat_mode);
-char* devzat_mining_multi(const char* reference, unsigned int thread_number, bool devzat_mode);
+// Limits of a search for a single key. When one runs out, or when
+// devzat_mining_interrupt is called, the search stops and returns the best
+// key it tried, if any, with exhausted set.
+typedef struct {
+	uint64_t max_time;     // Seconds, 0 for no limit
+	uint64_t max_attempts; // Candidates tried by all the threads, 0 for no limit
+	bool exhausted;
+	int best_score;        // Number of digits or characters of the reference matched by the returned key, or its score for a metric, when exhausted
+} mining_limits;
+
+char* devzat_mining_mono(const char* reference, bool devzat_mode, bool vartime, match_position position, bool ignore_case, bool is_pattern, const uint8_t* seed, mining_limits* limits);
+char* devzat_mining_multi(const char* reference, unsigned int thread_number, bool devzat_mode, bool vartime, match_position position, bool ignore_case, bool is_pattern, const uint8_t* seed, mining_limits* limits);
+char* devzat_mining_checkpoint(checkpoint* state, bool vartime, const char* checkpoint_path, mining_limits* limits);
+char* devzat_mining_score(const char* metric, int target_score, unsigned int thread_number, bool vartime, const uint8_t* seed, mining_limits* limits);
+bool devzat_mining_stream(const char* reference, unsigned int thread_number, bool devzat_mode, bool vartime, match_position position, bool ignore_case, bool is_pattern, uint64_t count, const char* output_path, const uint8_t* seed);
+
+bool devzat_mining_batch(const char* targets_file, unsigned int thread_number, bool vartime, match_position position, const uint8_t* seed);
+
+// Open the file at path to write a private key in it, readable only by the
+// user. Return NULL if it can not be opened.
+FILE* open_key_file(const char* path);
+
+// Write a key file to stdout, or to output_path followed by its number if
+// number is not 0
+void write_numbered_key(const char* keyfile, const char* output_path, uint64_t number);
+
+// Number of references that a mining pool can mine at once
+#define MINING_POOL_SLOTS 64
+
+// A pool of workers, pinned to the CPUs, that derive candidates from the
+// same keyspace for as long as it runs, and check each of them against all
+// the references mined at once. Each reference has a slot, which gets the
+// keys that match it. A worker gives at most one key of each batch of
+// candidates, to the first slot that it matches, the slots taking turns to
+// be first, and then moves to a fresh prefix, so that no two keys of the
+// pool share a prefix. A key is dropped when its slot has no room left.
+typedef struct mining_pool mining_pool;
+
+// Start thread_number workers, which wait for references. notify is called
+// with notify_argument by the workers after a key is pushed to a slot.
+mining_pool* mining_pool_start(unsigned int thread_number, bool vartime, const uint8_t* seed, void (*notify)(void*), void* notify_argument);
+
+// Return false if the reference can not be mined, after printing an error
+bool mining_pool_check(const char* reference, bool devzat_mode, match_position position, bool ignore_case, bool is_pattern);
+
+// Start mining for count keys of the reference, or keys until it is removed
+// if count is 0, in a free slot. Return the slot, or -1 if all the slots
+// are used, or are still used by the workers.
+int mining_pool_add(mining_pool* pool, const char* reference, bool devzat_mode, match_position position, bool ignore_case, bool is_pattern, uint64_t count);
+
+// Pop a key found for the slot into privkey. Return false if there is none.
+// Only one thread can pop the keys of a slot.
+bool mining_pool_pop(mining_pool* pool, int slot, uint8_t* privkey);
+
+// Stop mining for the reference of the slot
+void mining_pool_remove(mining_pool* pool, int slot);
+
+// Stop the workers and free the pool
+void mining_pool_stop(mining_pool* pool);
+
+bool devzat_mining_take_reserved(reservoir* store, const char* reference, match_position position, bool is_pattern, char** keyfile);
+
+// Offer the candidates that the following searches in Devzat ID mode try and
+// reject to the reservoir, or stop offering them if store is NULL. The
+// matching keys and the near misses that may be given out are never
+// offered.
+void devzat_mining_feed_reservoir(reservoir* store);
+
+// Stop the searches after the current batch of candidates. Streams and
+// batches still finish writing the keys already found. It can be called from
+// a signal handler.
+void devzat_mining_interrupt(void);
 
 #endif
 
@@ -0,0 +1,324 @@
+// Checks that all the ways monocypher.c derives public keys give the same
+// keys, on pseudo-random inputs:
+//  - without the fixed-base table, comb_recode() against the multiplication
+//    by 1/2 modulo L that it replaced, on clamped scalars and on scalars
+//    reduced modulo L;
+//  - the batches sharing one field inversion, their variable-time variant
+//    and the counter keys, against crypto_sign_public_key().  They use the
+//    4-way AVX2 code when the CPU has it.
+// The reference public keys are hashed together and the digest is compared
+// to the one of the original monocypher code, so that the radix 2^51 and
+// radix 2^25.5 field arithmetic are both checked against it.
+//
+// This program is compiled with the same CFLAGS as monocypher.c, and built
+// and run for each configuration by `make check`.  It exits with 1 on the
+// first mismatch.
+
+#include "monocypher.c"
+#include <stdio.h>
+#include <string.h>
+
+// Number of clamped scalars, and of scalars reduced modulo L, run through
+// both recodings
+#define RECODE_CHECKS 300000
+// Number of secret keys of each kind run through each batch function
+#define KEY_CHECKS    100000
+// Keys per batch call: more than SIGN_BATCH_SIZE, and not a multiple of 4,
+// so that the chunks and the keys left after the 4-way code are covered
+#define KEY_BATCH     1027
+
+// SHA-512 of the public keys of the KEY_CHECKS secret keys and of the
+// KEY_CHECKS counter keys, as computed by the original monocypher code
+static const char reference_digest[] =
+    "fb2bdb0474420ef3de0a1ab8a36c8ebf6548344f6ce1306eab0f2b0cb3ed1ffc"
+    "eeab6fce634d75916470a14c10b4bc114df56685e94c0f38d821abcf274df61a";
+
+static const struct {
+    const char *secret_key;
+    const char *public_key;
+} rfc8032_vectors[] = {
+    {"9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60",
+     "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a"},
+    {"4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb",
+     "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c"},
+    {"c5aa8df43f9f837bedb7442f31dcb7b166d38535076f094b85ce3a2e0b4458f7",
+     "fc51cd8e6218a1a38da47ed00230f0580816ed13ba3303ac5deb911548908025"},
+};
+
+// splitmix64: the inputs only need to be the same in every configuration.
+// Each check starts from its own seed.
+static u64 rng_state;
+
+static u64 rng_next(void)
+{
+    u64 z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static void rng_bytes(u8 *buf, size_t size)
+{
+    FOR (i, 0, size) {
+        if (i % 8 == 0) {
+            u64 r = rng_next();
+            FOR (j, 0, MIN(8, size - i)) {
+                buf[i + j] = (u8)(r >> (8 * j));
+            }
+        }
+    }
+}
+
+static void parse_hex(u8 *buf, const char *hex, size_t size)
+{
+    FOR (i, 0, size) {
+        unsigned int byte;
+        sscanf(hex + 2 * i, "%2x", &byte);
+        buf[i] = (u8)byte;
+    }
+}
+
+static void print_hex(const char *label, const u8 *buf, size_t size)
+{
+    printf("%s", label);
+    FOR (i, 0, size) {
+        printf("%02x", buf[i]);
+    }
+    printf("\n");
+}
+
+static int check_rfc8032(void)
+{
+    FOR (i, 0, sizeof(rfc8032_vectors) / sizeof(rfc8032_vectors[0])) {
+        u8 secret_key[32], expected[32], public_key[32];
+        parse_hex(secret_key, rfc8032_vectors[i].secret_key, 32);
+        parse_hex(expected  , rfc8032_vectors[i].public_key, 32);
+        crypto_sign_public_key(public_key, secret_key);
+        if (memcmp(public_key, expected, 32)) {
+            printf("RFC 8032 test %zu: wrong public key\n", i + 1);
+            print_hex("  expected: ", expected  , 32);
+            print_hex("  got:      ", public_key, 32);
+            return 1;
+        }
+    }
+    printf("RFC 8032 public keys: ok\n");
+    return 0;
+}
+
+#ifndef USE_BASE_TABLE
+// The recoding of ge_scalarmult_base() before comb_recode()
+static void old_comb_recode(u8 s_scalar[32], const u8 scalar[32])
+{
+    static const u8 half_mod_L[32] = { // 1 / 2 modulo L
+        0xf7, 0xe9, 0x7a, 0x2e, 0x8d, 0x31, 0x09, 0x2c,
+        0x6b, 0xce, 0x7b, 0x51, 0xef, 0x7c, 0x6f, 0x0a,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
+    };
+    static const u8 half_ones[32] = { // (2^255 - 1) / 2 modulo L
+        0x42, 0x9a, 0xa3, 0xba, 0x23, 0xa5, 0xbf, 0xcb,
+        0x11, 0x5b, 0x9d, 0xc5, 0x74, 0x95, 0xf3, 0xb6,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x07,
+    };
+    mul_add(s_scalar, scalar, half_mod_L, half_ones);
+}
+
+// ge_scalarmult_base() as it was before comb_recode()
+static void old_scalarmult_base(ge *p, const u8 scalar[32])
+{
+    u8 s_scalar[32];
+    old_comb_recode(s_scalar, scalar);
+
+    fe yp, ym, t2, n2, a;
+    ge dbl;
+    ge_zero(p);
+    for (int i = 50; i >= 0; i--) {
+        if (i < 50) {
+            ge_double(p, p, &dbl);
+        }
+        fe_1(yp);
+        fe_1(ym);
+        fe_0(t2);
+        u8 teeth = (u8)((scalar_bit(s_scalar, i)           ) +
+                        (scalar_bit(s_scalar, i +  51) << 1) +
+                        (scalar_bit(s_scalar, i + 102) << 2) +
+                        (scalar_bit(s_scalar, i + 153) << 3) +
+                        (scalar_bit(s_scalar, i + 204) << 4));
+        u8 high  = teeth >> 4;
+        u8 index = (teeth ^ (high - 1)) & 15;
+        FOR (j, 0, 16) {
+            i32 select = 1 & (((j ^ index) - 1) >> 8);
+            fe_ccopy(yp, comb_Yp[j], select);
+            fe_ccopy(ym, comb_Ym[j], select);
+            fe_ccopy(t2, comb_T2[j], select);
+        }
+        fe_neg(n2, t2);
+        fe_cswap(t2, n2, high);
+        fe_cswap(yp, ym, high);
+        ge_madd(p, p, ym, yp, n2, a, t2);
+    }
+}
+
+// Recode the scalar both ways, and compare the public keys they give.  The
+// new comb scalar is not reduced modulo L, so it is only compared to the old
+// one modulo L.
+static int check_recoding(const u8 scalar[32])
+{
+    u8 s_new[64] = {0}, s_old[32], key_new[32], key_old[32];
+    ge A;
+    comb_recode    (s_new, scalar);
+    old_comb_recode(s_old, scalar);
+    ge_scalarmult_base (&A, scalar);
+    ge_tobytes(key_new, &A);
+    old_scalarmult_base(&A, scalar);
+    ge_tobytes(key_old, &A);
+    reduce(s_new);
+    if (memcmp(s_new, s_old, 32) || memcmp(key_new, key_old, 32)) {
+        print_hex("comb_recode() mismatch for scalar ", scalar, 32);
+        print_hex("  old comb scalar: ", s_old  , 32);
+        print_hex("  new comb scalar: ", s_new  , 32); // modulo L
+        print_hex("  old public key:  ", key_old, 32);
+        print_hex("  new public key:  ", key_new, 32);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_recodings(void)
+{
+    rng_state = 1;
+    FOR (i, 0, RECODE_CHECKS) {
+        u8 scalar[32];
+        rng_bytes(scalar, 32);
+        trim_scalar(scalar);
+        if (check_recoding(scalar)) {
+            return 1;
+        }
+    }
+    FOR (i, 0, RECODE_CHECKS) {
+        u8 scalar[64];
+        rng_bytes(scalar, 64);
+        reduce(scalar);
+        if (check_recoding(scalar)) {
+            return 1;
+        }
+    }
+    printf("comb_recode() against mul_add(): %d clamped and %d reduced "
+           "scalars ok\n", RECODE_CHECKS, RECODE_CHECKS);
+    return 0;
+}
+#endif // USE_BASE_TABLE
+
+static int compare_keys(const char *name, u8 expected[][32], u8 got[][32],
+                        const u8 secret_keys[][32], size_t count)
+{
+    FOR (i, 0, count) {
+        if (memcmp(expected[i], got[i], 32)) {
+            printf("%s: wrong public key\n", name);
+            print_hex("  secret key: ", secret_keys[i], 32);
+            print_hex("  expected:   ", expected[i]   , 32);
+            print_hex("  got:        ", got[i]        , 32);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_batches(void)
+{
+    static u8 secret_keys[KEY_BATCH][32];
+    static u8 expected   [KEY_BATCH][32];
+    static u8 got        [KEY_BATCH][32];
+    HASH_CTX digest_ctx;
+    HASH_INIT(&digest_ctx);
+    rng_state = 0x6d696e696e672d64; // as for reference_digest
+    for (size_t done = 0; done < KEY_CHECKS; done += KEY_BATCH) {
+        size_t count = MIN(KEY_BATCH, KEY_CHECKS - done);
+        rng_bytes(secret_keys[0], count * 32);
+        FOR (i, 0, count) {
+            crypto_sign_public_key(expected[i], secret_keys[i]);
+        }
+        HASH_UPDATE(&digest_ctx, expected, count * 32);
+        crypto_sign_public_key_batch(got, secret_keys, count);
+        if (compare_keys("crypto_sign_public_key_batch()",
+                         expected, got, secret_keys, count)) {
+            return 1;
+        }
+        crypto_sign_public_key_batch_vartime(got, secret_keys, count);
+        if (compare_keys("crypto_sign_public_key_batch_vartime()",
+                         expected, got, secret_keys, count)) {
+            return 1;
+        }
+    }
+    for (size_t done = 0; done < KEY_CHECKS; done += KEY_BATCH) {
+        size_t count = MIN(KEY_BATCH, KEY_CHECKS - done);
+        u8 prefix[24];
+        rng_bytes(prefix, 24);
+        // Some batches carry into the upper bytes of the counter
+        u64 counter = rng_next() | 0xffffffffffffff00;
+        crypto_sign_counter_ctx ctx;
+        crypto_sign_counter_init(&ctx, prefix);
+        FOR (i, 0, count) {
+            crypto_sign_counter_secret_key(secret_keys[i], &ctx, counter + i);
+            crypto_sign_public_key(expected[i], secret_keys[i]);
+        }
+        HASH_UPDATE(&digest_ctx, expected, count * 32);
+        crypto_sign_public_key_counter_batch(got, &ctx, counter, count);
+        if (compare_keys("crypto_sign_public_key_counter_batch()",
+                         expected, got, secret_keys, count)) {
+            return 1;
+        }
+        crypto_sign_public_key_counter_batch_vartime(got, &ctx, counter,
+                                                     count);
+        if (compare_keys("crypto_sign_public_key_counter_batch_vartime()",
+                         expected, got, secret_keys, count)) {
+            return 1;
+        }
+    }
+    printf("batch, variable-time and counter public keys: %d secret keys "
+           "and %d counter keys ok\n", KEY_CHECKS, KEY_CHECKS);
+
+    u8 digest[64];
+    HASH_FINAL(&digest_ctx, digest);
+    u8 expected_digest[64];
+    parse_hex(expected_digest, reference_digest, 64);
+    if (memcmp(digest, expected_digest, 64)) {
+        printf("The public keys differ from the original monocypher code\n");
+        print_hex("  expected digest: ", expected_digest, 64);
+        print_hex("  got:             ", digest         , 64);
+        return 1;
+    }
+    printf("public keys against the original monocypher code: ok\n");
+    return 0;
+}
+
+int main(void)
+{
+#ifdef CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
+    const char *backend = "radix 2^51";
+#else
+    const char *backend = "radix 2^25.5";
+#endif
+#ifdef USE_BASE_TABLE
+    const char *base = "fixed-base table";
+#else
+    const char *base = "comb";
+#endif
+#ifdef USE_AVX2
+    const char *avx2 = cpu_has_avx2() ? "with AVX2" : "without AVX2 (not supported by the CPU)";
+#else
+    const char *avx2 = "without AVX2";
+#endif
+    printf("Checking the public keys with the %s field arithmetic, the %s, "
+           "%s\n", backend, base, avx2);
+    if (check_rfc8032()) {
+        return 1;
+    }
+#ifndef USE_BASE_TABLE
+    if (check_recodings()) {
+        return 1;
+    }
+#endif
+    return check_batches();
+}
@@ -26,6 +26,47 @@ static inline void ed25519_public_key(uint8_t public_key[32], const uint8_t secr
 	crypto_sign_public_key(public_key, secret_key);
 }
 
+// Generate count public keys at once
+static inline void ed25519_public_key_batch(uint8_t public_keys[][32], const uint8_t secret_keys[][32], size_t count)
+{
+	crypto_sign_public_key_batch(public_keys, secret_keys, count);
+}
+
+// Same as ed25519_public_key_batch, but not constant time and without wiping
+// the secrets. Only use it to mine keys.
+static inline void ed25519_public_key_batch_vartime(uint8_t public_keys[][32], const uint8_t secret_keys[][32], size_t count)
+{
+	crypto_sign_public_key_batch_vartime(public_keys, secret_keys, count);
+}
+
+// Secret keys made of a constant prefix followed by a big endian counter,
+// whose public keys are cheaper to derive in bulk
+#define CURVE_25519_COUNTER_PREFIX_SIZE 24
+typedef crypto_sign_counter_ctx ed25519_counter_ctx;
+
+static inline void ed25519_counter_init(ed25519_counter_ctx *ctx, const uint8_t prefix[24])
+{
+	crypto_sign_counter_init(ctx, prefix);
+}
+
+static inline void ed25519_counter_secret_key(uint8_t secret_key[32], const ed25519_counter_ctx *ctx, uint64_t counter)
+{
+	crypto_sign_counter_secret_key(secret_key, ctx, counter);
+}
+
+// Generate the public keys of the count secret keys of ctx starting from counter
+static inline void ed25519_public_key_counter_batch(uint8_t public_keys[][32], const ed25519_counter_ctx *ctx, uint64_t counter, size_t count)
+{
+	crypto_sign_public_key_counter_batch(public_keys, ctx, counter, count);
+}
+
+// Same as ed25519_public_key_counter_batch, but not constant time and
+// without wiping the secrets. Only use it to mine keys.
+static inline void ed25519_public_key_counter_batch_vartime(uint8_t public_keys[][32], const ed25519_counter_ctx *ctx, uint64_t counter, size_t count)
+{
+	crypto_sign_public_key_counter_batch_vartime(public_keys, ctx, counter, count);
+}
+
 // Direct interface
 static inline void ed25519_sign(uint8_t        signature [64],
 				 const uint8_t  secret_key[32],
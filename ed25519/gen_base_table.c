@@ -0,0 +1,88 @@
+// Generates base_table.h, the fixed-base table used by ge_scalarmult_base()
+// when monocypher.c is compiled with BASE_TABLE_WIDTH defined.
+//
+// This program is compiled and run on the build machine, with the same
+// CFLAGS as monocypher.c so that the field elements are written in the
+// representation monocypher.c will use. It writes the table on stdout.
+
+#define GENERATING_BASE_TABLE
+#include "monocypher.c"
+#include <stdio.h>
+
+#ifndef BASE_TABLE_WIDTH
+#error "BASE_TABLE_WIDTH must be defined to generate the fixed-base table"
+#endif
+#if BASE_TABLE_WIDTH < 1 || BASE_TABLE_WIDTH > 8
+#error "BASE_TABLE_WIDTH must be between 1 and 8"
+#endif
+
+#define BASE_TABLE_POSITIONS ((256 + BASE_TABLE_WIDTH - 1) / BASE_TABLE_WIDTH)
+#define BASE_TABLE_ENTRIES   (1 << (BASE_TABLE_WIDTH - 1))
+
+// Write the limbs of a fully carried field element
+static void print_fe(const fe f)
+{
+    u8 s[32];
+    fe canonical;
+    fe_tobytes(s, f);
+    fe_frombytes(canonical, s);
+    printf("{");
+    FOR (i, 0, sizeof(fe) / sizeof(canonical[0])) {
+        printf("%s%lld", i == 0 ? "" : ", ", (long long)canonical[i]);
+    }
+    printf("}");
+}
+
+// Write a point in cached format with Z = 1
+static void print_precomp(const ge *p)
+{
+    fe recip;
+    ge affine;
+    ge_cached c;
+    fe_invert(recip, p->Z);
+    fe_mul(affine.X, p->X, recip);
+    fe_mul(affine.Y, p->Y, recip);
+    fe_1  (affine.Z);
+    fe_mul(affine.T, affine.X, affine.Y);
+    ge_cache(&c, &affine);
+    printf("        {");
+    print_fe(c.Yp);
+    printf(",\n         ");
+    print_fe(c.Ym);
+    printf(",\n         ");
+    print_fe(c.T2);
+    printf("},\n");
+}
+
+int main(void)
+{
+    static const u8 one[32] = {1};
+    ge base, multiple, tmp;
+    ge_cached base_cached;
+    ge_scalarmult_base(&base, one);
+
+    printf("// Generated by gen_base_table.c, do not edit.\n\n");
+    printf("#if BASE_TABLE_WIDTH != %d || FE_LIMBS != %d\n",
+           BASE_TABLE_WIDTH, FE_LIMBS);
+    printf("#error \"base_table.h was generated for another "
+           "BASE_TABLE_WIDTH or field backend, run make clean\"\n");
+    printf("#endif\n\n");
+    printf("static const ge_precomp "
+           "base_table[BASE_TABLE_POSITIONS][BASE_TABLE_ENTRIES] = {\n");
+    FOR (i, 0, BASE_TABLE_POSITIONS) {
+        // base = 2^(i * BASE_TABLE_WIDTH) * B
+        printf("    { // 2^%d * B\n", (int)(i * BASE_TABLE_WIDTH));
+        multiple = base;
+        ge_cache(&base_cached, &base);
+        FOR (j, 0, BASE_TABLE_ENTRIES) {
+            print_precomp(&multiple);
+            ge_add(&multiple, &multiple, &base_cached);
+        }
+        printf("    },\n");
+        FOR (j, 0, BASE_TABLE_WIDTH) {
+            ge_double(&base, &base, &tmp);
+        }
+    }
+    printf("};\n");
+    return 0;
+}
@@ -14,6 +14,11 @@
 #define HASH_INIT   COMBINE2(HASH_NAME, _init)
 #define HASH_UPDATE COMBINE2(HASH_NAME, _update)
 #define HASH_FINAL  COMBINE2(HASH_NAME, _digest_final)
+#define HASH_X4     COMBINE2(HASH_NAME, _x4)
+#define HASH_ONEBLOCK     COMBINE2(HASH_NAME, _oneblock)
+#define HASH_COUNTER_INIT COMBINE2(HASH_NAME, _counter_init)
+#define HASH_COUNTER      COMBINE2(HASH_NAME, _counter_digest)
+#define HASH_COUNTER_X4   COMBINE2(HASH_NAME, _counter_digest_x4)
 #define HASH(a, data, size) { \
 	HASH_CTX hash_ctx; \
 	HASH_INIT(&hash_ctx); \
@@ -36,12 +41,14 @@ typedef int32_t  i32;
 typedef int64_t  i64;
 typedef uint64_t u64;
 
+#ifndef CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
 static u32 load24_le(const u8 s[3])
 {
     return (u32)s[0]
         | ((u32)s[1] <<  8)
         | ((u32)s[2] << 16);
 }
+#endif
 
 static u32 load32_le(const u8 s[4])
 {
@@ -95,11 +102,164 @@ static void crypto_wipe(void *secret, size_t size)
 ////////////////////////////////////
 /// Arithmetic modulo 2^255 - 19 ///
 ////////////////////////////////////
+#ifdef CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
+//  5 limbs of 51 bits, with 128-bit products.  Needs a 64-bit CPU to be
+//  fast, and a compiler that provides unsigned __int128.
+//  Based on the 64-bit code of curve25519-donna.
+//
+//  Every function accepts limbs below 2^53, and outputs limbs below 2^52.
+
+#ifndef __SIZEOF_INT128__
+#error "CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51 needs unsigned __int128"
+#endif
+typedef unsigned __int128 u128;
+
+// field element
+typedef u64 fe[5];
+#define FE_LIMBS 5
+#define FE_MASK  ((((u64)1) << 51) - 1)
+
+// Constants are written in the 10 limbs format of ref10.  Adding p keeps
+// the limbs positive.
+#define FE_LIMB(lo, hi) ((u64)((i64)(lo) + (i64)(hi) * (1 << 26)))
+#define FE(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9) {      \
+        FE_LIMB(t0, t1) + FE_MASK - 18,                 \
+        FE_LIMB(t2, t3) + FE_MASK,                      \
+        FE_LIMB(t4, t5) + FE_MASK,                      \
+        FE_LIMB(t6, t7) + FE_MASK,                      \
+        FE_LIMB(t8, t9) + FE_MASK }
+
+static void store64_le(u8 out[8], u64 in)
+{
+    store32_le(out    , (u32)in        );
+    store32_le(out + 4, (u32)(in >> 32));
+}
+
+static void fe_0(fe h) {            FOR(i, 0, 5) h[i] = 0; }
+static void fe_1(fe h) { h[0] = 1;  FOR(i, 1, 5) h[i] = 0; }
+
+static void fe_copy(fe h, const fe f) { FOR(i, 0, 5) h[i] = f[i]; }
+
+static void fe_carry(fe h)
+{
+    h[1] += h[0] >> 51;  h[0] &= FE_MASK;
+    h[2] += h[1] >> 51;  h[1] &= FE_MASK;
+    h[3] += h[2] >> 51;  h[2] &= FE_MASK;
+    h[4] += h[3] >> 51;  h[3] &= FE_MASK;
+    h[0] += 19 * (h[4] >> 51);  h[4] &= FE_MASK;
+}
+
+// 8 * p, bigger than any limb given as input
+#define FE_8P0 (8 * (FE_MASK - 18))
+#define FE_8P  (8 *  FE_MASK      )
+
+static void fe_neg(fe h, const fe f)
+{
+    h[0] = FE_8P0 - f[0];
+    FOR (i, 1, 5) { h[i] = FE_8P - f[i]; }
+    fe_carry(h);
+}
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+    FOR (i, 0, 5) { h[i] = f[i] + g[i]; }
+    fe_carry(h);
+}
+
+static void fe_sub(fe h, const fe f, const fe g)
+{
+    h[0] = f[0] + FE_8P0 - g[0];
+    FOR (i, 1, 5) { h[i] = f[i] + FE_8P - g[i]; }
+    fe_carry(h);
+}
+
+static void fe_cswap(fe f, fe g, int b)
+{
+    u64 mask = -(u64)b;
+    FOR (i, 0, 5) {
+        u64 x = (f[i] ^ g[i]) & mask;
+        f[i] = f[i] ^ x;
+        g[i] = g[i] ^ x;
+    }
+}
+
+static void fe_ccopy(fe f, const fe g, int b)
+{
+    u64 mask = -(u64)b;
+    FOR (i, 0, 5) {
+        u64 x = (f[i] ^ g[i]) & mask;
+        f[i] = f[i] ^ x;
+    }
+}
+
+static void fe_frombytes(fe h, const u8 s[32])
+{
+    h[0] =  load64_le(s     )        & FE_MASK;
+    h[1] = (load64_le(s +  6) >>  3) & FE_MASK;
+    h[2] = (load64_le(s + 12) >>  6) & FE_MASK;
+    h[3] = (load64_le(s + 19) >>  1) & FE_MASK;
+    h[4] = (load64_le(s + 24) >> 12) & FE_MASK;
+}
+
+// Carries the 128-bit limbs of a product into h
+#define FE_CARRY128                                                  \
+    r1 += r0 >> 51;  h[0] = (u64)r0 & FE_MASK;                       \
+    r2 += r1 >> 51;  h[1] = (u64)r1 & FE_MASK;                       \
+    r3 += r2 >> 51;  h[2] = (u64)r2 & FE_MASK;                       \
+    r4 += r3 >> 51;  h[3] = (u64)r3 & FE_MASK;                       \
+    r0  = h[0] + (r4 >> 51) * 19;  h[4] = (u64)r4 & FE_MASK;         \
+    h[0] = (u64)r0 & FE_MASK;  h[1] += (u64)(r0 >> 51)
+
+static void fe_mul_small(fe h, const fe f, i32 g)
+{
+    u128 r0 = (u128)f[0] * (u64)g;  u128 r1 = (u128)f[1] * (u64)g;
+    u128 r2 = (u128)f[2] * (u64)g;  u128 r3 = (u128)f[3] * (u64)g;
+    u128 r4 = (u128)f[4] * (u64)g;
+    FE_CARRY128;
+}
+static void fe_mul121666(fe h, const fe f) { fe_mul_small(h, f, 121666); }
+
+static void fe_mul(fe h, const fe f, const fe g)
+{
+    u64 f0 = f[0];  u64 f1 = f[1];  u64 f2 = f[2];  u64 f3 = f[3];  u64 f4 = f[4];
+    u64 g0 = g[0];  u64 g1 = g[1];  u64 g2 = g[2];  u64 g3 = g[3];  u64 g4 = g[4];
+    u64 G1 = g1*19; u64 G2 = g2*19; u64 G3 = g3*19; u64 G4 = g4*19;
+
+    u128 r0 = (u128)f0*g0 + (u128)f1*G4 + (u128)f2*G3 + (u128)f3*G2 + (u128)f4*G1;
+    u128 r1 = (u128)f0*g1 + (u128)f1*g0 + (u128)f2*G4 + (u128)f3*G3 + (u128)f4*G2;
+    u128 r2 = (u128)f0*g2 + (u128)f1*g1 + (u128)f2*g0 + (u128)f3*G4 + (u128)f4*G3;
+    u128 r3 = (u128)f0*g3 + (u128)f1*g2 + (u128)f2*g1 + (u128)f3*g0 + (u128)f4*G4;
+    u128 r4 = (u128)f0*g4 + (u128)f1*g3 + (u128)f2*g2 + (u128)f3*g1 + (u128)f4*g0;
+
+    FE_CARRY128;
+}
+
+// we could use fe_mul() for this, but this is significantly faster
+static void fe_sq(fe h, const fe f)
+{
+    u64 f0 = f[0];  u64 f1 = f[1];  u64 f2 = f[2];  u64 f3 = f[3];  u64 f4 = f[4];
+    u64 f0_2  = f0*2;   u64 f1_2  = f1*2;
+    u64 f1_38 = f1*38;  u64 f2_38 = f2*38;  u64 f3_38 = f3*38;
+    u64 f3_19 = f3*19;  u64 f4_19 = f4*19;
+
+    u128 r0 = (u128)f0  *f0    + (u128)f1_38*f4    + (u128)f2_38*f3;
+    u128 r1 = (u128)f0_2*f1    + (u128)f2_38*f4    + (u128)f3_19*f3;
+    u128 r2 = (u128)f0_2*f2    + (u128)f1   *f1    + (u128)f3_38*f4;
+    u128 r3 = (u128)f0_2*f3    + (u128)f1_2 *f2    + (u128)f4_19*f4;
+    u128 r4 = (u128)f0_2*f4    + (u128)f1_2 *f3    + (u128)f2   *f2;
+
+    FE_CARRY128;
+}
+
+#else // CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
 //  Taken from SUPERCOP's ref10 implementation.
 //  A bit bigger than TweetNaCl, over 4 times faster.
 
 // field element
 typedef i32 fe[10];
+#define FE_LIMBS 10
+#define FE(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9) \
+        {t0, t1, t2, t3, t4, t5, t6, t7, t8, t9}
 
 static void fe_0(fe h) {            FOR(i, 0, 10) h[i] = 0; }
 static void fe_1(fe h) { h[0] = 1;  FOR(i, 1, 10) h[i] = 0; }
@@ -257,6 +417,8 @@ static void fe_sq(fe h, const fe f)
     CARRY;
 }
 
+#endif // CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
+
 static void fe_sq2(fe h, const fe f)
 {
     fe_sq(h, f);
@@ -308,6 +470,42 @@ static void fe_pow22523(fe out, const fe z)
     WIPE_BUFFER(t2);
 }
 
+#ifdef CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
+
+static void fe_tobytes(u8 s[32], const fe h)
+{
+    u64 t[5];
+    FOR (i, 0, 5) {
+        t[i] = h[i];
+    }
+    fe_carry(t);
+    fe_carry(t);
+    // t is now between 0 and 2^255-1, properly carried.
+    // Either below p, or between p and 2^255-1.
+    t[0] += 19;
+    fe_carry(t);
+    // t is now offset by 19, between 19 and 2^255-1 in both cases.
+    // Add 2^255 - 19 to remove the offset, carry without reducing.
+    t[0] += FE_MASK + 1 - 19;
+    FOR (i, 1, 5) {
+        t[i] += FE_MASK;
+    }
+    t[1] += t[0] >> 51;  t[0] &= FE_MASK;
+    t[2] += t[1] >> 51;  t[1] &= FE_MASK;
+    t[3] += t[2] >> 51;  t[2] &= FE_MASK;
+    t[4] += t[3] >> 51;  t[3] &= FE_MASK;
+                         t[4] &= FE_MASK;
+
+    store64_le(s +  0, (t[0]      ) | (t[1] << 51));
+    store64_le(s +  8, (t[1] >> 13) | (t[2] << 38));
+    store64_le(s + 16, (t[2] >> 26) | (t[3] << 25));
+    store64_le(s + 24, (t[3] >> 39) | (t[4] << 12));
+
+    WIPE_BUFFER(t);
+}
+
+#else // CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
+
 static void fe_tobytes(u8 s[32], const fe h)
 {
     i32 t[10];
@@ -344,6 +542,8 @@ static void fe_tobytes(u8 s[32], const fe h)
     WIPE_BUFFER(t);
 }
 
+#endif // CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
+
 //  Parity check.  Returns 0 if even, 1 if odd
 static int fe_isnegative(const fe f)
 {
@@ -524,6 +724,7 @@ static int is_above_L(const u8 a[32])
 // x = X/Z, y = Y/Z, T = XY/Z
 typedef struct { fe X;  fe Y;  fe Z; fe T;  } ge;
 typedef struct { fe Yp; fe Ym; fe Z; fe T2; } ge_cached;
+typedef struct { fe Yp; fe Ym;       fe T2; } ge_precomp; // Z = 1
 
 static void ge_zero(ge *p)
 {
@@ -533,31 +734,67 @@ static void ge_zero(ge *p)
     fe_0(p->T);
 }
 
-static void ge_tobytes(u8 s[32], const ge *h)
+// recip must be the inverse of h->Z
+static void ge_tobytes_recip(u8 s[32], const ge *h, const fe recip)
 {
-    fe recip, x, y;
-    fe_invert(recip, h->Z);
+    fe x, y;
     fe_mul(x, h->X, recip);
     fe_mul(y, h->Y, recip);
     fe_tobytes(s, y);
     s[31] ^= fe_isnegative(x) << 7;
 
-    WIPE_BUFFER(recip);
     WIPE_BUFFER(x);
     WIPE_BUFFER(y);
 }
 
+static void ge_tobytes(u8 s[32], const ge *h)
+{
+    fe recip;
+    fe_invert(recip, h->Z);
+    ge_tobytes_recip(s, h, recip);
+    WIPE_BUFFER(recip);
+}
+
+// Same as ge_tobytes() for a whole array of points.  All the Z coordinates
+// are inverted at once with Montgomery's trick: 1 inversion and
+// 3 multiplications per point instead of 1 inversion per point.
+// acc must have room for count field elements.
+static void ge_tobytes_batch(u8 s[][32], const ge *h, fe *acc, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    // acc[i] = Z_0 * Z_1 * ... * Z_i
+    fe_copy(acc[0], h[0].Z);
+    FOR (i, 1, count) {
+        fe_mul(acc[i], acc[i-1], h[i].Z);
+    }
+    fe inv, recip;
+    fe_invert(inv, acc[count-1]);
+    // Peel off one Z at a time, from the last point to the first
+    for (size_t i = count - 1; i > 0; i--) {
+        fe_mul(recip, inv, acc[i-1]);
+        fe_mul(inv, inv, h[i].Z);
+        ge_tobytes_recip(s[i], &h[i], recip);
+    }
+    ge_tobytes_recip(s[0], &h[0], inv);
+
+    WIPE_BUFFER(inv);
+    WIPE_BUFFER(recip);
+    crypto_wipe(acc, count * sizeof(fe));
+}
+
 // Variable time! s must not be secret!
 static int ge_frombytes_neg_vartime(ge *h, const u8 s[32])
 {
-    static const fe d = {
+    static const fe d = FE(
         -10913610, 13857413, -15372611, 6949391, 114729,
         -8787816, -6275908, -3247719, -18696448, -12055116
-    } ;
-    static const fe sqrtm1 = {
+    );
+    static const fe sqrtm1 = FE(
         -32595792, -7943725, 9377950, 3500415, 12389472,
         -272473, -25146209, -2005654, 326686, 11406482
-    } ;
+    );
     fe u, v, v3; // no secret, no wipe
     fe_frombytes(h->Y, s);
     fe_1(h->Z);
@@ -596,10 +833,10 @@ static int ge_frombytes_neg_vartime(ge *h, const u8 s[32])
 
 static void ge_cache(ge_cached *c, const ge *p)
 {
-    static const fe D2 = { // - 2 * 121665 / 121666
+    static const fe D2 = FE( // - 2 * 121665 / 121666
         -21827239, -5839606, -30745221, 13898782, 229458,
         15978800, -12551817, -6495438, 29715968, 9444199
-    };
+    );
     fe_add (c->Yp, p->Y, p->X);
     fe_sub (c->Ym, p->Y, p->X);
     fe_copy(c->Z , p->Z      );
@@ -688,58 +925,58 @@ static void ge_double(ge *s, const ge *p, ge *q)
 }
 
 static const fe window_Yp[8] = {
-    {25967493, -14356035, 29566456, 3660896, -12694345,
-     4014787, 27544626, -11754271, -6079156, 2047605},
-    {15636291, -9688557, 24204773, -7912398, 616977,
-     -16685262, 27787600, -14772189, 28944400, -1550024},
-    {10861363, 11473154, 27284546, 1981175, -30064349,
-     12577861, 32867885, 14515107, -15438304, 10819380},
-    {5153746, 9909285, 1723747, -2777874, 30523605,
-     5516873, 19480852, 5230134, -23952439, -15175766},
-    {-22518993, -6692182, 14201702, -8745502, -23510406,
-     8844726, 18474211, -1361450, -13062696, 13821877},
-    {-25154831, -4185821, 29681144, 7868801, -6854661,
-     -9423865, -12437364, -663000, -31111463, -16132436},
-    {-33521811, 3180713, -2394130, 14003687, -16903474,
-     -16270840, 17238398, 4729455, -18074513, 9256800},
-    {-3151181, -5046075, 9282714, 6866145, -31907062,
-     -863023, -18940575, 15033784, 25105118, -7894876},
+    FE(25967493, -14356035, 29566456, 3660896, -12694345,
+       4014787, 27544626, -11754271, -6079156, 2047605),
+    FE(15636291, -9688557, 24204773, -7912398, 616977,
+       -16685262, 27787600, -14772189, 28944400, -1550024),
+    FE(10861363, 11473154, 27284546, 1981175, -30064349,
+       12577861, 32867885, 14515107, -15438304, 10819380),
+    FE(5153746, 9909285, 1723747, -2777874, 30523605,
+       5516873, 19480852, 5230134, -23952439, -15175766),
+    FE(-22518993, -6692182, 14201702, -8745502, -23510406,
+       8844726, 18474211, -1361450, -13062696, 13821877),
+    FE(-25154831, -4185821, 29681144, 7868801, -6854661,
+       -9423865, -12437364, -663000, -31111463, -16132436),
+    FE(-33521811, 3180713, -2394130, 14003687, -16903474,
+       -16270840, 17238398, 4729455, -18074513, 9256800),
+    FE(-3151181, -5046075, 9282714, 6866145, -31907062,
+       -863023, -18940575, 15033784, 25105118, -7894876),
 };
 static const fe window_Ym[8] = {
-    {-12545711, 934262, -2722910, 3049990, -727428,
-     9406986, 12720692, 5043384, 19500929, -15469378},
-    {16568933, 4717097, -11556148, -1102322, 15682896,
-     -11807043, 16354577, -11775962, 7689662, 11199574},
-    {4708026, 6336745, 20377586, 9066809, -11272109,
-     6594696, -25653668, 12483688, -12668491, 5581306},
-    {-30269007, -3463509, 7665486, 10083793, 28475525,
-     1649722, 20654025, 16520125, 30598449, 7715701},
-    {-6455177, -7839871, 3374702, -4740862, -27098617,
-     -10571707, 31655028, -7212327, 18853322, -14220951},
-    {25576264, -2703214, 7349804, -11814844, 16472782,
-     9300885, 3844789, 15725684, 171356, 6466918},
-    {-25182317, -4174131, 32336398, 5036987, -21236817,
-     11360617, 22616405, 9761698, -19827198, 630305},
-    {-24326370, 15950226, -31801215, -14592823, -11662737,
-     -5090925, 1573892, -2625887, 2198790, -15804619},
+    FE(-12545711, 934262, -2722910, 3049990, -727428,
+       9406986, 12720692, 5043384, 19500929, -15469378),
+    FE(16568933, 4717097, -11556148, -1102322, 15682896,
+       -11807043, 16354577, -11775962, 7689662, 11199574),
+    FE(4708026, 6336745, 20377586, 9066809, -11272109,
+       6594696, -25653668, 12483688, -12668491, 5581306),
+    FE(-30269007, -3463509, 7665486, 10083793, 28475525,
+       1649722, 20654025, 16520125, 30598449, 7715701),
+    FE(-6455177, -7839871, 3374702, -4740862, -27098617,
+       -10571707, 31655028, -7212327, 18853322, -14220951),
+    FE(25576264, -2703214, 7349804, -11814844, 16472782,
+       9300885, 3844789, 15725684, 171356, 6466918),
+    FE(-25182317, -4174131, 32336398, 5036987, -21236817,
+       11360617, 22616405, 9761698, -19827198, 630305),
+    FE(-24326370, 15950226, -31801215, -14592823, -11662737,
+       -5090925, 1573892, -2625887, 2198790, -15804619),
 };
 static const fe window_T2[8] = {
-    {-8738181, 4489570, 9688441, -14785194, 10184609,
-     -12363380, 29287919, 11864899, -24514362, -4438546},
-    {30464156, -5976125, -11779434, -15670865, 23220365,
-     15915852, 7512774, 10017326, -17749093, -9920357},
-    {19563160, 16186464, -29386857, 4097519, 10237984,
-     -4348115, 28542350, 13850243, -23678021, -15815942},
-    {28881845, 14381568, 9657904, 3680757, -20181635,
-     7843316, -31400660, 1370708, 29794553, -1409300},
-    {4566830, -12963868, -28974889, -12240689, -7602672,
-     -2830569, -8514358, -10431137, 2207753, -3209784},
-    {23103977, 13316479, 9739013, -16149481, 817875,
-     -15038942, 8965339, -14088058, -30714912, 16193877},
-    {-13720693, 2639453, -24237460, -7406481, 9494427,
-     -5774029, -6554551, -15960994, -2449256, -14291300},
-    {-3099351, 10324967, -2241613, 7453183, -5446979,
-     -2735503, -13812022, -16236442, -32461234, -12290683},
+    FE(-8738181, 4489570, 9688441, -14785194, 10184609,
+       -12363380, 29287919, 11864899, -24514362, -4438546),
+    FE(30464156, -5976125, -11779434, -15670865, 23220365,
+       15915852, 7512774, 10017326, -17749093, -9920357),
+    FE(19563160, 16186464, -29386857, 4097519, 10237984,
+       -4348115, 28542350, 13850243, -23678021, -15815942),
+    FE(28881845, 14381568, 9657904, 3680757, -20181635,
+       7843316, -31400660, 1370708, 29794553, -1409300),
+    FE(4566830, -12963868, -28974889, -12240689, -7602672,
+       -2830569, -8514358, -10431137, 2207753, -3209784),
+    FE(23103977, 13316479, 9739013, -16149481, 817875,
+       -15038942, 8965339, -14088058, -30714912, 16193877),
+    FE(-13720693, 2639453, -24237460, -7406481, 9494427,
+       -5774029, -6554551, -15960994, -2449256, -14291300),
+    FE(-3099351, 10324967, -2241613, 7453183, -5446979,
+       -2735503, -13812022, -16236442, -32461234, -12290683),
 };
 
 // Incremental sliding windows (left to right)
@@ -849,129 +1086,148 @@ static void ge_double_scalarmult_vartime(ge *P, const u8 p[32], const u8 b[32])
     }
 }
 
+#if defined(BASE_TABLE_WIDTH) && !defined(GENERATING_BASE_TABLE)
+#define USE_BASE_TABLE
+#endif
+
+#ifndef USE_BASE_TABLE
 // 5-bit signed comb in cached format (Niels coordinates, Z=1)
 static const fe comb_Yp[16] = {
-    {2615675, 9989699, 17617367, -13953520, -8802803,
-     1447286, -8909978, -270892, -12199203, -11617247},
-    {-1271192, 4785266, -29856067, -6036322, -10435381,
-     15493337, 20321440, -6036064, 15902131, 13420909},
-    {-26170888, -12891603, 9568996, -6197816, 26424622,
-     16308973, -4518568, -3771275, -15522557, 3991142},
-    {-25875044, 1958396, 19442242, -9809943, -26099408,
-     -18589, -30794750, -14100910, 4971028, -10535388},
-    {-13896937, -7357727, -12131124, 617289, -33188817,
-     10080542, 6402555, 10779157, 1176712, 2472642},
-    {71503, 12662254, -17008072, -8370006, 23408384,
-     -12897959, 32287612, 11241906, -16724175, 15336924},
-    {27397666, 4059848, 23573959, 8868915, -10602416,
-     -10456346, -22812831, -9666299, 31810345, -2695469},
-    {-3418193, -694531, 2320482, -11850408, -1981947,
-     -9606132, 23743894, 3933038, -25004889, -4478918},
-    {-4448372, 5537982, -4805580, 14016777, 15544316,
-     16039459, -7143453, -8003716, -21904564, 8443777},
-    {32495180, 15749868, 2195406, -15542321, -3213890,
-     -4030779, -2915317, 12751449, -1872493, 11926798},
-    {26779741, 12553580, -24344000, -4071926, -19447556,
-     -13464636, 21989468, 7826656, -17344881, 10055954},
-    {5848288, -1639207, -10452929, -11760637, 6484174,
-     -5895268, -11561603, 587105, -19220796, 14378222},
-    {32050187, 12536702, 9206308, -10016828, -13333241,
-     -4276403, -24225594, 14562479, -31803624, -9967812},
-    {23536033, -6219361, 199701, 4574817, 30045793,
-     7163081, -2244033, 883497, 10960746, -14779481},
-    {-8143354, -11558749, 15772067, 14293390, 5914956,
-     -16702904, -7410985, 7536196, 6155087, 16571424},
-    {6211591, -11166015, 24568352, 2768318, -10822221,
-     11922793, 33211827, 3852290, -13160369, -8855385},
+    FE(2615675, 9989699, 17617367, -13953520, -8802803,
+       1447286, -8909978, -270892, -12199203, -11617247),
+    FE(-1271192, 4785266, -29856067, -6036322, -10435381,
+       15493337, 20321440, -6036064, 15902131, 13420909),
+    FE(-26170888, -12891603, 9568996, -6197816, 26424622,
+       16308973, -4518568, -3771275, -15522557, 3991142),
+    FE(-25875044, 1958396, 19442242, -9809943, -26099408,
+       -18589, -30794750, -14100910, 4971028, -10535388),
+    FE(-13896937, -7357727, -12131124, 617289, -33188817,
+       10080542, 6402555, 10779157, 1176712, 2472642),
+    FE(71503, 12662254, -17008072, -8370006, 23408384,
+       -12897959, 32287612, 11241906, -16724175, 15336924),
+    FE(27397666, 4059848, 23573959, 8868915, -10602416,
+       -10456346, -22812831, -9666299, 31810345, -2695469),
+    FE(-3418193, -694531, 2320482, -11850408, -1981947,
+       -9606132, 23743894, 3933038, -25004889, -4478918),
+    FE(-4448372, 5537982, -4805580, 14016777, 15544316,
+       16039459, -7143453, -8003716, -21904564, 8443777),
+    FE(32495180, 15749868, 2195406, -15542321, -3213890,
+       -4030779, -2915317, 12751449, -1872493, 11926798),
+    FE(26779741, 12553580, -24344000, -4071926, -19447556,
+       -13464636, 21989468, 7826656, -17344881, 10055954),
+    FE(5848288, -1639207, -10452929, -11760637, 6484174,
+       -5895268, -11561603, 587105, -19220796, 14378222),
+    FE(32050187, 12536702, 9206308, -10016828, -13333241,
+       -4276403, -24225594, 14562479, -31803624, -9967812),
+    FE(23536033, -6219361, 199701, 4574817, 30045793,
+       7163081, -2244033, 883497, 10960746, -14779481),
+    FE(-8143354, -11558749, 15772067, 14293390, 5914956,
+       -16702904, -7410985, 7536196, 6155087, 16571424),
+    FE(6211591, -11166015, 24568352, 2768318, -10822221,
+       11922793, 33211827, 3852290, -13160369, -8855385),
 };
 static const fe comb_Ym[16] = {
-    {8873912, 14981221, 13714139, 6923085, 25481101,
-     4243739, 4646647, -203847, 9015725, -16205935},
-    {-1827892, 15407265, 2351140, -11810728, 28403158,
-     -1487103, -15057287, -4656433, -3780118, -1145998},
-    {-30623162, -11845055, -11327147, -16008347, 17564978,
-     -1449578, -20580262, 14113978, 29643661, 15580734},
-    {-15109423, 13348938, -14756006, 14132355, 30481360,
-     1830723, -240510, 9371801, -13907882, 8024264},
-    {25119567, 5628696, 10185251, -9279452, 683770,
-     -14523112, -7982879, -16450545, 1431333, -13253541},
-    {-8390493, 1276691, 19008763, -12736675, -9249429,
-     -12526388, 17434195, -13761261, 18962694, -1227728},
-    {26361856, -12366343, 8941415, 15163068, 7069802,
-     -7240693, -18656349, 8167008, 31106064, -1670658},
-    {-5677136, -11012483, -1246680, -6422709, 14772010,
-     1829629, -11724154, -15914279, -18177362, 1301444},
-    {937094, 12383516, -22597284, 7580462, -18767748,
-     13813292, -2323566, 13503298, 11510849, -10561992},
-    {28028043, 14715827, -6558532, -1773240, 27563607,
-     -9374554, 3201863, 8865591, -16953001, 7659464},
-    {13628467, 5701368, 4674031, 11935670, 11461401,
-     10699118, 31846435, -114971, -8269924, -14777505},
-    {-22124018, -12859127, 11966893, 1617732, 30972446,
-     -14350095, -21822286, 8369862, -29443219, -15378798},
-    {290131, -471434, 8840522, -2654851, 25963762,
-     -11578288, -7227978, 13847103, 30641797, 6003514},
-    {-23547482, -11475166, -11913550, 9374455, 22813401,
-     -5707910, 26635288, 9199956, 20574690, 2061147},
-    {9715324, 7036821, -17981446, -11505533, 26555178,
-     -3571571, 5697062, -14128022, 2795223, 9694380},
-    {14864569, -6319076, -3080, -8151104, 4994948,
-     -1572144, -41927, 9269803, 13881712, -13439497},
+    FE(8873912, 14981221, 13714139, 6923085, 25481101,
+       4243739, 4646647, -203847, 9015725, -16205935),
+    FE(-1827892, 15407265, 2351140, -11810728, 28403158,
+       -1487103, -15057287, -4656433, -3780118, -1145998),
+    FE(-30623162, -11845055, -11327147, -16008347, 17564978,
+       -1449578, -20580262, 14113978, 29643661, 15580734),
+    FE(-15109423, 13348938, -14756006, 14132355, 30481360,
+       1830723, -240510, 9371801, -13907882, 8024264),
+    FE(25119567, 5628696, 10185251, -9279452, 683770,
+       -14523112, -7982879, -16450545, 1431333, -13253541),
+    FE(-8390493, 1276691, 19008763, -12736675, -9249429,
+       -12526388, 17434195, -13761261, 18962694, -1227728),
+    FE(26361856, -12366343, 8941415, 15163068, 7069802,
+       -7240693, -18656349, 8167008, 31106064, -1670658),
+    FE(-5677136, -11012483, -1246680, -6422709, 14772010,
+       1829629, -11724154, -15914279, -18177362, 1301444),
+    FE(937094, 12383516, -22597284, 7580462, -18767748,
+       13813292, -2323566, 13503298, 11510849, -10561992),
+    FE(28028043, 14715827, -6558532, -1773240, 27563607,
+       -9374554, 3201863, 8865591, -16953001, 7659464),
+    FE(13628467, 5701368, 4674031, 11935670, 11461401,
+       10699118, 31846435, -114971, -8269924, -14777505),
+    FE(-22124018, -12859127, 11966893, 1617732, 30972446,
+       -14350095, -21822286, 8369862, -29443219, -15378798),
+    FE(290131, -471434, 8840522, -2654851, 25963762,
+       -11578288, -7227978, 13847103, 30641797, 6003514),
+    FE(-23547482, -11475166, -11913550, 9374455, 22813401,
+       -5707910, 26635288, 9199956, 20574690, 2061147),
+    FE(9715324, 7036821, -17981446, -11505533, 26555178,
+       -3571571, 5697062, -14128022, 2795223, 9694380),
+    FE(14864569, -6319076, -3080, -8151104, 4994948,
+       -1572144, -41927, 9269803, 13881712, -13439497),
 };
 static const fe comb_T2[16] = {
-    {-18494317, 2686822, 18449263, -13905325, 5966562,
-     -3368714, 2738304, -8583315, 15987143, 12180258},
-    {-33336513, -13705917, -18473364, -5039204, -4268481,
-     -4136039, -8192211, -2935105, -19354402, 5995895},
-    {-19753139, -1729018, 21880604, 13471713, 28315373,
-     -8530159, -17492688, 11730577, -8790216, 3942124},
-    {17278020, 3905045, 29577748, 11151940, 18451761,
-     -6801382, 31480073, -13819665, 26308905, 10868496},
-    {26937294, 3313561, 28601532, -3497112, -22814130,
-     11073654, 8956359, -16757370, 13465868, 16623983},
-    {-5468054, 6059101, -31275300, 2469124, 26532937,
-     8152142, 6423741, -11427054, -15537747, -10938247},
-    {-11303505, -9659620, -12354748, -9331434, 19501116,
-     -9146390, -841918, -5315657, 8903828, 8839982},
-    {16603354, -215859, 1591180, 3775832, -705596,
-     -13913449, 26574704, 14963118, 19649719, 6562441},
-    {33188866, -12232360, -24929148, -6133828, 21818432,
-     11040754, -3041582, -3524558, -29364727, -10264096},
-    {-20704194, -12560423, -1235774, -785473, 13240395,
-     4831780, -472624, -3796899, 25480903, -15422283},
-    {-2204347, -16313180, -21388048, 7520851, -8697745,
-     -14460961, 20894017, 12210317, -475249, -2319102},
-    {-16407882, 4940236, -21194947, 10781753, 22248400,
-     14425368, 14866511, -7552907, 12148703, -7885797},
-    {16376744, 15908865, -30663553, 4663134, -30882819,
-     -10105163, 19294784, -10800440, -33259252, 2563437},
-    {30208741, 11594088, -15145888, 15073872, 5279309,
-     -9651774, 8273234, 4796404, -31270809, -13316433},
-    {-17802574, 14455251, 27149077, -7832700, -29163160,
-     -7246767, 17498491, -4216079, 31788733, -14027536},
-    {-25233439, -9389070, -6618212, -3268087, -521386,
-     -7350198, 21035059, -14970947, 25910190, 11122681},
+    FE(-18494317, 2686822, 18449263, -13905325, 5966562,
+       -3368714, 2738304, -8583315, 15987143, 12180258),
+    FE(-33336513, -13705917, -18473364, -5039204, -4268481,
+       -4136039, -8192211, -2935105, -19354402, 5995895),
+    FE(-19753139, -1729018, 21880604, 13471713, 28315373,
+       -8530159, -17492688, 11730577, -8790216, 3942124),
+    FE(17278020, 3905045, 29577748, 11151940, 18451761,
+       -6801382, 31480073, -13819665, 26308905, 10868496),
+    FE(26937294, 3313561, 28601532, -3497112, -22814130,
+       11073654, 8956359, -16757370, 13465868, 16623983),
+    FE(-5468054, 6059101, -31275300, 2469124, 26532937,
+       8152142, 6423741, -11427054, -15537747, -10938247),
+    FE(-11303505, -9659620, -12354748, -9331434, 19501116,
+       -9146390, -841918, -5315657, 8903828, 8839982),
+    FE(16603354, -215859, 1591180, 3775832, -705596,
+       -13913449, 26574704, 14963118, 19649719, 6562441),
+    FE(33188866, -12232360, -24929148, -6133828, 21818432,
+       11040754, -3041582, -3524558, -29364727, -10264096),
+    FE(-20704194, -12560423, -1235774, -785473, 13240395,
+       4831780, -472624, -3796899, 25480903, -15422283),
+    FE(-2204347, -16313180, -21388048, 7520851, -8697745,
+       -14460961, 20894017, 12210317, -475249, -2319102),
+    FE(-16407882, 4940236, -21194947, 10781753, 22248400,
+       14425368, 14866511, -7552907, 12148703, -7885797),
+    FE(16376744, 15908865, -30663553, 4663134, -30882819,
+       -10105163, 19294784, -10800440, -33259252, 2563437),
+    FE(30208741, 11594088, -15145888, 15073872, 5279309,
+       -9651774, 8273234, 4796404, -31270809, -13316433),
+    FE(-17802574, 14455251, 27149077, -7832700, -29163160,
+       -7246767, 17498491, -4216079, 31788733, -14027536),
+    FE(-25233439, -9389070, -6618212, -3268087, -521386,
+       -7350198, 21035059, -14970947, 25910190, 11122681),
 };
 
+// Recodes the scalar for the comb, in all bits set form: bit i of s_scalar
+// stands for 2^i if set and -2^i if cleared, so that
+// 2 * s_scalar - (2^255 - 1) = scalar modulo L.
+// Instead of multiplying by 1/2 modulo L, computes
+// s_scalar = (scalar + 2^255 - 1 - L * (scalar is even)) / 2,
+// which is below 2^255 as long as the scalar is.  Clamped secret scalars and
+// scalars reduced modulo L are.
+static void comb_recode(u8 s_scalar[32], const u8 scalar[32])
+{
+    i64 even  = (scalar[0] & 1) - 1; // all ones if the scalar is even
+    i64 carry = -1;
+    FOR (i, 0, 32) {
+        carry += scalar[i] - (L[i] & even);
+        if (i == 31) {
+            carry += 0x80;
+        }
+        s_scalar[i] = (u8)carry;
+        carry >>= 8;
+    }
+    // The sum is even: halve it
+    FOR (i, 0, 31) {
+        s_scalar[i] = (u8)((s_scalar[i] >> 1) | (s_scalar[i+1] << 7));
+    }
+    s_scalar[31] >>= 1;
+}
+
 static void ge_scalarmult_base(ge *p, const u8 scalar[32])
 {
     // 5-bits signed comb, from Mike Hamburg's
     // Fast and compact elliptic-curve cryptography (2012)
-    static const u8 half_mod_L[32] = { // 1 / 2 modulo L
-        0xf7, 0xe9, 0x7a, 0x2e, 0x8d, 0x31, 0x09, 0x2c,
-        0x6b, 0xce, 0x7b, 0x51, 0xef, 0x7c, 0x6f, 0x0a,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
-    };
-    static const u8 half_ones[32] = { // (2^255 - 1) / 2 modulo L
-        0x42, 0x9a, 0xa3, 0xba, 0x23, 0xa5, 0xbf, 0xcb,
-        0x11, 0x5b, 0x9d, 0xc5, 0x74, 0x95, 0xf3, 0xb6,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x07,
-    };
     // All bits set form: 1 means 1, 0 means -1
     u8 s_scalar[32];
-    mul_add(s_scalar, scalar, half_mod_L, half_ones);
+    comb_recode(s_scalar, scalar);
 
     // Double and add ladder
     fe yp, ym, t2, n2, a; // temporaries for addition
@@ -1009,10 +1265,552 @@ static void ge_scalarmult_base(ge *p, const u8 scalar[32])
     WIPE_BUFFER(s_scalar);
 }
 
+// Variable time! Internal buffers are not wiped! Scalar must not be secret!
+// Same as ge_scalarmult_base(), but the comb is indexed directly.
+static void ge_scalarmult_base_vartime(ge *p, const u8 scalar[32])
+{
+    u8 s_scalar[32];
+    comb_recode(s_scalar, scalar);
+
+    fe a, b;
+    ge dbl;
+    ge_zero(p);
+    for (int i = 50; i >= 0; i--) {
+        if (i < 50) {
+            ge_double(p, p, &dbl);
+        }
+        u8 teeth = (u8)((scalar_bit(s_scalar, i)           ) +
+                        (scalar_bit(s_scalar, i +  51) << 1) +
+                        (scalar_bit(s_scalar, i + 102) << 2) +
+                        (scalar_bit(s_scalar, i + 153) << 3) +
+                        (scalar_bit(s_scalar, i + 204) << 4));
+        u8 high  = teeth >> 4;
+        u8 index = (teeth ^ (high - 1)) & 15;
+        if (high) {
+            ge_madd(p, p, comb_Yp[index], comb_Ym[index], comb_T2[index], a, b);
+        } else {
+            ge_msub(p, p, comb_Yp[index], comb_Ym[index], comb_T2[index], a, b);
+        }
+    }
+}
+
+#else // USE_BASE_TABLE
+
+// Fixed-base table generated at build time by gen_base_table.c.
+// base_table[i][j] = (j + 1) * 2^(i * BASE_TABLE_WIDTH) * B, in cached
+// format (Niels coordinates, Z=1).  Bigger widths mean fewer additions but
+// bigger tables.
+#define BASE_TABLE_POSITIONS ((256 + BASE_TABLE_WIDTH - 1) / BASE_TABLE_WIDTH)
+#define BASE_TABLE_ENTRIES   (1 << (BASE_TABLE_WIDTH - 1))
+#include "base_table.h"
+
+// Splits the scalar into signed digits in [-2^(w-1), 2^(w-1)], so that
+// scalar = sum(e[i] * 2^(i*w)).  The scalar must be below 2^255.
+static void base_table_digits(i16 e[BASE_TABLE_POSITIONS], const u8 scalar[32])
+{
+    int carry = 0;
+    FOR_T (int, i, 0, BASE_TABLE_POSITIONS) {
+        int v = carry;
+        FOR_T (int, j, 0, BASE_TABLE_WIDTH) {
+            int bit = i * BASE_TABLE_WIDTH + j;
+            if (bit < 256) { // bit positions are public
+                v += scalar_bit(scalar, bit) << j;
+            }
+        }
+        if (i == BASE_TABLE_POSITIONS - 1) { // no carry out of the last digit
+            e[i] = (i16)v;
+        } else {
+            carry = (v + (1 << (BASE_TABLE_WIDTH - 1))) >> BASE_TABLE_WIDTH;
+            e[i]  = (i16)(v - carry * (1 << BASE_TABLE_WIDTH));
+        }
+    }
+}
+
+// Constant time selection of digit * 2^(position * w) * B
+static void base_table_select(fe yp, fe ym, fe t2, fe n2,
+                              int position, int digit)
+{
+    int neg = (digit >> 15) & 1; // digit is an i16
+    int abs = (digit ^ -neg) + neg;
+    fe_1(yp);
+    fe_1(ym);
+    fe_0(t2);
+    FOR_T (int, j, 0, BASE_TABLE_ENTRIES) {
+        i32 select = 1 & ((((j + 1) ^ abs) - 1) >> 8);
+        fe_ccopy(yp, base_table[position][j].Yp, select);
+        fe_ccopy(ym, base_table[position][j].Ym, select);
+        fe_ccopy(t2, base_table[position][j].T2, select);
+    }
+    // -(x, y) = (-x, y)
+    fe_neg(n2, t2);
+    fe_cswap(t2, n2, neg);
+    fe_cswap(yp, ym, neg);
+}
+
+static void ge_scalarmult_base(ge *p, const u8 scalar[32])
+{
+    // Each digit is looked up in its own sub-table: no doubling needed.
+    i16 e[BASE_TABLE_POSITIONS];
+    base_table_digits(e, scalar);
+
+    fe yp, ym, t2, n2, a; // temporaries for addition
+    ge_zero(p);
+    FOR_T (int, i, 0, BASE_TABLE_POSITIONS) {
+        base_table_select(yp, ym, t2, n2, i, e[i]);
+        ge_madd(p, p, yp, ym, t2, a, n2); // reuse n2 as temporary
+    }
+    WIPE_BUFFER(yp);  WIPE_BUFFER(t2);  WIPE_BUFFER(a);
+    WIPE_BUFFER(ym);  WIPE_BUFFER(n2);
+    WIPE_BUFFER(e);
+}
+
+// Variable time! Internal buffers are not wiped! Scalar must not be secret!
+// Same as ge_scalarmult_base(), but the sub-tables are indexed directly
+// and the zero digits are skipped.
+static void ge_scalarmult_base_vartime(ge *p, const u8 scalar[32])
+{
+    i16 e[BASE_TABLE_POSITIONS];
+    base_table_digits(e, scalar);
+
+    fe a, b;
+    ge_zero(p);
+    FOR_T (int, i, 0, BASE_TABLE_POSITIONS) {
+        if (e[i] > 0) {
+            const ge_precomp *q = &base_table[i][e[i] - 1];
+            ge_madd(p, p, q->Yp, q->Ym, q->T2, a, b);
+        }
+        if (e[i] < 0) {
+            const ge_precomp *q = &base_table[i][-e[i] - 1];
+            ge_msub(p, p, q->Yp, q->Ym, q->T2, a, b);
+        }
+    }
+}
+
+#endif // USE_BASE_TABLE
+
+////////////////////////////////////
+/// 4-way AVX2 fixed-base scalar ///
+////////////////////////////////////
+
+// Same formulas as above, on 4 independent points at once.  Field elements
+// are laid out structure-of-arrays: each vector holds the same limb of 4
+// field elements, one per 64-bit lane.  Limbs are unsigned, in radix 2^25.5
+// (26 bits for even limbs, 25 bits for odd limbs), so that products of limbs
+// fit in _mm256_mul_epu32().  Used when the CPU supports AVX2.
+#if defined(__x86_64__) && !defined(NO_SIMD) && !defined(GENERATING_BASE_TABLE)
+#define USE_AVX2
+#include <immintrin.h>
+#include "cpu_features.h"
+
+#define AVX2 __attribute__((target("avx2")))
+typedef struct { __m256i l[10]; } fe4;
+typedef struct { fe4 X; fe4 Y; fe4 Z; fe4 T; } ge4;
+
+#define V4(x)   _mm256_set1_epi64x((i64)(x))
+#define ADD4(a, b) _mm256_add_epi64(a, b)
+#define MUL4(a, b) _mm256_mul_epu32(a, b)
+
+// Limbs end up below 2^26 + 2^16 (even) and 2^25 + 2^16 (odd).
+// Input limbs must be below 2^63.
+#define FE4_CARRY(i)                                                \
+    c = _mm256_srli_epi64(l[i], (i) & 1 ? 25 : 26);                 \
+    l[i] = _mm256_and_si256(l[i], (i) & 1 ? m25 : m26);             \
+    l[(i) + 1] = ADD4(l[(i) + 1], c)
+
+AVX2 static void fe4_carry(fe4 *h)
+{
+    const __m256i m26 = V4((1 << 26) - 1);
+    const __m256i m25 = V4((1 << 25) - 1);
+    __m256i *l = h->l;
+    __m256i c;
+    FE4_CARRY(0);  FE4_CARRY(4);
+    FE4_CARRY(1);  FE4_CARRY(5);
+    FE4_CARRY(2);  FE4_CARRY(6);
+    FE4_CARRY(3);  FE4_CARRY(7);
+    FE4_CARRY(4);  FE4_CARRY(8);
+    c    = _mm256_srli_epi64(l[9], 25);
+    l[9] = _mm256_and_si256(l[9], m25);
+    l[0] = ADD4(l[0], MUL4(c, V4(19)));
+    FE4_CARRY(0);
+}
+
+// 4*p, to keep the limbs positive in subtractions
+static const i64 fe4_4p[10] = {
+    0xfffffb4, 0x7fffffc, 0xffffffc, 0x7fffffc, 0xffffffc,
+    0x7fffffc, 0xffffffc, 0x7fffffc, 0xffffffc, 0x7fffffc,
+};
+
+AVX2 static void fe4_0(fe4 *h) { FOR (i, 0, 10) h->l[i] = V4(0); }
+AVX2 static void fe4_1(fe4 *h) { h->l[0] = V4(1); FOR (i, 1, 10) h->l[i] = V4(0); }
+
+AVX2 static void fe4_add(fe4 *h, const fe4 *f, const fe4 *g)
+{
+    FOR (i, 0, 10) {
+        h->l[i] = ADD4(f->l[i], g->l[i]);
+    }
+    fe4_carry(h);
+}
+
+AVX2 static void fe4_sub(fe4 *h, const fe4 *f, const fe4 *g)
+{
+    FOR (i, 0, 10) {
+        h->l[i] = _mm256_sub_epi64(ADD4(f->l[i], V4(fe4_4p[i])), g->l[i]);
+    }
+    fe4_carry(h);
+}
+
+// Lanes where mask is set get -f, the others get f
+AVX2 static void fe4_cneg(fe4 *h, const fe4 *f, __m256i mask)
+{
+    fe4 n;
+    FOR (i, 0, 10) {
+        n.l[i] = _mm256_sub_epi64(V4(fe4_4p[i]), f->l[i]);
+    }
+    fe4_carry(&n);
+    FOR (i, 0, 10) {
+        h->l[i] = _mm256_blendv_epi8(f->l[i], n.l[i], mask);
+    }
+}
+
+// Lanes where mask is set get f and g swapped
+AVX2 static void fe4_cswap(fe4 *f, fe4 *g, __m256i mask)
+{
+    FOR (i, 0, 10) {
+        __m256i x = _mm256_and_si256(mask, _mm256_xor_si256(f->l[i], g->l[i]));
+        f->l[i] = _mm256_xor_si256(f->l[i], x);
+        g->l[i] = _mm256_xor_si256(g->l[i], x);
+    }
+}
+
+// Schoolbook product, as in the 32-bit fe_mul().  Input limbs must be
+// below 2^27.
+AVX2 static void fe4_mul(fe4 *h, const fe4 *f, const fe4 *g)
+{
+    __m256i f2[10], g19[10], t[10];
+    FOR (i, 0, 10) {
+        f2 [i] = ADD4(f->l[i], f->l[i]);
+        g19[i] = MUL4(g->l[i], V4(19));
+        t  [i] = V4(0);
+    }
+#pragma GCC unroll 10
+    FOR (i, 0, 10) {
+#pragma GCC unroll 10
+        FOR (j, 0, 10) {
+            // odd * odd limbs are counted twice, wrapped limbs 19 times
+            __m256i a = i & j & 1  ? f2[i]   : f->l[i];
+            __m256i b = i + j < 10 ? g->l[j] : g19[j];
+            t[(i + j) % 10] = ADD4(t[(i + j) % 10], MUL4(a, b));
+        }
+    }
+    FOR (i, 0, 10) {
+        h->l[i] = t[i];
+    }
+    fe4_carry(h);
+}
+
+#ifndef USE_BASE_TABLE // squarings are only needed for the comb's doublings
+// Same as fe4_mul(h, f, f), with the symmetric products computed once
+AVX2 static void fe4_sq(fe4 *h, const fe4 *f)
+{
+    __m256i f2[10], f19[10], f38[10], t[10];
+    FOR (i, 0, 10) {
+        f2 [i] = ADD4(f->l[i], f->l[i]);
+        f19[i] = MUL4(f->l[i], V4(19));
+        f38[i] = ADD4(f19[i], f19[i]);
+        t  [i] = V4(0);
+    }
+#pragma GCC unroll 10
+    FOR (i, 0, 10) {
+#pragma GCC unroll 10
+        FOR (j, i, 10) {
+            int odd  = i & j & 1;
+            int wrap = i + j >= 10;
+            __m256i a = i == j ? f->l[i] : f2[i];
+            __m256i b = odd ? (wrap ? f38[j] : f2[j])
+                            : (wrap ? f19[j] : f->l[j]);
+            t[(i + j) % 10] = ADD4(t[(i + j) % 10], MUL4(a, b));
+        }
+    }
+    FOR (i, 0, 10) {
+        h->l[i] = t[i];
+    }
+    fe4_carry(h);
+}
+
+#endif
+
+AVX2 static void ge4_zero(ge4 *p)
+{
+    fe4_0(&p->X);
+    fe4_1(&p->Y);
+    fe4_1(&p->Z);
+    fe4_0(&p->T);
+}
+
+AVX2 static void ge4_madd(ge4 *s, const ge4 *p,
+                          const fe4 *yp, const fe4 *ym, const fe4 *t2,
+                          fe4 *a, fe4 *b)
+{
+    fe4_add(a    , &p->Y, &p->X);
+    fe4_sub(b    , &p->Y, &p->X);
+    fe4_mul(a    , a    , yp   );
+    fe4_mul(b    , b    , ym   );
+    fe4_add(&s->Y, a    , b    );
+    fe4_sub(&s->X, a    , b    );
+
+    fe4_add(&s->Z, &p->Z, &p->Z);
+    fe4_mul(&s->T, &p->T, t2   );
+    fe4_add(a    , &s->Z, &s->T);
+    fe4_sub(b    , &s->Z, &s->T);
+
+    fe4_mul(&s->T, &s->X, &s->Y);
+    fe4_mul(&s->X, &s->X, b    );
+    fe4_mul(&s->Y, &s->Y, a    );
+    fe4_mul(&s->Z, a    , b    );
+}
+
+#ifndef USE_BASE_TABLE
+AVX2 static void ge4_double(ge4 *s, const ge4 *p, ge4 *q)
+{
+    fe4_sq (&q->X, &p->X);
+    fe4_sq (&q->Y, &p->Y);
+    fe4_sq (&q->Z, &p->Z);
+    fe4_add(&q->Z, &q->Z, &q->Z);
+    fe4_add(&q->T, &p->X, &p->Y);
+    fe4_sq (&s->T, &q->T);
+    fe4_add(&q->T, &q->Y, &q->X);
+    fe4_sub(&q->Y, &q->Y, &q->X);
+    fe4_sub(&q->X, &s->T, &q->T);
+    fe4_sub(&q->Z, &q->Z, &q->Y);
+
+    fe4_mul(&s->X, &q->X, &q->Z);
+    fe4_mul(&s->Y, &q->T, &q->Y);
+    fe4_mul(&s->Z, &q->Y, &q->Z);
+    fe4_mul(&s->T, &q->X, &q->T);
+}
+#endif
+
+// Constant time table lookup: the lanes where mask is set get (yp, ym, t2).
+// acc accumulates the limbs in the representation of the scalar backend,
+// and is converted once all the entries have been scanned.
+AVX2 static void ge4_select(__m256i acc[3][FE_LIMBS], __m256i mask,
+                            const fe yp, const fe ym, const fe t2)
+{
+    FOR (i, 0, FE_LIMBS) {
+        acc[0][i] = _mm256_or_si256(acc[0][i], _mm256_and_si256(mask, V4(yp[i])));
+        acc[1][i] = _mm256_or_si256(acc[1][i], _mm256_and_si256(mask, V4(ym[i])));
+        acc[2][i] = _mm256_or_si256(acc[2][i], _mm256_and_si256(mask, V4(t2[i])));
+    }
+}
+
+// Converts limbs accumulated by ge4_select() to fe4
+AVX2 static void fe4_from_select(fe4 *h, const __m256i acc[FE_LIMBS])
+{
+#ifdef CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
+    // Limbs below 2^52: split them in 26 + 26 bits
+    FOR (i, 0, 5) {
+        h->l[2*i    ] = _mm256_and_si256(acc[i], V4((1 << 26) - 1));
+        h->l[2*i + 1] = _mm256_srli_epi64(acc[i], 26);
+    }
+#else
+    // Carried signed limbs: add 2*p to make them positive
+    FOR (i, 0, 10) {
+        h->l[i] = ADD4(acc[i], V4(fe4_4p[i] / 2));
+    }
+#endif
+}
+
+// Writes the 4 lanes of h back to the scalar representation
+AVX2 static void fe4_extract(fe out[4], const fe4 *h)
+{
+    u64 t[10][4];
+    FOR (i, 0, 10) {
+        _mm256_storeu_si256((__m256i*)t[i], h->l[i]);
+    }
+    FOR (k, 0, 4) {
+#ifdef CONFIG_MODULE_CRYPTO_CURVE25519_RADIX51
+        FOR (i, 0, 5) {
+            out[k][i] = t[2*i][k] + (t[2*i + 1][k] << 26);
+        }
+#else
+        FOR (i, 0, 10) {
+            out[k][i] = (i32)t[i][k];
+        }
+#endif
+    }
+    WIPE_BUFFER(t);
+}
+
+AVX2 static void ge4_extract(ge p[4], const ge4 *q)
+{
+    fe x[4], y[4], z[4], t[4];
+    fe4_extract(x, &q->X);
+    fe4_extract(y, &q->Y);
+    fe4_extract(z, &q->Z);
+    fe4_extract(t, &q->T);
+    FOR (k, 0, 4) {
+        fe_copy(p[k].X, x[k]);
+        fe_copy(p[k].Y, y[k]);
+        fe_copy(p[k].Z, z[k]);
+        fe_copy(p[k].T, t[k]);
+    }
+    WIPE_BUFFER(x);  WIPE_BUFFER(y);
+    WIPE_BUFFER(z);  WIPE_BUFFER(t);
+}
+
+// Adds the selected points to p, negated in the lanes where neg is set
+AVX2 static void ge4_madd_select(ge4 *p, __m256i acc[3][FE_LIMBS],
+                                 __m256i neg, fe4 tmp[5])
+{
+    fe4 *yp = &tmp[0], *ym = &tmp[1], *t2 = &tmp[2];
+    fe4_from_select(yp, acc[0]);
+    fe4_from_select(ym, acc[1]);
+    fe4_from_select(t2, acc[2]);
+    // -(x, y) = (-x, y)
+    fe4_cswap(yp, ym, neg);
+    fe4_cneg (t2, t2, neg);
+    ge4_madd(p, p, yp, ym, t2, &tmp[3], &tmp[4]);
+}
+
+#ifdef USE_BASE_TABLE
+
+// Same as ge_scalarmult_base(), on 4 scalars
+AVX2 static void ge_scalarmult_base_x4(ge p[4], const u8 scalars[4][32])
+{
+    i16 e[4][BASE_TABLE_POSITIONS];
+    FOR (k, 0, 4) {
+        base_table_digits(e[k], scalars[k]);
+    }
+
+    __m256i acc[3][FE_LIMBS];
+    fe4 tmp[5];
+    ge4 q;
+    ge4_zero(&q);
+    FOR_T (int, i, 0, BASE_TABLE_POSITIONS) {
+        __m256i digit = _mm256_set_epi64x(e[3][i], e[2][i], e[1][i], e[0][i]);
+        __m256i neg   = _mm256_cmpgt_epi64(V4(0), digit);
+        __m256i abs   = _mm256_sub_epi64(_mm256_xor_si256(digit, neg), neg);
+        // Digit 0 selects the neutral point (1, 1, 0)
+        __m256i zero  = _mm256_cmpeq_epi64(abs, V4(0));
+        FOR (j, 0, FE_LIMBS) {
+            acc[0][j] = acc[1][j] = acc[2][j] = V4(0);
+        }
+        acc[0][0] = acc[1][0] = _mm256_and_si256(zero, V4(1));
+        FOR_T (int, j, 0, BASE_TABLE_ENTRIES) {
+            __m256i mask = _mm256_cmpeq_epi64(abs, V4(j + 1));
+            const ge_precomp *entry = &base_table[i][j];
+            ge4_select(acc, mask, entry->Yp, entry->Ym, entry->T2);
+        }
+        ge4_madd_select(&q, acc, neg, tmp);
+    }
+    ge4_extract(p, &q);
+    WIPE_CTX(&q);
+    WIPE_BUFFER(acc);
+    WIPE_BUFFER(tmp);
+    WIPE_BUFFER(e);
+}
+
+// Variable time! Internal buffers are not wiped! Scalars must not be secret!
+// Same as ge_scalarmult_base_x4(), but the sub-tables are indexed directly.
+AVX2 static void ge_scalarmult_base_vartime_x4(ge p[4], const u8 scalars[4][32])
+{
+    static const fe one = FE(1, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    static const fe zero = FE(0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    i16 e[4][BASE_TABLE_POSITIONS];
+    FOR (k, 0, 4) {
+        base_table_digits(e[k], scalars[k]);
+    }
+
+    __m256i acc[3][FE_LIMBS];
+    fe4 tmp[5];
+    ge4 q;
+    ge4_zero(&q);
+    FOR_T (int, i, 0, BASE_TABLE_POSITIONS) {
+        const fe *yp[4], *ym[4], *t2[4];
+        i64 neg[4];
+        FOR (k, 0, 4) {
+            int digit = e[k][i];
+            neg[k] = -(i64)(digit < 0);
+            if (digit == 0) {
+                yp[k] = ym[k] = &one;
+                t2[k] = &zero;
+            } else {
+                const ge_precomp *entry = &base_table[i][(digit < 0 ? -digit : digit) - 1];
+                yp[k] = &entry->Yp;
+                ym[k] = &entry->Ym;
+                t2[k] = &entry->T2;
+            }
+        }
+        FOR (j, 0, FE_LIMBS) {
+            acc[0][j] = _mm256_set_epi64x((*yp[3])[j], (*yp[2])[j], (*yp[1])[j], (*yp[0])[j]);
+            acc[1][j] = _mm256_set_epi64x((*ym[3])[j], (*ym[2])[j], (*ym[1])[j], (*ym[0])[j]);
+            acc[2][j] = _mm256_set_epi64x((*t2[3])[j], (*t2[2])[j], (*t2[1])[j], (*t2[0])[j]);
+        }
+        ge4_madd_select(&q, acc, _mm256_set_epi64x(neg[3], neg[2], neg[1], neg[0]), tmp);
+    }
+    ge4_extract(p, &q);
+}
+
+#else // USE_BASE_TABLE
+
+// Same as ge_scalarmult_base(), on 4 scalars
+AVX2 static void ge_scalarmult_base_x4(ge p[4], const u8 scalars[4][32])
+{
+    u8 s_scalar[4][32];
+    FOR (k, 0, 4) {
+        comb_recode(s_scalar[k], scalars[k]);
+    }
+
+    __m256i acc[3][FE_LIMBS];
+    fe4 tmp[5];
+    ge4 q, dbl;
+    ge4_zero(&q);
+    for (int i = 50; i >= 0; i--) {
+        if (i < 50) {
+            ge4_double(&q, &q, &dbl);
+        }
+        i64 index[4], high[4];
+        FOR (k, 0, 4) {
+            u8 teeth = (u8)((scalar_bit(s_scalar[k], i)           ) +
+                            (scalar_bit(s_scalar[k], i +  51) << 1) +
+                            (scalar_bit(s_scalar[k], i + 102) << 2) +
+                            (scalar_bit(s_scalar[k], i + 153) << 3) +
+                            (scalar_bit(s_scalar[k], i + 204) << 4));
+            high [k] = teeth >> 4;
+            index[k] = (teeth ^ (high[k] - 1)) & 15;
+        }
+        __m256i idx = _mm256_set_epi64x(index[3], index[2], index[1], index[0]);
+        __m256i neg = _mm256_cmpeq_epi64(V4(0), _mm256_set_epi64x(
+                                             high[3], high[2], high[1], high[0]));
+        FOR (j, 0, FE_LIMBS) {
+            acc[0][j] = acc[1][j] = acc[2][j] = V4(0);
+        }
+        FOR (j, 0, 16) {
+            __m256i mask = _mm256_cmpeq_epi64(idx, V4(j));
+            ge4_select(acc, mask, comb_Yp[j], comb_Ym[j], comb_T2[j]);
+        }
+        // The comb subtracts the entry when the high bit is cleared
+        ge4_madd_select(&q, acc, neg, tmp);
+    }
+    ge4_extract(p, &q);
+    WIPE_CTX(&q);
+    WIPE_CTX(&dbl);
+    WIPE_BUFFER(acc);
+    WIPE_BUFFER(tmp);
+    WIPE_BUFFER(s_scalar);
+}
+
+// The comb is scanned in constant time anyway: 4 lanes cost less than the
+// direct indexing of ge_scalarmult_base_vartime().
+#define ge_scalarmult_base_vartime_x4 ge_scalarmult_base_x4
+
+#endif // USE_BASE_TABLE
+#endif // AVX2
+
 void crypto_sign_public_key(u8 public_key[32], const u8 secret_key[32])
 {
     u8 a[64];
-    HASH(a, secret_key, 32);
+    HASH_ONEBLOCK(secret_key, 32, a);
     trim_scalar(a);
     ge A;
     ge_scalarmult_base(&A, a);
@@ -1021,6 +1819,227 @@ void crypto_sign_public_key(u8 public_key[32], const u8 secret_key[32])
     WIPE_CTX(&A);
 }
 
+// Number of points normalised with a single inversion
+#define SIGN_BATCH_SIZE 256
+
+// Hashes and trims secret keys, 4 at a time
+static void expand_secret_keys(u8 scalars[][32], const u8 secret_keys[][32],
+                               size_t count)
+{
+    u8 a[4][64];
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const u8 *keys[4] = { secret_keys[i  ], secret_keys[i+1],
+                              secret_keys[i+2], secret_keys[i+3] };
+        HASH_X4(keys, 32, a);
+        FOR (k, 0, 4) {
+            trim_scalar(a[k]);
+            FOR (j, 0, 32) {
+                scalars[i+k][j] = a[k][j];
+            }
+        }
+    }
+    for (; i < count; i++) {
+        HASH_ONEBLOCK(secret_keys[i], 32, a[0]);
+        trim_scalar(a[0]);
+        FOR (j, 0, 32) {
+            scalars[i][j] = a[0][j];
+        }
+    }
+    WIPE_BUFFER(a);
+}
+
+// Same as expand_secret_keys(), for the secret keys of ctx from counter
+static void expand_counter_keys(u8 scalars[][32],
+                                const crypto_sign_counter_ctx *ctx,
+                                u64 counter, size_t count)
+{
+    u8 a[4][64];
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        u64 counters[4] = { counter + i    , counter + i + 1,
+                            counter + i + 2, counter + i + 3 };
+        HASH_COUNTER_X4(&ctx->hash, counters, a);
+        FOR (k, 0, 4) {
+            trim_scalar(a[k]);
+            FOR (j, 0, 32) {
+                scalars[i+k][j] = a[k][j];
+            }
+        }
+    }
+    for (; i < count; i++) {
+        HASH_COUNTER(&ctx->hash, counter + i, a[0]);
+        trim_scalar(a[0]);
+        FOR (j, 0, 32) {
+            scalars[i][j] = a[0][j];
+        }
+    }
+    WIPE_BUFFER(a);
+}
+
+// Public keys of at most SIGN_BATCH_SIZE trimmed scalars
+static void public_keys_from_scalars(u8 public_keys[][32], const u8 s[][32],
+                                     size_t count)
+{
+    ge A  [SIGN_BATCH_SIZE];
+    fe acc[SIGN_BATCH_SIZE];
+    size_t i = 0;
+#ifdef USE_AVX2
+    if (cpu_has_avx2()) {
+        for (; i + 4 <= count; i += 4) {
+            ge_scalarmult_base_x4(&A[i], &s[i]);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        ge_scalarmult_base(&A[i], s[i]);
+    }
+    ge_tobytes_batch(public_keys, A, acc, count);
+    crypto_wipe(A, count * sizeof(ge));
+}
+
+void crypto_sign_public_key_batch(u8 public_keys[][32],
+                                  const u8 secret_keys[][32], size_t count)
+{
+    u8 s[SIGN_BATCH_SIZE][32];
+    while (count > 0) {
+        size_t chunk = MIN(count, SIGN_BATCH_SIZE);
+        expand_secret_keys(s, secret_keys, chunk);
+        public_keys_from_scalars(public_keys, s, chunk);
+        public_keys += chunk;
+        secret_keys += chunk;
+        count       -= chunk;
+    }
+    WIPE_BUFFER(s);
+}
+
+// Internal buffers are not wiped!
+static void ge_tobytes_recip_vartime(u8 s[32], const ge *h, const fe recip)
+{
+    fe x, y;
+    u8 x_bytes[32];
+    fe_mul(x, h->X, recip);
+    fe_mul(y, h->Y, recip);
+    fe_tobytes(x_bytes, x);
+    fe_tobytes(s, y);
+    s[31] ^= (x_bytes[0] & 1) << 7;
+}
+
+// Internal buffers are not wiped!
+// Same as ge_tobytes_batch(), without the wiping.
+static void ge_tobytes_batch_vartime(u8 s[][32], const ge *h, fe *acc,
+                                     size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    fe_copy(acc[0], h[0].Z);
+    FOR (i, 1, count) {
+        fe_mul(acc[i], acc[i-1], h[i].Z);
+    }
+    fe inv, recip;
+    fe_invert(inv, acc[count-1]);
+    for (size_t i = count - 1; i > 0; i--) {
+        fe_mul(recip, inv, acc[i-1]);
+        fe_mul(inv, inv, h[i].Z);
+        ge_tobytes_recip_vartime(s[i], &h[i], recip);
+    }
+    ge_tobytes_recip_vartime(s[0], &h[0], inv);
+}
+
+// Variable time! Internal buffers are not wiped! Scalars must not be secret!
+// Same as public_keys_from_scalars().
+static void public_keys_from_scalars_vartime(u8 public_keys[][32],
+                                             const u8 s[][32], size_t count)
+{
+    ge A  [SIGN_BATCH_SIZE];
+    fe acc[SIGN_BATCH_SIZE];
+    size_t i = 0;
+#ifdef USE_AVX2
+    if (cpu_has_avx2()) {
+        for (; i + 4 <= count; i += 4) {
+            ge_scalarmult_base_vartime_x4(&A[i], &s[i]);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        ge_scalarmult_base_vartime(&A[i], s[i]);
+    }
+    ge_tobytes_batch_vartime(public_keys, A, acc, count);
+}
+
+// The timing of this function leaks information about the secret keys,
+// and copies of them are left on the stack. Use it only to search keys
+// in bulk on a machine where this does not matter, and wipe the keys that
+// are not kept.
+void crypto_sign_public_key_batch_vartime(u8 public_keys[][32],
+                                          const u8 secret_keys[][32],
+                                          size_t count)
+{
+    u8 s[SIGN_BATCH_SIZE][32];
+    while (count > 0) {
+        size_t chunk = MIN(count, SIGN_BATCH_SIZE);
+        expand_secret_keys(s, secret_keys, chunk);
+        public_keys_from_scalars_vartime(public_keys, s, chunk);
+        public_keys += chunk;
+        secret_keys += chunk;
+        count       -= chunk;
+    }
+}
+
+void crypto_sign_counter_init(crypto_sign_counter_ctx *ctx,
+                              const u8 prefix[24])
+{
+    HASH_COUNTER_INIT(&ctx->hash, prefix);
+    FOR (i, 0, 24) {
+        ctx->prefix[i] = prefix[i];
+    }
+}
+
+void crypto_sign_counter_secret_key(u8 secret_key[32],
+                                    const crypto_sign_counter_ctx *ctx,
+                                    u64 counter)
+{
+    FOR (i, 0, 24) {
+        secret_key[i] = ctx->prefix[i];
+    }
+    FOR (i, 0, 8) {
+        secret_key[24 + i] = (u8)(counter >> (56 - 8 * i));
+    }
+}
+
+void crypto_sign_public_key_counter_batch(u8 public_keys[][32],
+                                          const crypto_sign_counter_ctx *ctx,
+                                          u64 counter, size_t count)
+{
+    u8 s[SIGN_BATCH_SIZE][32];
+    while (count > 0) {
+        size_t chunk = MIN(count, SIGN_BATCH_SIZE);
+        expand_counter_keys(s, ctx, counter, chunk);
+        public_keys_from_scalars(public_keys, s, chunk);
+        public_keys += chunk;
+        counter     += chunk;
+        count       -= chunk;
+    }
+    WIPE_BUFFER(s);
+}
+
+// Same warning as crypto_sign_public_key_batch_vartime()
+void crypto_sign_public_key_counter_batch_vartime(
+    u8 public_keys[][32], const crypto_sign_counter_ctx *ctx,
+    u64 counter, size_t count)
+{
+    u8 s[SIGN_BATCH_SIZE][32];
+    while (count > 0) {
+        size_t chunk = MIN(count, SIGN_BATCH_SIZE);
+        expand_counter_keys(s, ctx, counter, chunk);
+        public_keys_from_scalars_vartime(public_keys, s, chunk);
+        public_keys += chunk;
+        counter     += chunk;
+        count       -= chunk;
+    }
+}
+
 void crypto_sign_init_first_pass(crypto_sign_ctx *ctx,
                                  const u8 secret_key[32],
                                  const u8 public_key[32])
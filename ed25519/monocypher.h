@@ -26,6 +26,12 @@ typedef struct {
     uint8_t pk [32];
 } crypto_check_ctx;
 
+// Secret keys made of a constant prefix and a counter
+typedef struct {
+    cf_sha512_counter_context hash;
+    uint8_t prefix[24];
+} crypto_sign_counter_ctx;
+
 ////////////////////////////
 /// High level interface ///
 ////////////////////////////
@@ -37,6 +43,39 @@ typedef struct {
 void crypto_sign_public_key(uint8_t        public_key[32],
                             const uint8_t  secret_key[32]);
 
+// Generate count public keys at once.  Faster than calling
+// crypto_sign_public_key() count times.
+void crypto_sign_public_key_batch(uint8_t        public_keys[][32],
+                                  const uint8_t  secret_keys[][32],
+                                  size_t         count);
+
+// Same as crypto_sign_public_key_batch(), but faster and not constant
+// time.  Secrets are not wiped either.  Only use it to mine keys!
+void crypto_sign_public_key_batch_vartime(uint8_t        public_keys[][32],
+                                          const uint8_t  secret_keys[][32],
+                                          size_t         count);
+
+// Secret keys made of a constant 24-byte prefix followed by a big endian
+// 64-bit counter.  Consecutive keys are cheaper to derive in bulk than
+// arbitrary keys: the part of the hash that only reads the prefix is
+// computed once, by crypto_sign_counter_init().
+void crypto_sign_counter_init(crypto_sign_counter_ctx *ctx,
+                              const uint8_t prefix[24]);
+void crypto_sign_counter_secret_key(uint8_t secret_key[32],
+                                    const crypto_sign_counter_ctx *ctx,
+                                    uint64_t counter);
+
+// Same as crypto_sign_public_key_batch() and its variable-time variant,
+// for the count secret keys of ctx starting from counter.
+void crypto_sign_public_key_counter_batch(uint8_t public_keys[][32],
+                                          const crypto_sign_counter_ctx *ctx,
+                                          uint64_t counter, size_t count);
+void crypto_sign_public_key_counter_batch_vartime(
+    uint8_t                        public_keys[][32],
+    const crypto_sign_counter_ctx *ctx,
+    uint64_t                       counter,
+    size_t                         count);
+
 // Direct interface
 void crypto_sign(uint8_t        signature [64],
                  const uint8_t  secret_key[32],
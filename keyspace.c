@@ -0,0 +1,93 @@
+#include "keyspace.h"
+#include "sha2.h"
+#include "handy.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+// Prepended to the seed before hashing it, so that the prefixes do not come
+// from a hash of the seed that could be used elsewhere
+#define KEYSPACE_DOMAIN "mining-devzat-id keyspace"
+
+bool keyspace_random_seed(uint8_t seed[KEYSPACE_SEED_SIZE]) {
+#ifdef __linux__
+	if (getrandom(seed, KEYSPACE_SEED_SIZE, 0) == KEYSPACE_SEED_SIZE) {
+		return true;
+	}
+#endif
+	FILE* f = fopen("/dev/urandom", "r");
+	if (f == NULL) {
+		f = fopen("/dev/random", "r");
+	}
+	if (f == NULL) {
+		fprintf(stderr, "Error, unable to find a true random source.\n");
+		return false;
+	}
+	bool ok = fread(seed, KEYSPACE_SEED_SIZE, 1, f) == 1;
+	fclose(f);
+	if (!ok) {
+		fprintf(stderr, "Error, unable to read from the true random source.\n");
+	}
+	return ok;
+}
+
+// Value of a hex digit, or -1
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+bool keyspace_parse_seed(uint8_t seed[KEYSPACE_SEED_SIZE], const char* hex) {
+	if (strlen(hex) != KEYSPACE_SEED_SIZE * 2) {
+		return false;
+	}
+	for (int i=0; i<KEYSPACE_SEED_SIZE; i++) {
+		int high = hex_digit(hex[2 * i]);
+		int low = hex_digit(hex[2 * i + 1]);
+		if (high < 0 || low < 0) {
+			return false;
+		}
+		seed[i] = (uint8_t) (high << 4 | low);
+	}
+	return true;
+}
+
+void keyspace_init(keyspace* space, const uint8_t seed[KEYSPACE_SEED_SIZE]) {
+	memcpy(space->seed, seed, KEYSPACE_SEED_SIZE);
+}
+
+uint64_t keyspace_worker_candidates(const keyspace* space, unsigned int index, uint64_t generation, ed25519_counter_ctx* candidates) {
+	// The worker and the generation, in big endian
+	uint8_t position[12];
+	for (int i=0; i<4; i++) {
+		position[i] = (uint8_t) (index >> (24 - 8 * i));
+	}
+	for (int i=0; i<8; i++) {
+		position[4 + i] = (uint8_t) (generation >> (56 - 8 * i));
+	}
+	uint8_t hash[CF_SHA512_HASHSZ];
+	cf_sha512_context ctx;
+	cf_sha512_init(&ctx);
+	cf_sha512_update(&ctx, KEYSPACE_DOMAIN, strlen(KEYSPACE_DOMAIN));
+	cf_sha512_update(&ctx, space->seed, KEYSPACE_SEED_SIZE);
+	cf_sha512_update(&ctx, position, sizeof(position));
+	cf_sha512_digest_final(&ctx, hash);
+	ed25519_counter_init(candidates, hash);
+	uint64_t start = 0;
+	for (int i=0; i<8; i++) {
+		start = (start << 8) | hash[CURVE_25519_COUNTER_PREFIX_SIZE + i];
+	}
+	mem_clean(hash, sizeof(hash));
+	mem_clean(&ctx, sizeof(ctx));
+	return start;
+}
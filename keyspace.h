@@ -0,0 +1,45 @@
+#ifndef _KEYSPACE_H_
+#define _KEYSPACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "curve25519.h"
+
+// Size of the master seed of a search
+#define KEYSPACE_SEED_SIZE 32
+
+// Number of workers that the candidates of a search can be split between
+#define KEYSPACE_MAX_WORKERS (1 << 16)
+
+// The candidates of a search, derived from its master seed. A candidate
+// secret key is a CURVE_25519_COUNTER_PREFIX_SIZE-byte prefix followed by a
+// big endian counter, so that anybody who holds one of them finds all the
+// others of its prefix by trying the counters around it: keys of the same
+// prefix must never go to different recipients.
+// Each worker therefore draws its prefixes from its own stream, a hash DRBG
+// keyed by the seed: the prefix of generation g of worker i, and the counter
+// its candidates start from, are hashed from the domain, the seed, i and g.
+// A worker tries the candidates of a generation one counter after the other,
+// and moves to its next generation once it gives out a key, so that no two
+// keys given out share a prefix. The same seed gives the same candidates, in
+// the same order.
+typedef struct {
+	uint8_t seed[KEYSPACE_SEED_SIZE];
+} keyspace;
+
+// Read a master seed from the random source of the system. Print an error
+// and return false if there is none.
+bool keyspace_random_seed(uint8_t seed[KEYSPACE_SEED_SIZE]);
+
+// Read a master seed written as KEYSPACE_SEED_SIZE * 2 hex digits. Return
+// false if it is not valid.
+bool keyspace_parse_seed(uint8_t seed[KEYSPACE_SEED_SIZE], const char* hex);
+
+void keyspace_init(keyspace* space, const uint8_t seed[KEYSPACE_SEED_SIZE]);
+
+// Set candidates to the prefix of the generation of the worker, and return
+// the counter of its first candidate
+uint64_t keyspace_worker_candidates(const keyspace* space, unsigned int index, uint64_t generation, ed25519_counter_ctx* candidates);
+
+#endif
+
@@ -1,39 +1,135 @@
 #include "devzat_mining.h"
+#include "keyspace.h"
+#include "devzat_matcher.h"
+#include "mining_server.h"
+#include "handy.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <signal.h>
 
 static void help(const char* prg_name) {
     printf("mining-devzat-id, a tool to get yourself a shiny SSH ID.\n");
     printf("This tool generates an openSSH ed25519 private key that will make a\n"
            "cool Devzat id or SSH pubkey.\n\n");
     printf("Usage:\n");
-    printf("    %s desired-id [-j thread-number] [-o output-file] [-t type]\n", prg_name);
+    printf("    %s desired-id [-j thread-number] [-o output-file] [-n count] [-t type] [-m position] [-p] [-i] [-f] [-s seed] [-c checkpoint-file] [limits]\n", prg_name);
+    printf("    %s desired-id --reservoir reservoir-file [-j thread-number] [-o output-file] [-m position] [-p] [-f] [limits]\n", prg_name);
+    printf("    %s --score metric [--target-score score] [-j thread-number] [-o output-file] [-f] [-s seed] [-c checkpoint-file] [limits]\n", prg_name);
+    printf("    %s --resume checkpoint-file [-o output-file] [-f] [limits]\n", prg_name);
+    printf("    %s -b targets-file [-j thread-number] [-m position] [-f] [-s seed]\n", prg_name);
+    printf("    %s --serve socket [-j thread-number] [-f]\n", prg_name);
+    printf("    %s --client socket desired-id [-o output-file] [-n count] [-t type] [-m position] [-p] [-i] [--priority priority] [--deadline seconds]\n", prg_name);
     printf("  desired-id: Vanity part of the resulting id. If desired-id is 000, you\n"
            "              will get an id starting with 000 such as 000c6d33...\n");
     printf("  thread-number: Number of threads used to compute the id.\n"
            "                 Default to 1.\n");
     printf("  output-file: Oath to the file where the generated key will be written.\n"
            "               Default to stdout.\n");
+    printf("  count: Number of keys to generate, written as they are found. With\n"
+           "         an output-file, the keys are written to output-file.1,\n"
+           "         output-file.2... 0 generates keys until interrupted.\n");
     printf("  type: Either 'devzat-id' to generate a key that will  make the desired\n"
            "        Devzat ID or 'ssh-pubkey' to generate a key with the desired ID\n"
            "        as it's pubkey sufix. Default to Devzat ID.\n");
+    printf("  position: Either 'prefix', 'suffix' or 'anywhere' (Devzat ID only) to\n"
+           "            look for the desired ID at the start, at the end or anywhere\n"
+           "            in the Devzat ID or pubkey. In pubkeys, the prefix comes\n"
+           "            after the AAAAC3NzaC1lZDI1NTE5AAAAI header that all ed25519\n"
+           "            keys share. Default to prefix for Devzat IDs and to suffix\n"
+           "            for pubkeys.\n");
+    printf("  -p: Read desired-id as a pattern. Besides hex digits or base64\n"
+           "      characters, it can have . for any character, classes such as\n"
+           "      [0-9] or [^a-f], groups with alternatives such as (dead|beef),\n"
+           "      and repeats ?, *, +, {n}, {n,} or {n,m}. Use \\ to escape a\n"
+           "      special character, as in \\+ for the base64 +.\n");
+    printf("  targets-file: File with a Devzat ID reference per line, optionally\n"
+           "                followed by the path where its key is written, which\n"
+           "                defaults to the reference followed by .key. All the\n"
+           "                references are mined at once, until each has a key.\n");
+    printf("  -i: In ssh-pubkey mode, ignore the case of the desired ID.\n");
+    printf("  -f: Use a faster key derivation that is not constant time and does not\n"
+           "      wipe the rejected keys from memory. Only use it on a machine where\n"
+           "      nobody else can run code.\n");
+    printf("  seed: 64 hex digits from which all the candidate keys are derived,\n"
+           "        to get the same keys in the same order on each run, for\n"
+           "        example to compare the speed of two builds. Anybody who\n"
+           "        knows the seed can find the keys. Default to a random seed.\n");
+    printf("  checkpoint-file: File where the progress of the search is saved every\n"
+           "                   %d seconds, to continue it later with --resume. It\n"
+           "                   holds the seed, so keep it as secret as the key.\n", CHECKPOINT_INTERVAL);
+    printf("  metric: Instead of a desired-id, look for the Devzat ID with the best\n"
+           "          score: 'leading-zeros' for the most 0 at its start, 'repeat'\n"
+           "          for the longest run of a single digit or 'digits' for the\n"
+           "          most digits from 0 to 9. The search stops at the first key\n"
+           "          that scores at least the target score, or when the limits\n"
+           "          run out or on Ctrl-C, with the best key found.\n");
+    printf("  reservoir-file: File shared by the searches that keeps keys they\n"
+           "                  rejected, by the first %d digits of their Devzat ID.\n"
+           "                  A key of the reservoir that matches desired-id is\n"
+           "                  given out at once, and only once. Otherwise, the\n"
+           "                  search adds the keys it rejects to the reservoir.\n", RESERVOIR_PREFIX_DIGITS);
+    printf("  socket: Unix socket where a server keeps a pool of thread-number\n"
+           "          threads mining the jobs of its clients at once, each key\n"
+           "          being checked against all of them. A client sends a job\n"
+           "          and writes the count keys it gets back, as with -n,\n"
+           "          except that a single key is written to output-file. Up\n"
+           "          to %d jobs are mined at once; the others wait, the clients\n"
+           "          with fewer jobs mined going first and the priority\n"
+           "          ordering the jobs of a client. A job expires after its\n"
+           "          deadline, with exit code 3, and stopping the client\n"
+           "          cancels it.\n", MINING_POOL_SLOTS);
+    printf("  limits: --max-time seconds and --max-attempts number stop the search\n"
+           "          after that time or that many candidates. As with Ctrl-C, the\n"
+           "          search then writes the key whose Devzat ID or public key has\n"
+           "          the most digits or characters of the desired ID in a row,\n"
+           "          from its start, or from its end with -m suffix, and exits\n"
+           "          with code 3.\n");
 }
 
 struct args {
     char* desired_id;
-    FILE* out;
+    char* metric;
+    int   target_score;
+    char* targets_file;
+    char* output_file;
+    char* checkpoint_file;
+    char* resume_file;
+    char* reservoir_file;
+    char* serve_socket;
+    char* client_socket;
+    int   priority;
+    bool  priority_given;
+    unsigned long long deadline;
+    unsigned long long count;
+    bool  count_given;
+    uint8_t seed[KEYSPACE_SEED_SIZE];
+    bool  seed_given;
+    mining_limits limits;
     int   thread_number;
+    bool  thread_number_given;
     bool  devzat_mode;
+    bool  type_given;
+    bool  vartime;
+    match_position position;
+    bool  position_given;
+    bool  ignore_case;
+    bool  is_pattern;
     bool  asked_for_help;
 };
 
 void free_args(struct args* args) {
     if (args) {
         free(args->desired_id);
-        if (args->out && args->out != stdout) {
-            fclose(args->out);
-        }
+        free(args->metric);
+        free(args->targets_file);
+        free(args->output_file);
+        free(args->checkpoint_file);
+        free(args->resume_file);
+        free(args->reservoir_file);
+        free(args->serve_socket);
+        free(args->client_socket);
+        mem_clean(args->seed, sizeof(args->seed));
         free(args);
     }
 }
@@ -42,7 +138,6 @@ void free_args(struct args* args) {
 struct args* read_args(int argc, char** argv) {
     struct args* args = calloc(1, sizeof(*args));
     args->thread_number = 1;
-    args->out = stdout;
     args->devzat_mode = true;
     int current_arg = 1;
     while (current_arg < argc) {
@@ -52,16 +147,109 @@ struct args* read_args(int argc, char** argv) {
         } else if(!strcmp(argv[current_arg], "-j")) {
             if (++current_arg >= argc) {return NULL;}
             args->thread_number = atoi(argv[current_arg++]);
-            if (args->thread_number == 0) {
+            if (args->thread_number <= 0 || args->thread_number > KEYSPACE_MAX_WORKERS) {
                 return NULL;
             }
+            args->thread_number_given = true;
         } else if(!strcmp(argv[current_arg], "-o")) {
             if (++current_arg >= argc) {return NULL;}
-            args->out = fopen(argv[current_arg++], "w");
-            if (!args->out) {
-                fprintf(stderr, "Error, unable to open output file.\n");
+            free(args->output_file);
+            args->output_file = strdup(argv[current_arg++]);
+        } else if(!strcmp(argv[current_arg], "-n")) {
+            if (++current_arg >= argc) {return NULL;}
+            char* end;
+            args->count = strtoull(argv[current_arg++], &end, 10);
+            if (*end || end == argv[current_arg - 1]) {
+                return NULL;
+            }
+            args->count_given = true;
+        } else if(!strcmp(argv[current_arg], "-b")) {
+            if (++current_arg >= argc) {return NULL;}
+            free(args->targets_file);
+            args->targets_file = strdup(argv[current_arg++]);
+        } else if(!strcmp(argv[current_arg], "-c")) {
+            if (++current_arg >= argc) {return NULL;}
+            free(args->checkpoint_file);
+            args->checkpoint_file = strdup(argv[current_arg++]);
+        } else if(!strcmp(argv[current_arg], "--resume")) {
+            if (++current_arg >= argc) {return NULL;}
+            free(args->resume_file);
+            args->resume_file = strdup(argv[current_arg++]);
+        } else if(!strcmp(argv[current_arg], "--reservoir")) {
+            if (++current_arg >= argc) {return NULL;}
+            free(args->reservoir_file);
+            args->reservoir_file = strdup(argv[current_arg++]);
+        } else if(!strcmp(argv[current_arg], "--serve") || !strcmp(argv[current_arg], "--client")) {
+            char** socket_path = !strcmp(argv[current_arg], "--serve") ? &args->serve_socket : &args->client_socket;
+            if (++current_arg >= argc) {return NULL;}
+            free(*socket_path);
+            *socket_path = strdup(argv[current_arg++]);
+        } else if(!strcmp(argv[current_arg], "--priority")) {
+            if (++current_arg >= argc) {return NULL;}
+            char* end;
+            args->priority = (int) strtol(argv[current_arg++], &end, 10);
+            if (*end || end == argv[current_arg - 1]) {
+                return NULL;
+            }
+            args->priority_given = true;
+        } else if(!strcmp(argv[current_arg], "--deadline")) {
+            if (++current_arg >= argc) {return NULL;}
+            char* end;
+            args->deadline = strtoull(argv[current_arg++], &end, 10);
+            if (*end || end == argv[current_arg - 1] || !args->deadline) {
+                return NULL;
+            }
+        } else if(!strcmp(argv[current_arg], "--score")) {
+            if (++current_arg >= argc) {return NULL;}
+            free(args->metric);
+            args->metric = strdup(argv[current_arg++]);
+        } else if(!strcmp(argv[current_arg], "--target-score")) {
+            if (++current_arg >= argc) {return NULL;}
+            args->target_score = atoi(argv[current_arg++]);
+            if (args->target_score <= 0 || args->target_score > DEVZAT_ID_DIGITS) {
                 return NULL;
             }
+        } else if(!strcmp(argv[current_arg], "--max-time") || !strcmp(argv[current_arg], "--max-attempts")) {
+            bool time_limit = !strcmp(argv[current_arg], "--max-time");
+            if (++current_arg >= argc) {return NULL;}
+            char* end;
+            uint64_t limit = strtoull(argv[current_arg++], &end, 10);
+            if (*end || end == argv[current_arg - 1] || !limit) {
+                return NULL;
+            }
+            if (time_limit) {
+                args->limits.max_time = limit;
+            } else {
+                args->limits.max_attempts = limit;
+            }
+        } else if(!strcmp(argv[current_arg], "-s")) {
+            if (++current_arg >= argc) {return NULL;}
+            if (!keyspace_parse_seed(args->seed, argv[current_arg++])) {
+                return NULL;
+            }
+            args->seed_given = true;
+        } else if(!strcmp(argv[current_arg], "-f")) {
+            args->vartime = true;
+            current_arg++;
+        } else if(!strcmp(argv[current_arg], "-p")) {
+            args->is_pattern = true;
+            current_arg++;
+        } else if(!strcmp(argv[current_arg], "-i")) {
+            args->ignore_case = true;
+            current_arg++;
+        } else if(!strcmp(argv[current_arg], "-m")) {
+            if (++current_arg >= argc) {return NULL;}
+            if (!strcmp(argv[current_arg], "suffix")) {
+                args->position = MATCH_SUFFIX;
+            } else if (!strcmp(argv[current_arg], "prefix")) {
+                args->position = MATCH_PREFIX;
+            } else if (!strcmp(argv[current_arg], "anywhere")) {
+                args->position = MATCH_ANYWHERE;
+            } else {
+                return NULL;
+            }
+            args->position_given = true;
+            current_arg++;
         } else if(!strcmp(argv[current_arg], "-t")) {
             if (++current_arg >= argc) {return NULL;}
             if (!strcmp(argv[current_arg], "devzat-id")) {
@@ -71,6 +259,7 @@ struct args* read_args(int argc, char** argv) {
             } else {
                 return NULL;
             }
+            args->type_given = true;
             current_arg++;
         } else {
             if (args->desired_id) {
@@ -80,9 +269,67 @@ struct args* read_args(int argc, char** argv) {
             }
         }
     }
+    // The batch mode only mines Devzat ID references for key files
+    if (args->targets_file && (args->desired_id || !args->devzat_mode || args->is_pattern || args->ignore_case || args->output_file || args->count_given)) {
+        return NULL;
+    }
+    // Only one key is mined with checkpoints or limits
+    bool limited = args->limits.max_time || args->limits.max_attempts;
+    if ((args->checkpoint_file || limited) && (args->targets_file || args->count_given)) {
+        return NULL;
+    }
+    // A metric scores Devzat IDs on their own, instead of a reference
+    if (args->target_score && !args->metric) {
+        return NULL;
+    }
+    if (args->metric && (args->desired_id || args->targets_file || args->count_given || !args->devzat_mode || args->position_given || args->is_pattern || args->ignore_case)) {
+        return NULL;
+    }
+    // The reservoir only holds keys given out once: never keys of a seed or
+    // of a checkpoint, which a later run derives again
+    if (args->reservoir_file && (args->targets_file || args->count_given || !args->devzat_mode || args->seed_given || args->checkpoint_file || args->resume_file)) {
+        return NULL;
+    }
+    // The server gets its jobs from the clients, which only send a reference
+    bool single_search = args->metric || args->targets_file || args->checkpoint_file || args->resume_file || args->reservoir_file || args->seed_given || limited;
+    if (args->serve_socket) {
+        bool job_given = args->desired_id || args->client_socket || args->output_file || args->count_given || args->type_given || args->position_given || args->is_pattern || args->ignore_case || args->priority_given || args->deadline;
+        return job_given || single_search ? NULL : args;
+    }
+    if ((args->priority_given || args->deadline) && !args->client_socket) {
+        return NULL;
+    }
+    if (args->client_socket && (single_search || args->thread_number_given || args->vartime || !args->desired_id)) {
+        return NULL;
+    }
+    // The search to resume is described by the checkpoint
+    if (args->resume_file) {
+        bool search_given = args->desired_id || args->metric || args->targets_file || args->count_given || args->seed_given || args->checkpoint_file;
+        bool options_given = args->thread_number_given || args->type_given || args->position_given || args->is_pattern || args->ignore_case;
+        return search_given || options_given ? NULL : args;
+    }
+    if (!args->targets_file && !args->desired_id && !args->metric) {
+        return NULL;
+    }
+    if (!args->position_given) {
+        args->position = args->devzat_mode ? MATCH_PREFIX : MATCH_SUFFIX;
+    }
     return args;
 }
 
+// Stop the search on the first Ctrl-C or SIGTERM, and let the next one kill
+// the program
+static void interrupt(int signal_number) {
+    signal(signal_number, SIG_DFL);
+    devzat_mining_interrupt();
+}
+
+// Same for the server, which stops once its clients are told
+static void stop_serving(int signal_number) {
+    signal(signal_number, SIG_DFL);
+    mining_server_stop();
+}
+
 int main(int argc, char** argv) {
     if (argc <= 1) {
         fprintf(stderr, "Error, invalid arguments.\nRun `%s --help` for more info.\n", argv[0]);
@@ -101,22 +348,145 @@ int main(int argc, char** argv) {
         return 0;
     }
 
-    char* keyfile;
-    if (args->thread_number > 1) {
-        keyfile = devzat_mining_multi(args->desired_id, args->thread_number, args->devzat_mode);
+    if (args->serve_socket) {
+        signal(SIGINT, stop_serving);
+        signal(SIGTERM, stop_serving);
+        bool ok = mining_server_run(args->serve_socket, args->thread_number, args->vartime);
+        free_args(args);
+        return ok ? 0 : 4;
+    }
+
+    if (args->client_socket) {
+        mining_request request = {
+            .reference = args->desired_id,
+            .devzat_mode = args->devzat_mode,
+            .position = args->position,
+            .ignore_case = args->ignore_case,
+            .is_pattern = args->is_pattern,
+            .count = args->count_given ? args->count : 1,
+            .priority = args->priority,
+            .deadline = args->deadline,
+        };
+        int ret = mining_client_run(args->client_socket, &request, args->output_file);
+        free_args(args);
+        return ret;
+    }
+
+    checkpoint state;
+    if (args->resume_file) {
+        if (!checkpoint_read(&state, args->resume_file)) {
+            free_args(args);
+            return 4;
+        }
+        args->checkpoint_file = strdup(args->resume_file);
+    } else if (args->seed_given) {
+        fprintf(stderr, "Warning, the keys are derived from the given seed. Do not use them for anything else than tests.\n");
+    } else if (!keyspace_random_seed(args->seed)) {
+        free_args(args);
+        return 4;
+    }
+
+    if (args->checkpoint_file && !args->resume_file) {
+        checkpoint_init(&state, args->seed, args->metric ? args->metric : args->desired_id, args->devzat_mode, args->position, args->ignore_case, args->is_pattern, args->thread_number);
+        state.is_metric = args->metric != NULL;
+        state.target_score = args->target_score;
+        if (!checkpoint_write(&state, args->checkpoint_file)) {
+            checkpoint_free(&state);
+            free_args(args);
+            return 4;
+        }
+    }
+
+    // Before any search, so that streams and batches never die in the
+    // middle of writing a key file
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    if (args->targets_file) {
+        bool ok = devzat_mining_batch(args->targets_file, args->thread_number, args->vartime, args->position, args->seed);
+        free_args(args);
+        return ok ? 0 : 4;
+    }
+
+    if (args->count_given) {
+        bool ok = devzat_mining_stream(args->desired_id, args->thread_number, args->devzat_mode, args->vartime, args->position, args->ignore_case, args->is_pattern, args->count, args->output_file, args->seed);
+        free_args(args);
+        return ok ? 0 : 4;
+    }
+
+    FILE* out = stdout;
+    if (args->output_file) {
+        out = open_key_file(args->output_file);
+        if (!out) {
+            fprintf(stderr, "Error, unable to open output file.\n");
+            if (args->checkpoint_file) {
+                checkpoint_free(&state);
+            }
+            free_args(args);
+            return 1;
+        }
+    }
+
+    reservoir store;
+    char* keyfile = NULL;
+    if (args->reservoir_file) {
+        if (!reservoir_open(&store, args->reservoir_file)) {
+            if (out != stdout) {
+                fclose(out);
+            }
+            free_args(args);
+            return 4;
+        }
+        if (args->desired_id && !devzat_mining_take_reserved(&store, args->desired_id, args->position, args->is_pattern, &keyfile)) {
+            reservoir_close(&store);
+            if (out != stdout) {
+                fclose(out);
+            }
+            free_args(args);
+            return 4;
+        }
+        devzat_mining_feed_reservoir(&store);
+    }
+
+    if (keyfile) {
+        // Taken from the reservoir, there is nothing to mine
+    } else if (args->checkpoint_file) {
+        keyfile = devzat_mining_checkpoint(&state, args->vartime, args->checkpoint_file, &args->limits);
+        checkpoint_free(&state);
+    } else if (args->metric) {
+        keyfile = devzat_mining_score(args->metric, args->target_score, args->thread_number, args->vartime, args->seed, &args->limits);
+    } else if (args->thread_number > 1) {
+        keyfile = devzat_mining_multi(args->desired_id, args->thread_number, args->devzat_mode, args->vartime, args->position, args->ignore_case, args->is_pattern, args->seed, &args->limits);
     } else {
-        keyfile = devzat_mining_mono(args->desired_id, args->devzat_mode);
+        keyfile = devzat_mining_mono(args->desired_id, args->devzat_mode, args->vartime, args->position, args->ignore_case, args->is_pattern, args->seed, &args->limits);
+    }
+    if (args->reservoir_file) {
+        devzat_mining_feed_reservoir(NULL);
+        reservoir_close(&store);
     }
     if (keyfile == NULL) {
-        return 4;
+        if (out != stdout) {
+            fclose(out);
+        }
         free_args(args);
+        return 4;
     }
 
-    fprintf(args->out, "%s", keyfile);
+    fprintf(out, "%s", keyfile);
+    if (out != stdout) {
+        fclose(out);
+    }
+    // The search is over, it can not be resumed anymore
+    bool exhausted = args->limits.exhausted;
+    if (args->checkpoint_file && !exhausted) {
+        remove(args->checkpoint_file);
+    }
 
+    // The key is secret, wipe it as the workers wipe their state
+    mem_clean(keyfile, strlen(keyfile));
     free(keyfile);
     free_args(args);
 
-    return 0;
+    return exhausted ? 3 : 0;
 }
 
@@ -0,0 +1,12 @@
+#ifndef _MATCH_POSITION_H_
+#define _MATCH_POSITION_H_
+
+// Where the reference has to be found in the Devzat ID or base64 public key
+typedef enum {
+	MATCH_PREFIX,   // At the start of the ID, or right after the AAAAC3NzaC1lZDI1NTE5AAAAI header that all the ed25519 keys share
+	MATCH_SUFFIX,   // At the end
+	MATCH_ANYWHERE, // At any offset, only for Devzat IDs
+} match_position;
+
+#endif
+
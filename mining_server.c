@@ -0,0 +1,553 @@
+#include "mining_server.h"
+#include "devzat_mining.h"
+#include "keyspace.h"
+#include "openssh_formatter.h"
+#include "curve25519.h"
+#include "handy.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Maximum size of a line of the protocol
+#define MAX_LINE 4096
+
+// Seconds after which a client that does not read what it is sent is
+// disconnected
+#define SEND_TIMEOUT 5
+
+static const char* const type_names[] = {"ssh-pubkey", "devzat-id"};
+static const char* const position_names[] = {
+	[MATCH_PREFIX] = "prefix",
+	[MATCH_SUFFIX] = "suffix",
+	[MATCH_ANYWHERE] = "anywhere",
+};
+
+// Set by mining_server_stop
+static atomic_bool stopping = false;
+
+typedef struct {
+	int fd; // -1 if there is no client
+	bool broken; // Set when the client is to be disconnected
+	unsigned int active; // Number of its jobs in the pool
+	size_t input_size;
+	char input[MAX_LINE];
+} server_client;
+
+typedef struct {
+	bool used;
+	uint64_t id;
+	int client;
+	char* reference;
+	mining_request request;
+	time_t deadline; // 0 for no deadline
+	int slot;        // Slot of the pool, or -1 while waiting for one
+	uint64_t sent;   // Number of keys sent
+} server_job;
+
+typedef struct {
+	mining_pool* pool;
+	int listener;
+	int wake[2]; // Written by the workers of the pool when they find a key
+	uint64_t last_id;
+	server_client client[MINING_SERVER_MAX_CLIENTS];
+	server_job job[MINING_SERVER_MAX_JOBS];
+} server;
+
+void mining_server_stop(void) {
+	atomic_store(&stopping, true);
+}
+
+// Called by the workers of the pool after they push a key
+static void wake_server(void* argument) {
+	server* srv = argument;
+	char byte = 0;
+	// If the pipe is full, the server is already woken up
+	ssize_t written = write(srv->wake[1], &byte, 1);
+	(void) written;
+}
+
+static bool send_all(int fd, const char* data, size_t size) {
+	while (size) {
+		ssize_t n = write(fd, data, size);
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Send a line to the client, and mark it to be disconnected if it fails
+static void send_line(server* srv, int c, const char* format, ...) {
+	server_client* client = &srv->client[c];
+	if (client->broken) {
+		return;
+	}
+	char line[MAX_LINE];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	client->broken = !send_all(client->fd, line, strlen(line));
+}
+
+// Remove the job, from the pool if it is in it, and tell its client why if
+// status is not NULL
+static void finish_job(server* srv, server_job* job, const char* status) {
+	if (job->slot >= 0) {
+		mining_pool_remove(srv->pool, job->slot);
+		srv->client[job->client].active--;
+	}
+	if (status) {
+		send_line(srv, job->client, "%s %llu\n", status, (unsigned long long) job->id);
+	}
+	free(job->reference);
+	memset(job, 0, sizeof(server_job));
+}
+
+// Read the arguments of a mine command in the request. Return an error
+// message if they are not valid.
+static const char* read_request(mining_request* request) {
+	memset(request, 0, sizeof(mining_request));
+	request->devzat_mode = true;
+	request->count = 1;
+	bool position_given = false;
+	char* argument;
+	while ((argument = strtok(NULL, " \r\n"))) {
+		char* value = strchr(argument, '=');
+		if (!value) {
+			return "arguments should be key=value";
+		}
+		*value++ = 0;
+		char* end = NULL;
+		if (!strcmp(argument, "reference")) {
+			request->reference = value;
+		} else if (!strcmp(argument, "type")) {
+			if (strcmp(value, type_names[0]) && strcmp(value, type_names[1])) {
+				return "unknown type";
+			}
+			request->devzat_mode = !strcmp(value, type_names[1]);
+		} else if (!strcmp(argument, "position")) {
+			int position = -1;
+			for (size_t i=0; i<ARRAYCOUNT(position_names); i++) {
+				position = strcmp(value, position_names[i]) ? position : (int) i;
+			}
+			if (position < 0) {
+				return "unknown position";
+			}
+			request->position = (match_position) position;
+			position_given = true;
+		} else if (!strcmp(argument, "pattern") || !strcmp(argument, "ignore-case")) {
+			if (strcmp(value, "0") && strcmp(value, "1")) {
+				return "flags should be 0 or 1";
+			}
+			*(!strcmp(argument, "pattern") ? &request->is_pattern : &request->ignore_case) = value[0] == '1';
+		} else if (!strcmp(argument, "count")) {
+			request->count = strtoull(value, &end, 10);
+		} else if (!strcmp(argument, "deadline")) {
+			request->deadline = strtoull(value, &end, 10);
+		} else if (!strcmp(argument, "priority")) {
+			request->priority = (int) strtol(value, &end, 10);
+		} else {
+			return "unknown argument";
+		}
+		// Only the priority can be negative
+		if (end && (end == value || *end || (value[0] == '-' && strcmp(argument, "priority")))) {
+			return "numbers should be decimal";
+		}
+	}
+	if (!request->reference) {
+		return "no reference";
+	}
+	if (!position_given) {
+		request->position = request->devzat_mode ? MATCH_PREFIX : MATCH_SUFFIX;
+	}
+	if (!mining_pool_check(request->reference, request->devzat_mode, request->position, request->ignore_case, request->is_pattern)) {
+		return "invalid reference";
+	}
+	return NULL;
+}
+
+// Queue the job of a mine command
+static void start_job(server* srv, int c) {
+	mining_request request;
+	const char* error = read_request(&request);
+	if (error) {
+		send_line(srv, c, "error %s\n", error);
+		return;
+	}
+	server_job* job = NULL;
+	for (int j=0; j<MINING_SERVER_MAX_JOBS && !job; j++) {
+		job = srv->job[j].used ? NULL : &srv->job[j];
+	}
+	if (!job) {
+		send_line(srv, c, "error too many jobs\n");
+		return;
+	}
+	job->used = true;
+	job->id = ++srv->last_id;
+	job->client = c;
+	job->reference = strdup(request.reference);
+	job->request = request;
+	job->request.reference = job->reference;
+	job->deadline = request.deadline ? time(NULL) + (time_t) request.deadline : 0;
+	job->slot = -1;
+	job->sent = 0;
+	send_line(srv, c, "queued %llu\n", (unsigned long long) job->id);
+}
+
+// Cancel the job of a cancel command
+static void cancel_job(server* srv, int c) {
+	char* value = strtok(NULL, " \r\n");
+	uint64_t id = value ? strtoull(value, NULL, 10) : 0;
+	for (int j=0; j<MINING_SERVER_MAX_JOBS; j++) {
+		if (srv->job[j].used && srv->job[j].id == id && srv->job[j].client == c) {
+			finish_job(srv, &srv->job[j], "cancelled");
+			return;
+		}
+	}
+	send_line(srv, c, "error unknown job\n");
+}
+
+static void handle_line(server* srv, int c, char* line) {
+	char* command = strtok(line, " \r\n");
+	if (!command) {
+		return;
+	}
+	if (!strcmp(command, "mine")) {
+		start_job(srv, c);
+	} else if (!strcmp(command, "cancel")) {
+		cancel_job(srv, c);
+	} else {
+		send_line(srv, c, "error unknown command\n");
+	}
+}
+
+// Read what the client sent and handle its complete lines
+static void read_client(server* srv, int c) {
+	server_client* client = &srv->client[c];
+	ssize_t n = read(client->fd, client->input + client->input_size, MAX_LINE - 1 - client->input_size);
+	if (n <= 0) {
+		client->broken = true;
+		return;
+	}
+	client->input_size += n;
+	char* end;
+	while (!client->broken && (end = memchr(client->input, '\n', client->input_size))) {
+		*end = 0;
+		size_t line_size = end + 1 - client->input;
+		handle_line(srv, c, client->input);
+		memmove(client->input, end + 1, client->input_size - line_size);
+		client->input_size -= line_size;
+	}
+	if (client->input_size == MAX_LINE - 1) {
+		send_line(srv, c, "error line too long\n");
+		client->broken = true;
+	}
+}
+
+static void accept_client(server* srv) {
+	int fd = accept(srv->listener, NULL, NULL);
+	if (fd < 0) {
+		return;
+	}
+	for (int c=0; c<MINING_SERVER_MAX_CLIENTS; c++) {
+		if (srv->client[c].fd < 0) {
+			struct timeval timeout = {.tv_sec = SEND_TIMEOUT, .tv_usec = 0};
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			memset(&srv->client[c], 0, sizeof(server_client));
+			srv->client[c].fd = fd;
+			return;
+		}
+	}
+	const char* full = "error too many clients\n";
+	send_all(fd, full, strlen(full));
+	close(fd);
+}
+
+// Cancel the jobs of the client and disconnect it
+static void drop_client(server* srv, int c) {
+	for (int j=0; j<MINING_SERVER_MAX_JOBS; j++) {
+		if (srv->job[j].used && srv->job[j].client == c) {
+			finish_job(srv, &srv->job[j], NULL);
+		}
+	}
+	close(srv->client[c].fd);
+	srv->client[c].fd = -1;
+}
+
+// Return the waiting job that gets the next free slot of the pool, or NULL
+// if there is none. The slot goes to the client with the fewest jobs in the
+// pool, then to the client whose oldest waiting job is the oldest, so that a
+// client can not take the slots of the others by sending many jobs or high
+// priorities. Among the jobs of that client, it goes to the job of highest
+// priority, then to the oldest one.
+static server_job* next_waiting_job(server* srv) {
+	server_job* first[MINING_SERVER_MAX_CLIENTS] = {NULL}; // Job of each client that goes first
+	uint64_t oldest[MINING_SERVER_MAX_CLIENTS] = {0};      // Oldest waiting job of each client
+	for (int j=0; j<MINING_SERVER_MAX_JOBS; j++) {
+		server_job* job = &srv->job[j];
+		if (!job->used || job->slot >= 0) {
+			continue;
+		}
+		int c = job->client;
+		if (!first[c] || job->request.priority > first[c]->request.priority || (job->request.priority == first[c]->request.priority && job->id < first[c]->id)) {
+			first[c] = job;
+		}
+		if (!oldest[c] || job->id < oldest[c]) {
+			oldest[c] = job->id;
+		}
+	}
+	int next = -1;
+	for (int c=0; c<MINING_SERVER_MAX_CLIENTS; c++) {
+		if (first[c] && (next < 0 || srv->client[c].active < srv->client[next].active || (srv->client[c].active == srv->client[next].active && oldest[c] < oldest[next]))) {
+			next = c;
+		}
+	}
+	return next < 0 ? NULL : first[next];
+}
+
+// Give the free slots of the pool to the waiting jobs that go first
+static void schedule_jobs(server* srv) {
+	for (;;) {
+		server_job* next = next_waiting_job(srv);
+		if (!next) {
+			return;
+		}
+		const mining_request* r = &next->request;
+		next->slot = mining_pool_add(srv->pool, r->reference, r->devzat_mode, r->position, r->ignore_case, r->is_pattern, r->count);
+		if (next->slot < 0) {
+			return;
+		}
+		srv->client[next->client].active++;
+	}
+}
+
+// Send the keys found by the pool to the clients of their jobs
+static void send_keys(server* srv) {
+	uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	uint8_t pubkey[CURVE_25519_PUBLIC_KEY_SIZE];
+	for (int j=0; j<MINING_SERVER_MAX_JOBS; j++) {
+		server_job* job = &srv->job[j];
+		while (job->used && job->slot >= 0 && mining_pool_pop(srv->pool, job->slot, privkey)) {
+			ed25519_public_key(pubkey, privkey);
+			char* keyfile = openssh_format_key(privkey, pubkey);
+			mem_clean(privkey, sizeof(privkey));
+			size_t size = strlen(keyfile);
+			send_line(srv, job->client, "key %llu %zu\n", (unsigned long long) job->id, size);
+			if (!srv->client[job->client].broken) {
+				srv->client[job->client].broken = !send_all(srv->client[job->client].fd, keyfile, size);
+			}
+			mem_clean(keyfile, size);
+			free(keyfile);
+			if (++job->sent == job->request.count) {
+				finish_job(srv, job, "done");
+			}
+		}
+	}
+}
+
+static void expire_jobs(server* srv) {
+	time_t now = time(NULL);
+	for (int j=0; j<MINING_SERVER_MAX_JOBS; j++) {
+		if (srv->job[j].used && srv->job[j].deadline && now >= srv->job[j].deadline) {
+			finish_job(srv, &srv->job[j], "expired");
+		}
+	}
+}
+
+// Listen on the socket, replacing a socket left by a server that is gone,
+// but not one that a server still listens on. Only the owner can connect,
+// as the keys are sent over it.
+static int open_listener(const char* socket_path) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Error, the socket path %s is too long.\n", socket_path);
+		return -1;
+	}
+	strcpy(address.sun_path, socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Error, unable to create a socket.\n");
+		return -1;
+	}
+	struct stat st;
+	if (!lstat(socket_path, &st) && S_ISSOCK(st.st_mode)) {
+		if (!connect(fd, (struct sockaddr*) &address, sizeof(address))) {
+			fprintf(stderr, "Error, a server already listens on %s.\n", socket_path);
+			close(fd);
+			return -1;
+		}
+		unlink(socket_path);
+	}
+	mode_t mask = umask(077);
+	bool ok = !bind(fd, (struct sockaddr*) &address, sizeof(address)) && !listen(fd, 16);
+	umask(mask);
+	if (!ok) {
+		fprintf(stderr, "Error, unable to listen on %s.\n", socket_path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Wait for the clients, the keys found or the next second, and handle them
+static void serve_once(server* srv) {
+	struct pollfd fds[2 + MINING_SERVER_MAX_CLIENTS];
+	int clients[MINING_SERVER_MAX_CLIENTS];
+	int n = 0;
+	fds[n++] = (struct pollfd) {.fd = srv->listener, .events = POLLIN};
+	fds[n++] = (struct pollfd) {.fd = srv->wake[0], .events = POLLIN};
+	for (int c=0; c<MINING_SERVER_MAX_CLIENTS; c++) {
+		if (srv->client[c].fd >= 0) {
+			clients[n - 2] = c;
+			fds[n++] = (struct pollfd) {.fd = srv->client[c].fd, .events = POLLIN};
+		}
+	}
+	if (poll(fds, n, 1000) < 0) {
+		return;
+	}
+	if (fds[1].revents) {
+		char drain[256];
+		while (read(srv->wake[0], drain, sizeof(drain)) > 0);
+	}
+	send_keys(srv);
+	for (int i=2; i<n; i++) {
+		if (fds[i].revents) {
+			read_client(srv, clients[i - 2]);
+		}
+	}
+	if (fds[0].revents) {
+		accept_client(srv);
+	}
+	expire_jobs(srv);
+	for (int c=0; c<MINING_SERVER_MAX_CLIENTS; c++) {
+		if (srv->client[c].fd >= 0 && srv->client[c].broken) {
+			drop_client(srv, c);
+		}
+	}
+	schedule_jobs(srv);
+}
+
+bool mining_server_run(const char* socket_path, unsigned int thread_number, bool vartime) {
+	uint8_t seed[KEYSPACE_SEED_SIZE];
+	if (!keyspace_random_seed(seed)) {
+		return false;
+	}
+	server* srv = calloc(1, sizeof(server));
+	srv->listener = open_listener(socket_path);
+	if (srv->listener < 0 || pipe(srv->wake)) {
+		if (srv->listener >= 0) {
+			close(srv->listener);
+		}
+		free(srv);
+		return false;
+	}
+	fcntl(srv->wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(srv->wake[1], F_SETFL, O_NONBLOCK);
+	for (int c=0; c<MINING_SERVER_MAX_CLIENTS; c++) {
+		srv->client[c].fd = -1;
+	}
+	// A client that disconnects must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+	srv->pool = mining_pool_start(thread_number, vartime, seed, wake_server, srv);
+	mem_clean(seed, sizeof(seed));
+	fprintf(stderr, "Serving on %s with %u threads.\n", socket_path, thread_number);
+
+	while (!atomic_load(&stopping)) {
+		serve_once(srv);
+	}
+
+	for (int c=0; c<MINING_SERVER_MAX_CLIENTS; c++) {
+		if (srv->client[c].fd >= 0) {
+			drop_client(srv, c);
+		}
+	}
+	mining_pool_stop(srv->pool);
+	close(srv->listener);
+	close(srv->wake[0]);
+	close(srv->wake[1]);
+	unlink(socket_path);
+	free(srv);
+	return true;
+}
+
+int mining_client_run(const char* socket_path, const mining_request* request, const char* output_path) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (strlen(socket_path) >= sizeof(address.sun_path) || fd < 0) {
+		fprintf(stderr, "Error, unable to connect to %s.\n", socket_path);
+		return 4;
+	}
+	strcpy(address.sun_path, socket_path);
+	if (connect(fd, (struct sockaddr*) &address, sizeof(address))) {
+		fprintf(stderr, "Error, unable to connect to %s.\n", socket_path);
+		close(fd);
+		return 4;
+	}
+	char line[MAX_LINE];
+	snprintf(line, sizeof(line), "mine reference=%s type=%s position=%s pattern=%d ignore-case=%d count=%llu priority=%d deadline=%llu\n",
+		request->reference, type_names[request->devzat_mode], position_names[request->position], request->is_pattern, request->ignore_case,
+		(unsigned long long) request->count, request->priority, (unsigned long long) request->deadline);
+	if (!send_all(fd, line, strlen(line))) {
+		fprintf(stderr, "Error, unable to send the request to %s.\n", socket_path);
+		close(fd);
+		return 4;
+	}
+
+	FILE* f = fdopen(fd, "r");
+	uint64_t received = 0;
+	int ret = 4;
+	bool over = false;
+	while (!over && fgets(line, sizeof(line), f)) {
+		unsigned long long id;
+		size_t size;
+		if (sscanf(line, "key %llu %zu", &id, &size) == 2) {
+			char* keyfile = malloc(size + 1);
+			bool complete = fread(keyfile, 1, size, f) == size;
+			keyfile[size] = 0;
+			if (complete) {
+				received++;
+				write_numbered_key(keyfile, output_path, request->count == 1 ? 0 : received);
+			}
+			mem_clean(keyfile, size);
+			free(keyfile);
+			if (!complete) {
+				break;
+			}
+		} else if (!strncmp(line, "queued ", 7)) {
+			continue;
+		} else {
+			over = true;
+			if (!strncmp(line, "done ", 5)) {
+				ret = 0;
+			} else if (!strncmp(line, "expired ", 8)) {
+				fprintf(stderr, "Warning, the job expired after %llu keys.\n", (unsigned long long) received);
+				ret = 3;
+			} else {
+				fprintf(stderr, "Error, the server answered: %s", line);
+			}
+		}
+	}
+	if (!over) {
+		fprintf(stderr, "Error, the server closed the connection.\n");
+	}
+	fclose(f);
+	return ret;
+}
+
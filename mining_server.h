@@ -0,0 +1,55 @@
+#ifndef _MINING_SERVER_H_
+#define _MINING_SERVER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "match_position.h"
+
+// Number of clients connected at once, and of their jobs, active or waiting
+#define MINING_SERVER_MAX_CLIENTS 64
+#define MINING_SERVER_MAX_JOBS 1024
+
+// A search sent to the server
+typedef struct {
+	const char* reference;
+	bool devzat_mode;
+	match_position position;
+	bool ignore_case;
+	bool is_pattern;
+	uint64_t count;    // Number of keys, 0 for keys until the job is cancelled
+	int priority;      // Jobs of higher priority get a slot of the pool before the other jobs of the same client
+	uint64_t deadline; // Seconds after which the job expires, 0 for no limit
+} mining_request;
+
+// Serve the jobs of the clients that connect to the Unix socket, with a
+// mining pool of thread_number workers, until mining_server_stop is called.
+// Each client sends lines, made of a command and its arguments:
+// - "mine reference=... [type=devzat-id|ssh-pubkey]
+//   [position=prefix|suffix|anywhere] [pattern=0|1] [ignore-case=0|1]
+//   [count=n] [priority=n] [deadline=seconds]" starts a job. The server
+//   answers "queued <job>", or "error <message>" if it is not valid.
+// - "cancel <job>" cancels one of its jobs, which is answered with
+//   "cancelled <job>".
+// The server then sends each key found for a job as "key <job> <size>"
+// followed by the size bytes of the key file, and finally "done <job>" once
+// the job has all its keys or "expired <job>" at its deadline. The jobs of a
+// client are cancelled when it disconnects.
+// Up to MINING_POOL_SLOTS jobs are mined at once, and each candidate is
+// checked against all of them. The other jobs wait for a slot, which goes to
+// the client with the fewest jobs in the pool, then to the client that has
+// waited the longest. The priority only orders the jobs of a client.
+// Return false if the socket can not be set up.
+bool mining_server_run(const char* socket_path, unsigned int thread_number, bool vartime);
+
+// Make mining_server_run return. It can be called from a signal handler.
+void mining_server_stop(void);
+
+// Send the request to the server of the socket and write the keys that it
+// sends back to stdout, or to output_path if there is one key, or to
+// output_path.1, output_path.2... otherwise.
+// Return 0 once all the keys are received, 3 if the job expired before and
+// 4 on failure.
+int mining_client_run(const char* socket_path, const mining_request* request, const char* output_path);
+
+#endif
+
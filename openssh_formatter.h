@@ -4,6 +4,11 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// Size of the public key blob written by openssh_format_pubkey and offset of
+// the raw public key in it. Everything before the key is constant.
+#define OPENSSH_PUBKEY_SIZE 51
+#define OPENSSH_PUBKEY_OFFSET 19
+
 size_t openssh_format_pubkey(uint8_t* s, const uint8_t* pubkey);
 char* openssh_format_key(const uint8_t* privkey, const uint8_t* pubkey);
 
@@ -0,0 +1,587 @@
+#include "pattern.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Maximum number of states of the NFA of a pattern. The repeated atoms are
+// copied, so a{10} uses 10 times the states of a.
+#define NFA_MAX_STATES 1024
+#define NFA_WORDS (NFA_MAX_STATES / 64)
+
+// Maximum count of a repeat, the number of characters of a pubkey
+#define MAX_REPEAT 68
+
+// A state of the NFA built from the pattern. If set is not empty, it goes to
+// out after reading one of its symbols. Otherwise, it goes to out and out1
+// without reading anything, -1 standing for no state.
+typedef struct {
+	uint64_t set;
+	int out;
+	int out1;
+} nfa_state;
+
+// Part of the NFA built from a part of the pattern. end is a state with an
+// empty set whose out is not set yet.
+typedef struct {
+	int start;
+	int end;
+} fragment;
+
+typedef struct {
+	const char* cursor;
+	pattern_alphabet alphabet;
+	uint64_t all_symbols;
+	bool ignore_case;
+	bool reverse;
+	bool error;
+	nfa_state* states;
+	int count;
+} parser;
+
+// Value of a symbol of the alphabet, or -1 if c is not one
+static int symbol_value(char c, pattern_alphabet alphabet) {
+	if (alphabet == PATTERN_HEX) {
+		if ('0' <= c && c <= '9') {
+			return c - '0';
+		}
+		if ('a' <= c && c <= 'f') {
+			return c - 'a' + 10;
+		}
+		if ('A' <= c && c <= 'F') {
+			return c - 'A' + 10;
+		}
+		return -1;
+	}
+	if ('A' <= c && c <= 'Z') {
+		return c - 'A';
+	}
+	if ('a' <= c && c <= 'z') {
+		return c - 'a' + 26;
+	}
+	if ('0' <= c && c <= '9') {
+		return c - '0' + 52;
+	}
+	if (c == '+') {
+		return 62;
+	}
+	if (c == '/') {
+		return 63;
+	}
+	return -1;
+}
+
+uint64_t pattern_symbol_set(char c, pattern_alphabet alphabet, bool ignore_case) {
+	int value = symbol_value(c, alphabet);
+	if (value < 0) {
+		return 0;
+	}
+	uint64_t ret = (uint64_t) 1 << value;
+	if (alphabet == PATTERN_BASE64 && ignore_case && 'A' <= c && c <= 'Z') {
+		ret |= (uint64_t) 1 << symbol_value(c - 'A' + 'a', alphabet);
+	}
+	if (alphabet == PATTERN_BASE64 && ignore_case && 'a' <= c && c <= 'z') {
+		ret |= (uint64_t) 1 << symbol_value(c - 'a' + 'A', alphabet);
+	}
+	return ret;
+}
+
+/* ------------------------------- Parsing ------------------------------- */
+
+// Print the error only once, as the parsing goes on until the end
+static void parse_error(parser* p, const char* message) {
+	if (!p->error) {
+		fprintf(stderr, "Error, %s\n", message);
+	}
+	p->error = true;
+}
+
+// Add a state to the NFA. When there is no room left, the error is set and
+// the state 0 is reused, so that the parsing can go on without checks.
+static int new_state(parser* p, uint64_t set, int out, int out1) {
+	if (p->count == NFA_MAX_STATES) {
+		parse_error(p, "the pattern is too complex.");
+		return 0;
+	}
+	p->states[p->count] = (nfa_state) {.set = set, .out = out, .out1 = out1};
+	return p->count++;
+}
+
+static fragment empty_fragment(parser* p) {
+	int state = new_state(p, 0, -1, -1);
+	return (fragment) {state, state};
+}
+
+static fragment symbols_fragment(parser* p, uint64_t set) {
+	int end = new_state(p, 0, -1, -1);
+	return (fragment) {new_state(p, set, end, -1), end};
+}
+
+// a then b, or b then a for a reversed pattern
+static fragment concat(parser* p, fragment a, fragment b) {
+	if (p->reverse) {
+		fragment tmp = a;
+		a = b;
+		b = tmp;
+	}
+	p->states[a.end].out = b.start;
+	return (fragment) {a.start, b.end};
+}
+
+static fragment alternative(parser* p, fragment a, fragment b) {
+	int end = new_state(p, 0, -1, -1);
+	p->states[a.end].out = end;
+	p->states[b.end].out = end;
+	return (fragment) {new_state(p, 0, a.start, b.start), end};
+}
+
+static fragment optional(parser* p, fragment f) {
+	int end = new_state(p, 0, -1, -1);
+	p->states[f.end].out = end;
+	return (fragment) {new_state(p, 0, f.start, end), end};
+}
+
+static fragment star(parser* p, fragment f) {
+	int end = new_state(p, 0, -1, -1);
+	int start = new_state(p, 0, f.start, end);
+	p->states[f.end].out = start;
+	return (fragment) {start, end};
+}
+
+static fragment parse_alternatives(parser* p);
+
+// Read a character of the pattern, unescaping it if needed
+static char parse_char(parser* p) {
+	if (*p->cursor == '\\') {
+		p->cursor++;
+	}
+	if (!*p->cursor) {
+		parse_error(p, "the pattern ends unexpectedly.");
+		return 0;
+	}
+	return *p->cursor++;
+}
+
+// Read the class after its [
+static uint64_t parse_class(parser* p) {
+	bool negated = *p->cursor == '^';
+	if (negated) {
+		p->cursor++;
+	}
+	uint64_t set = 0;
+	while (*p->cursor != ']' && !p->error) {
+		char first = parse_char(p);
+		char last = first;
+		if (p->cursor[0] == '-' && p->cursor[1] && p->cursor[1] != ']') {
+			p->cursor++;
+			last = parse_char(p);
+		}
+		if (!pattern_symbol_set(first, p->alphabet, p->ignore_case) || !pattern_symbol_set(last, p->alphabet, p->ignore_case) || first > last) {
+			parse_error(p, "invalid character class in the pattern.");
+		}
+		// The characters of a range which are not symbols are left out
+		for (int c=first; c<=last; c++) {
+			set |= pattern_symbol_set(c, p->alphabet, p->ignore_case);
+		}
+	}
+	if (*p->cursor == ']') {
+		p->cursor++;
+	}
+	if (negated) {
+		set = p->all_symbols & ~set;
+	}
+	if (!set) {
+		parse_error(p, "empty character class in the pattern.");
+	}
+	return set;
+}
+
+static fragment parse_atom(parser* p) {
+	switch (*p->cursor) {
+		case '(': {
+			p->cursor++;
+			fragment ret = parse_alternatives(p);
+			if (*p->cursor != ')') {
+				parse_error(p, "unbalanced parentheses in the pattern.");
+			} else {
+				p->cursor++;
+			}
+			return ret;
+		}
+		case '[':
+			p->cursor++;
+			return symbols_fragment(p, parse_class(p));
+		case '.':
+			p->cursor++;
+			return symbols_fragment(p, p->all_symbols);
+		case '?':
+		case '*':
+		case '+':
+		case '{':
+			parse_error(p, "repeat without anything to repeat in the pattern.");
+			return empty_fragment(p);
+		default: {
+			uint64_t set = pattern_symbol_set(parse_char(p), p->alphabet, p->ignore_case);
+			if (!set) {
+				parse_error(p, "invalid character in the pattern.");
+			}
+			return symbols_fragment(p, set);
+		}
+	}
+}
+
+// Read a number of the pattern that is at most MAX_REPEAT
+static int parse_count(parser* p) {
+	if (*p->cursor < '0' || '9' < *p->cursor) {
+		parse_error(p, "invalid repeat in the pattern.");
+		return 0;
+	}
+	int ret = 0;
+	while ('0' <= *p->cursor && *p->cursor <= '9') {
+		ret = ret * 10 + *p->cursor++ - '0';
+		if (ret > MAX_REPEAT) {
+			parse_error(p, "repeat too large in the pattern.");
+			return 0;
+		}
+	}
+	return ret;
+}
+
+// Read the quantifier after an atom, if any. max is -1 for no upper bound.
+static bool parse_quantifier(parser* p, int* min, int* max) {
+	switch (*p->cursor) {
+		case '?':
+			*min = 0;
+			*max = 1;
+			break;
+		case '*':
+			*min = 0;
+			*max = -1;
+			break;
+		case '+':
+			*min = 1;
+			*max = -1;
+			break;
+		case '{':
+			p->cursor++;
+			*min = parse_count(p);
+			*max = *min;
+			if (*p->cursor == ',') {
+				p->cursor++;
+				*max = *p->cursor == '}' ? -1 : parse_count(p);
+			}
+			if (*p->cursor != '}' || (*max >= 0 && *max < *min)) {
+				parse_error(p, "invalid repeat in the pattern.");
+			}
+			break;
+		default:
+			return false;
+	}
+	if (*p->cursor) {
+		p->cursor++;
+	}
+	return true;
+}
+
+// An atom and its quantifier. The atom is parsed again for each copy that
+// the quantifier asks for.
+static fragment parse_repeat(parser* p) {
+	const char* atom = p->cursor;
+	fragment f = parse_atom(p);
+	int min, max;
+	if (p->error || !parse_quantifier(p, &min, &max)) {
+		return f;
+	}
+	if (strchr("?*+{", *p->cursor) && *p->cursor) {
+		parse_error(p, "repeats should be grouped to be repeated again in the pattern.");
+	}
+	const char* after = p->cursor;
+
+	fragment ret = empty_fragment(p);
+	int copies = max < 0 ? min + 1 : max;
+	for (int i=0; i<copies && !p->error; i++) {
+		if (i) {
+			p->cursor = atom;
+			f = parse_atom(p);
+		}
+		if (i >= min) {
+			f = max < 0 ? star(p, f) : optional(p, f);
+		}
+		ret = concat(p, ret, f);
+	}
+	p->cursor = after;
+	return ret;
+}
+
+static fragment parse_sequence(parser* p) {
+	fragment ret = empty_fragment(p);
+	while (*p->cursor && *p->cursor != '|' && *p->cursor != ')' && !p->error) {
+		ret = concat(p, ret, parse_repeat(p));
+	}
+	return ret;
+}
+
+static fragment parse_alternatives(parser* p) {
+	fragment ret = parse_sequence(p);
+	while (*p->cursor == '|' && !p->error) {
+		p->cursor++;
+		ret = alternative(p, ret, parse_sequence(p));
+	}
+	return ret;
+}
+
+// Build the NFA of the pattern in states. Return the whole fragment, whose end
+// is the accepting state, or print an error and return a fragment with a
+// negative start.
+static fragment build_nfa(nfa_state* states, const char* pattern, pattern_alphabet alphabet, bool ignore_case, int flags) {
+	parser p = {
+		.cursor = pattern,
+		.alphabet = alphabet,
+		.all_symbols = alphabet == PATTERN_HEX ? 0xFFFF : ~(uint64_t) 0,
+		.ignore_case = ignore_case,
+		.reverse = flags & PATTERN_REVERSE,
+		.error = false,
+		.states = states,
+		.count = 0,
+	};
+	fragment ret = parse_alternatives(&p);
+	if (*p.cursor) {
+		parse_error(&p, "unbalanced parentheses in the pattern.");
+	}
+	if (flags & PATTERN_UNANCHORED) {
+		int start = new_state(&p, 0, ret.start, -1);
+		p.states[start].out1 = new_state(&p, p.all_symbols, start, -1);
+		ret.start = start;
+	}
+	if (p.error) {
+		ret.start = -1;
+	}
+	return ret;
+}
+
+/* ------------------------- Subset construction ------------------------- */
+
+typedef struct {
+	uint64_t bits[NFA_WORDS];
+} state_set;
+
+// Add the state and the ones it reaches without reading anything to the set
+static void add_state(const nfa_state* states, state_set* set, int state) {
+	if (state < 0 || ((set->bits[state / 64] >> (state % 64)) & 1)) {
+		return;
+	}
+	set->bits[state / 64] |= (uint64_t) 1 << (state % 64);
+	if (!states[state].set) {
+		add_state(states, set, states[state].out);
+		add_state(states, set, states[state].out1);
+	}
+}
+
+static bool has_state(const state_set* set, int state) {
+	return (set->bits[state / 64] >> (state % 64)) & 1;
+}
+
+static bool is_empty(const state_set* set) {
+	for (int i=0; i<NFA_WORDS; i++) {
+		if (set->bits[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Index of the DFA state of the set of NFA states, added if it is new, or -1
+// if there is no room left. All the sets with the accepting state of the NFA
+// are merged in PATTERN_ACCEPT, as nothing is read after a match.
+static int dfa_state(state_set* sets, int* count, const state_set* set, int accept) {
+	if (is_empty(set)) {
+		return PATTERN_DEAD;
+	}
+	if (has_state(set, accept)) {
+		return PATTERN_ACCEPT;
+	}
+	for (int i=PATTERN_ACCEPT+1; i<*count; i++) {
+		if (!memcmp(&sets[i], set, sizeof(state_set))) {
+			return i;
+		}
+	}
+	if (*count == PATTERN_MAX_STATES) {
+		return -1;
+	}
+	sets[*count] = *set;
+	return (*count)++;
+}
+
+// Build the DFA of the NFA by subset construction. Return its number of
+// states, or -1 if there are too many.
+static int build_dfa(pattern_dfa* dfa, const nfa_state* states, fragment nfa) {
+	int symbols = 1 << dfa->shift;
+	state_set* sets = calloc(PATTERN_MAX_STATES, sizeof(state_set));
+	int count = PATTERN_ACCEPT + 1;
+	memset(dfa->next, PATTERN_DEAD, sizeof(dfa->next));
+	memset(dfa->next + (PATTERN_ACCEPT << dfa->shift), PATTERN_ACCEPT, symbols);
+
+	state_set set = {0};
+	add_state(states, &set, nfa.start);
+	dfa->start = dfa_state(sets, &count, &set, nfa.end);
+	for (int i=PATTERN_ACCEPT+1; i<count && count>=0; i++) {
+		for (int symbol=0; symbol<symbols; symbol++) {
+			memset(&set, 0, sizeof(set));
+			for (int word=0; word<NFA_WORDS; word++) {
+				for (uint64_t bits=sets[i].bits[word]; bits; bits&=bits-1) {
+					const nfa_state* state = &states[word * 64 + __builtin_ctzll(bits)];
+					if ((state->set >> symbol) & 1) {
+						add_state(states, &set, state->out);
+					}
+				}
+			}
+			int next = dfa_state(sets, &count, &set, nfa.end);
+			if (next < 0) {
+				count = -1;
+				break;
+			}
+			dfa->next[(i << dfa->shift) | symbol] = next;
+		}
+	}
+	free(sets);
+	return count;
+}
+
+// Merge the states of the DFA that lead to the same results. They are split
+// in parts, starting with PATTERN_ACCEPT and all the others, and the parts
+// are split until all the states of a part go to the same parts on each
+// symbol. The states that can not lead to a match end up with PATTERN_DEAD.
+// Return the new number of states.
+static int minimize_dfa(pattern_dfa* dfa, int count) {
+	int symbols = 1 << dfa->shift;
+	int part[PATTERN_MAX_STATES];
+	int new_part[PATTERN_MAX_STATES];
+	int first[PATTERN_MAX_STATES]; // First state of each part
+	int parts = 2;
+	for (int i=0; i<count; i++) {
+		part[i] = i == PATTERN_ACCEPT;
+	}
+	for (;;) {
+		// The parts are numbered by their first state, so PATTERN_DEAD and
+		// PATTERN_ACCEPT keep their index
+		int new_parts = 0;
+		for (int i=0; i<count; i++) {
+			new_part[i] = -1;
+			for (int p=0; p<new_parts && new_part[i]<0; p++) {
+				int j = first[p];
+				bool same = part[i] == part[j];
+				for (int symbol=0; symbol<symbols && same; symbol++) {
+					same = part[pattern_dfa_step(dfa, i, symbol)] == part[pattern_dfa_step(dfa, j, symbol)];
+				}
+				if (same) {
+					new_part[i] = p;
+				}
+			}
+			if (new_part[i] < 0) {
+				first[new_parts] = i;
+				new_part[i] = new_parts++;
+			}
+		}
+		memcpy(part, new_part, sizeof(part));
+		if (new_parts == parts) {
+			break;
+		}
+		parts = new_parts;
+	}
+
+	// The first state of a part is never before it, so the rows are read
+	// before being replaced
+	for (int p=0; p<parts; p++) {
+		for (int symbol=0; symbol<symbols; symbol++) {
+			dfa->next[(p << dfa->shift) | symbol] = part[pattern_dfa_step(dfa, first[p], symbol)];
+		}
+	}
+	dfa->start = part[dfa->start];
+	return parts;
+}
+
+// Length of the shortest input taking the DFA to PATTERN_ACCEPT, found by a
+// breadth-first search, or -1 if there is none
+static int shortest_match(const pattern_dfa* dfa, int count) {
+	int distance[PATTERN_MAX_STATES];
+	int queue[PATTERN_MAX_STATES];
+	for (int i=0; i<count; i++) {
+		distance[i] = -1;
+	}
+	int head = 0, tail = 0;
+	distance[dfa->start] = 0;
+	queue[tail++] = dfa->start;
+	while (head < tail) {
+		int state = queue[head++];
+		if (state == PATTERN_ACCEPT) {
+			return distance[state];
+		}
+		for (int symbol=0; symbol<(1 << dfa->shift); symbol++) {
+			int next = pattern_dfa_step(dfa, state, symbol);
+			if (distance[next] < 0) {
+				distance[next] = distance[state] + 1;
+				queue[tail++] = next;
+			}
+		}
+	}
+	return -1;
+}
+
+// Build the minimal DFA of the pattern and return its number of states, or
+// print an error and return -1
+static int build_pattern_dfa(pattern_dfa* dfa, const char* pattern, pattern_alphabet alphabet, bool ignore_case, int flags) {
+	nfa_state* states = malloc(NFA_MAX_STATES * sizeof(nfa_state));
+	fragment nfa = build_nfa(states, pattern, alphabet, ignore_case, flags);
+	int count = -1;
+	if (nfa.start >= 0) {
+		dfa->shift = alphabet == PATTERN_HEX ? 4 : 6;
+		count = build_dfa(dfa, states, nfa);
+		if (count < 0) {
+			fprintf(stderr, "Error, the pattern is too complex.\n");
+		} else {
+			count = minimize_dfa(dfa, count);
+		}
+	}
+	free(states);
+	return count;
+}
+
+bool pattern_compile(pattern_dfa* dfa, const char* pattern, pattern_alphabet alphabet, bool ignore_case, int flags, int max_length) {
+	int count = build_pattern_dfa(dfa, pattern, alphabet, ignore_case, flags);
+	if (count < 0) {
+		return false;
+	}
+	int shortest = shortest_match(dfa, count);
+	if (shortest < 0 || shortest > max_length) {
+		fprintf(stderr, "Error, the pattern can not match within %d characters.\n", max_length);
+		return false;
+	}
+	return true;
+}
+
+int pattern_classes(uint64_t* classes, int max_length, const pattern_dfa* dfa) {
+	// Follow the DFA while all the symbols that do not fail lead to the same
+	// state
+	int state = dfa->start;
+	int length = 0;
+	while (state != PATTERN_ACCEPT) {
+		int next = PATTERN_DEAD;
+		uint64_t set = 0;
+		for (int symbol=0; symbol<(1 << dfa->shift); symbol++) {
+			int to = pattern_dfa_step(dfa, state, symbol);
+			if (to == PATTERN_DEAD) {
+				continue;
+			}
+			if (next != PATTERN_DEAD && to != next) {
+				return -1;
+			}
+			next = to;
+			set |= (uint64_t) 1 << symbol;
+		}
+		if (next == PATTERN_DEAD || length == max_length) {
+			return -1;
+		}
+		classes[length++] = set;
+		state = next;
+	}
+	return length;
+}
@@ -0,0 +1,67 @@
+#ifndef _PATTERN_H_
+#define _PATTERN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Patterns describe the wanted Devzat IDs or pubkeys with a small regular
+// expression syntax:
+//   x        a hex digit or base64 character, \x to escape a special character
+//   .        any symbol
+//   [...]    a class of symbols, such as [0-9] or [^a-f]
+//   (...|..) a group with alternatives
+//   ? * +    repeat the previous atom 0 or 1, 0 or more, or 1 or more times
+//   {n} {n,} {n,m} repeat the previous atom n, at least n, or n to m times
+// Hex digits are matched in any case. Base64 letters are matched in any case
+// only if it is asked.
+
+// Symbols that are read by the patterns
+typedef enum {
+	PATTERN_HEX,    // The 16 hex digits, with their value
+	PATTERN_BASE64, // The 64 base64 characters, with their value
+} pattern_alphabet;
+
+#define PATTERN_MAX_SYMBOLS 64
+#define PATTERN_MAX_STATES 256
+
+// States of all DFA. Once they are reached, the following symbols do not
+// change the result.
+#define PATTERN_DEAD 0   // The symbols read can not start a match
+#define PATTERN_ACCEPT 1 // The symbols read start with a match
+
+// A pattern compiled to a minimal DFA that reads symbols until the ones read
+// start with a match of the pattern or can not start any. The next state is
+// read from a table indexed by the current state and the symbol, so the
+// symbols are checked without any allocation.
+typedef struct {
+	int shift; // log2 of the number of symbols, the size of a row of next
+	int start;
+	uint8_t next[PATTERN_MAX_STATES * PATTERN_MAX_SYMBOLS];
+} pattern_dfa;
+
+// Flags of pattern_compile
+#define PATTERN_REVERSE 1    // Match the pattern reversed, to read the symbols from the end
+#define PATTERN_UNANCHORED 2 // Let the match start after any number of symbols
+
+// Set of the values of the symbol written as the character c, as a bitmask,
+// or 0 if it is not a symbol of the alphabet
+uint64_t pattern_symbol_set(char c, pattern_alphabet alphabet, bool ignore_case);
+
+// Compile the pattern to a DFA. Print an error and return false if it is not
+// valid, if it has too many states or if none of its matches is
+// max_length symbols long or less.
+bool pattern_compile(pattern_dfa* dfa, const char* pattern, pattern_alphabet alphabet, bool ignore_case, int flags, int max_length);
+
+// If the inputs accepted by the DFA are the ones that start with a fixed
+// number of symbols, each from its own set, as with dead.beef or [0-9]{6},
+// write the sets in classes and return their number. Otherwise, or if there
+// are more than max_length sets, return -1.
+int pattern_classes(uint64_t* classes, int max_length, const pattern_dfa* dfa);
+
+// State of the DFA after reading symbol in state
+static inline int pattern_dfa_step(const pattern_dfa* dfa, int state, unsigned int symbol) {
+	return dfa->next[(state << dfa->shift) | symbol];
+}
+
+#endif
+
@@ -0,0 +1,197 @@
+#include "pubkey_matcher.h"
+#include <string.h>
+#include <stdio.h>
+
+// Index of the first base64 character with bits of the public key. The ones
+// before it only depend on the constant start of the blob.
+#define FIRST_KEY_CHAR (OPENSSH_PUBKEY_OFFSET * 8 / 6)
+
+// Read the field of size bits starting at the given bit of data, which is
+// size bytes long
+static unsigned int read_field(const uint8_t* data, size_t size, unsigned int bit, unsigned int bits) {
+	unsigned int byte = bit / 8;
+	unsigned int window = data[byte] << 8;
+	if (byte + 1 < size) {
+		window |= data[byte + 1];
+	}
+	return (window >> (16 - bit % 8 - bits)) & ((1 << bits) - 1);
+}
+
+// Require the field of the key starting at bit to be equal to value
+static void add_exact_field(uint8_t* mask, uint8_t* value, unsigned int bit, unsigned int bits, unsigned int field_value) {
+	for (unsigned int i=0; i<bits; i++) {
+		unsigned int key_bit = bit + i;
+		uint8_t byte_bit = 0x80 >> (key_bit % 8);
+		mask[key_bit / 8] |= byte_bit;
+		if ((field_value >> (bits - 1 - i)) & 1) {
+			value[key_bit / 8] |= byte_bit;
+		}
+	}
+}
+
+// Compile the sets of accepted values of the len characters of the reference
+static bool compile_classes(pubkey_matcher* matcher, const uint64_t* classes, size_t len) {
+	uint8_t mask[CURVE_25519_PUBLIC_KEY_SIZE] = {0};
+	uint8_t value[CURVE_25519_PUBLIC_KEY_SIZE] = {0};
+	size_t first = matcher->position == MATCH_PREFIX ? FIRST_KEY_CHAR : PUBKEY_BASE64_SIZE - len;
+	memcpy(matcher->classes, classes, len * sizeof(uint64_t));
+	matcher->length = len;
+
+	for (size_t i=0; i<len; i++) {
+		uint64_t accepted = classes[i];
+
+		// Keep the values that agree with the bits from the constant start
+		// of the blob
+		int bit = (first + i) * 6 - OPENSSH_PUBKEY_OFFSET * 8;
+		unsigned int constant_bits = bit < 0 ? (-bit < 6 ? -bit : 6) : 0;
+		unsigned int bits = 6 - constant_bits;
+		if (constant_bits) {
+			unsigned int constant = read_field(matcher->blob_template, OPENSSH_PUBKEY_SIZE, (first + i) * 6, constant_bits);
+			uint64_t key_values = 0;
+			for (unsigned int v=0; v<64; v++) {
+				if (((accepted >> v) & 1) && (v >> bits) == constant) {
+					key_values |= (uint64_t) 1 << (v & ((1 << bits) - 1));
+				}
+			}
+			accepted = key_values;
+		}
+		if (!accepted) {
+			fprintf(stderr, "Error, no public key can match the reference.\n");
+			return false;
+		}
+		uint64_t all_values = bits == 6 ? ~(uint64_t) 0 : ((uint64_t) 1 << (1 << bits)) - 1;
+		if (accepted == all_values) {
+			continue;
+		}
+
+		bit = bit < 0 ? 0 : bit;
+		if (!(accepted & (accepted - 1))) {
+			add_exact_field(mask, value, bit, bits, __builtin_ctzll(accepted));
+		} else {
+			matcher->field[matcher->fields].bit = bit;
+			matcher->field[matcher->fields].bits = bits;
+			matcher->field[matcher->fields].accepted = accepted;
+			matcher->fields++;
+		}
+	}
+
+	memcpy(matcher->mask, mask, sizeof(mask));
+	memcpy(matcher->value, value, sizeof(value));
+	return true;
+}
+
+// Compile the pattern to character sets if it is a fixed number of
+// characters, or to a DFA otherwise
+static bool compile_pattern(pubkey_matcher* matcher, const char* pattern, bool ignore_case) {
+	// Suffixes are read backward, from the end of the pubkey
+	int flags = matcher->position == MATCH_SUFFIX ? PATTERN_REVERSE : 0;
+	int max_length = PUBKEY_BASE64_SIZE - (matcher->position == MATCH_PREFIX ? FIRST_KEY_CHAR : 0);
+	if (!pattern_compile(&matcher->dfa, pattern, PATTERN_BASE64, ignore_case, flags, max_length)) {
+		return false;
+	}
+	uint64_t classes[PUBKEY_BASE64_SIZE];
+	int length = pattern_classes(classes, max_length, &matcher->dfa);
+	if (length < 0) {
+		matcher->use_dfa = true;
+		return true;
+	}
+	for (int i=0; matcher->position == MATCH_SUFFIX && i<length/2; i++) {
+		uint64_t tmp = classes[i];
+		classes[i] = classes[length - 1 - i];
+		classes[length - 1 - i] = tmp;
+	}
+	return compile_classes(matcher, classes, length);
+}
+
+bool pubkey_matcher_compile(pubkey_matcher* matcher, const char* reference, match_position position, bool ignore_case, bool is_pattern) {
+	memset(matcher, 0, sizeof(pubkey_matcher));
+	const uint8_t dummy_pubkey[CURVE_25519_PUBLIC_KEY_SIZE] = {0};
+	openssh_format_pubkey(matcher->blob_template, dummy_pubkey);
+	matcher->position = position;
+
+	if (position == MATCH_ANYWHERE) {
+		fprintf(stderr, "Error, ssh-pubkey references can only be matched as a prefix or a suffix.\n");
+		return false;
+	}
+	if (is_pattern) {
+		return compile_pattern(matcher, reference, ignore_case);
+	}
+	size_t len = strlen(reference);
+	if (len > PUBKEY_BASE64_SIZE - (position == MATCH_PREFIX ? FIRST_KEY_CHAR : 0)) {
+		fprintf(stderr, "Error, reference is longer than the public keys.\n");
+		return false;
+	}
+	uint64_t classes[PUBKEY_BASE64_SIZE];
+	for (size_t i=0; i<len; i++) {
+		classes[i] = pattern_symbol_set(reference[i], PATTERN_BASE64, ignore_case);
+		if (!classes[i]) {
+			fprintf(stderr, "Error, reference should only contain base64 characters.\n");
+			return false;
+		}
+	}
+	return compile_classes(matcher, classes, len);
+}
+
+// Write the blob of the key
+static void format_blob(const pubkey_matcher* matcher, uint8_t* blob, const uint8_t* pubkey) {
+	memcpy(blob, matcher->blob_template, OPENSSH_PUBKEY_OFFSET);
+	memcpy(blob + OPENSSH_PUBKEY_OFFSET, pubkey, CURVE_25519_PUBLIC_KEY_SIZE);
+}
+
+// Run the DFA on the base64 characters of the blob of the key, from the
+// prefix or backward from the end
+static bool match_dfa(const pubkey_matcher* matcher, const uint8_t* pubkey) {
+	uint8_t blob[OPENSSH_PUBKEY_SIZE];
+	format_blob(matcher, blob, pubkey);
+	int direction = matcher->position == MATCH_PREFIX ? 1 : -1;
+	int state = matcher->dfa.start;
+	for (int c=(direction > 0 ? FIRST_KEY_CHAR : PUBKEY_BASE64_SIZE - 1); state > PATTERN_ACCEPT && 0 <= c && c < PUBKEY_BASE64_SIZE; c += direction) {
+		state = pattern_dfa_step(&matcher->dfa, state, read_field(blob, OPENSSH_PUBKEY_SIZE, c * 6, 6));
+	}
+	return state == PATTERN_ACCEPT;
+}
+
+bool pubkey_matcher_match(const pubkey_matcher* matcher, const uint8_t* pubkey) {
+	if (matcher->use_dfa) {
+		return match_dfa(matcher, pubkey);
+	}
+	for (int i=0; i<CURVE_25519_PUBLIC_KEY_SIZE / 8; i++) {
+		uint64_t word;
+		memcpy(&word, pubkey + 8 * i, sizeof(word));
+		if ((word & matcher->mask[i]) != matcher->value[i]) {
+			return false;
+		}
+	}
+	for (int i=0; i<matcher->fields; i++) {
+		unsigned int field = read_field(pubkey, CURVE_25519_PUBLIC_KEY_SIZE, matcher->field[i].bit, matcher->field[i].bits);
+		if (!((matcher->field[i].accepted >> field) & 1)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+int pubkey_matcher_score(const pubkey_matcher* matcher, const uint8_t* pubkey) {
+	uint8_t blob[OPENSSH_PUBKEY_SIZE];
+	format_blob(matcher, blob, pubkey);
+	// Suffixes are read backward, from the end of the pubkey
+	int direction = matcher->position == MATCH_PREFIX ? 1 : -1;
+	int c = direction > 0 ? FIRST_KEY_CHAR : PUBKEY_BASE64_SIZE - 1;
+	int score = 0;
+	if (matcher->use_dfa) {
+		int state = matcher->dfa.start;
+		while (0 <= c && c < PUBKEY_BASE64_SIZE && (state = pattern_dfa_step(&matcher->dfa, state, read_field(blob, OPENSSH_PUBKEY_SIZE, c * 6, 6))) != PATTERN_DEAD) {
+			score++;
+			c += direction;
+		}
+		return score;
+	}
+	int k = direction > 0 ? 0 : matcher->length - 1;
+	while (score < matcher->length && ((matcher->classes[k] >> read_field(blob, OPENSSH_PUBKEY_SIZE, c * 6, 6)) & 1)) {
+		score++;
+		c += direction;
+		k += direction;
+	}
+	return score;
+}
@@ -0,0 +1,55 @@
+#ifndef _PUBKEY_MATCHER_H_
+#define _PUBKEY_MATCHER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "curve25519.h"
+#include "openssh_formatter.h"
+#include "match_position.h"
+#include "pattern.h"
+
+// Number of base64 characters of the public key blob. Its size is a multiple
+// of 3, so there is no padding and each character stands for 6 bits of the
+// blob.
+#define PUBKEY_BASE64_SIZE (OPENSSH_PUBKEY_SIZE / 3 * 4)
+
+// A ssh-pubkey reference compiled once, so that the candidates are checked on
+// their raw bytes without being base64 encoded.
+// The characters with a single accepted value are checked with masks on
+// 64-bit words of the key. The others, such as the letters of a case
+// insensitive reference or the classes of a pattern, are fields of the key
+// with a set of accepted values. The patterns that are not a fixed number of
+// characters are checked by running their DFA on the base64 characters.
+typedef struct {
+	uint64_t mask[CURVE_25519_PUBLIC_KEY_SIZE / 8];
+	uint64_t value[CURVE_25519_PUBLIC_KEY_SIZE / 8];
+	int fields;
+	struct {
+		uint16_t bit;      // Position of the first bit of the field in the key, from the most significant bit of its first byte
+		uint8_t  bits;     // Size of the field, 6 bits or less for the character that starts in the header
+		uint64_t accepted; // Bit v is set if the field can have the value v
+	} field[PUBKEY_BASE64_SIZE];
+	uint64_t classes[PUBKEY_BASE64_SIZE]; // Accepted values of each character of the reference, to score the keys
+	int length;
+	match_position position;
+	bool use_dfa;
+	pattern_dfa dfa; // Read forward from the prefix, or backward from the end for MATCH_SUFFIX
+	uint8_t blob_template[OPENSSH_PUBKEY_SIZE];
+} pubkey_matcher;
+
+// Compile the reference, or the pattern if is_pattern is true, for
+// MATCH_PREFIX or MATCH_SUFFIX. Print an error and return false if the
+// reference is not made of base64 characters, if the pattern is not valid or
+// if no key can match it.
+bool pubkey_matcher_compile(pubkey_matcher* matcher, const char* reference, match_position position, bool ignore_case, bool is_pattern);
+
+// Check if the base64 form of the public key matches the compiled reference
+bool pubkey_matcher_match(const pubkey_matcher* matcher, const uint8_t* pubkey);
+
+// Return how close the base64 form of the public key is to matching: the
+// number of characters that match the reference from its start, or from its
+// end for MATCH_SUFFIX
+int pubkey_matcher_score(const pubkey_matcher* matcher, const uint8_t* pubkey);
+
+#endif
+
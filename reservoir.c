@@ -0,0 +1,165 @@
+#include "reservoir.h"
+#include "handy.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// Start of the reservoir files
+#define RESERVOIR_MAGIC "mining-devzat-id reservoir"
+
+// Written in the byte order of the machine, so that a file made on a machine
+// of the other order is rejected, as the IDs are stored as native words
+#define RESERVOIR_BYTE_ORDER 0x01020304
+
+struct reservoir_header {
+	char magic[32];
+	uint32_t byte_order;
+	uint32_t prefix_digits;
+	uint32_t slots;
+	uint32_t slot_size;
+	uint8_t padding[16];
+};
+
+#define RESERVOIR_USED_OFFSET sizeof(reservoir_header)
+#define RESERVOIR_SLOTS_OFFSET (RESERVOIR_USED_OFFSET + RESERVOIR_BUCKETS)
+#define RESERVOIR_FILE_SIZE (RESERVOIR_SLOTS_OFFSET + (size_t) RESERVOIR_BUCKETS * RESERVOIR_SLOTS * sizeof(reservoir_slot))
+
+static void init_header(reservoir_header* header) {
+	memset(header, 0, sizeof(reservoir_header));
+	strcpy(header->magic, RESERVOIR_MAGIC);
+	header->byte_order = RESERVOIR_BYTE_ORDER;
+	header->prefix_digits = RESERVOIR_PREFIX_DIGITS;
+	header->slots = RESERVOIR_SLOTS;
+	header->slot_size = sizeof(reservoir_slot);
+}
+
+// Create the file content if it is empty, or check that it is a reservoir
+// of the same layout. The file must be locked, so that only one process
+// creates it.
+static bool setup_file(int fd, const char* path) {
+	struct stat st;
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "Error, unable to read reservoir file %s.\n", path);
+		return false;
+	}
+	reservoir_header expected;
+	init_header(&expected);
+	if (st.st_size == 0) {
+		// The keys and the used counts start as zeros, which is empty
+		if (ftruncate(fd, RESERVOIR_FILE_SIZE) || pwrite(fd, &expected, sizeof(expected), 0) != sizeof(expected)) {
+			fprintf(stderr, "Error, unable to create reservoir file %s.\n", path);
+			return false;
+		}
+		return true;
+	}
+	reservoir_header header;
+	if ((size_t) st.st_size != RESERVOIR_FILE_SIZE || pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(&header, &expected, sizeof(header))) {
+		fprintf(stderr, "Error, %s is not a reservoir file of this version.\n", path);
+		return false;
+	}
+	return true;
+}
+
+bool reservoir_open(reservoir* store, const char* path) {
+	memset(store, 0, sizeof(reservoir));
+	int fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "Error, unable to open reservoir file %s.\n", path);
+		return false;
+	}
+	flock(fd, LOCK_EX);
+	bool ok = setup_file(fd, path);
+	flock(fd, LOCK_UN);
+	if (ok) {
+		store->map = mmap(NULL, RESERVOIR_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (store->map == MAP_FAILED) {
+			fprintf(stderr, "Error, unable to map reservoir file %s.\n", path);
+			store->map = NULL;
+			ok = false;
+		}
+	}
+	// The mapping stays valid once the file is closed
+	close(fd);
+	if (!ok) {
+		return false;
+	}
+	store->size = RESERVOIR_FILE_SIZE;
+	store->used = (atomic_uchar*) ((uint8_t*) store->map + RESERVOIR_USED_OFFSET);
+	store->slots = (reservoir_slot*) ((uint8_t*) store->map + RESERVOIR_SLOTS_OFFSET);
+	return true;
+}
+
+void reservoir_close(reservoir* store) {
+	if (store->map) {
+		munmap(store->map, store->size);
+	}
+	memset(store, 0, sizeof(reservoir));
+}
+
+bool reservoir_store(reservoir* store, const uint32_t hash_words[CF_SHA256_HASHSZ / 4], const uint8_t* privkey) {
+	unsigned int bucket = reservoir_bucket(hash_words);
+	reservoir_slot* slots = store->slots + (size_t) bucket * RESERVOIR_SLOTS;
+	for (int i=0; i<RESERVOIR_SLOTS; i++) {
+		uint32_t state = RESERVOIR_EMPTY;
+		if (!atomic_compare_exchange_strong_explicit(&slots[i].state, &state, RESERVOIR_WRITING, memory_order_acquire, memory_order_relaxed)) {
+			continue;
+		}
+		atomic_fetch_add_explicit(&store->used[bucket], 1, memory_order_relaxed);
+		memcpy(slots[i].id, hash_words, sizeof(slots[i].id));
+		memcpy(slots[i].privkey, privkey, CURVE_25519_PRIVATE_KEY_SIZE);
+		atomic_store_explicit(&slots[i].state, RESERVOIR_READY, memory_order_release);
+		return true;
+	}
+	return false;
+}
+
+// Take a key of the bucket whose Devzat ID matches
+static bool take_from_bucket(reservoir* store, unsigned int bucket, const devzat_matcher* matcher, uint8_t* privkey) {
+	reservoir_slot* slots = store->slots + (size_t) bucket * RESERVOIR_SLOTS;
+	for (int i=0; i<RESERVOIR_SLOTS; i++) {
+		if (atomic_load_explicit(&slots[i].state, memory_order_acquire) != RESERVOIR_READY || devzat_matcher_match(matcher, slots[i].id) < 0) {
+			continue;
+		}
+		uint32_t state = RESERVOIR_READY;
+		if (!atomic_compare_exchange_strong_explicit(&slots[i].state, &state, RESERVOIR_TAKEN, memory_order_acquire, memory_order_relaxed)) {
+			continue;
+		}
+		// Another process may have taken the key and written a new one
+		// since it was checked
+		if (devzat_matcher_match(matcher, slots[i].id) < 0) {
+			atomic_store_explicit(&slots[i].state, RESERVOIR_READY, memory_order_release);
+			continue;
+		}
+		memcpy(privkey, slots[i].privkey, CURVE_25519_PRIVATE_KEY_SIZE);
+		mem_clean(slots[i].privkey, CURVE_25519_PRIVATE_KEY_SIZE);
+		mem_clean(slots[i].id, sizeof(slots[i].id));
+		atomic_store_explicit(&slots[i].state, RESERVOIR_EMPTY, memory_order_release);
+		atomic_fetch_sub_explicit(&store->used[bucket], 1, memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+bool reservoir_take(reservoir* store, const devzat_matcher* matcher, uint8_t* privkey) {
+	// Bits of the bucket fixed by a reference matched at the prefix
+	unsigned int known = 0;
+	unsigned int wanted = 0;
+	if (matcher->position == MATCH_PREFIX && !matcher->use_dfa && !matcher->metric) {
+		known = reservoir_bucket(matcher->mask);
+		wanted = reservoir_bucket(matcher->value);
+	}
+	for (unsigned int b=0; b<RESERVOIR_BUCKETS; b++) {
+		if (((b ^ wanted) & known) || !atomic_load_explicit(&store->used[b], memory_order_relaxed)) {
+			continue;
+		}
+		if (take_from_bucket(store, b, matcher, privkey)) {
+			return true;
+		}
+	}
+	return false;
+}
+
@@ -0,0 +1,82 @@
+#ifndef _RESERVOIR_H_
+#define _RESERVOIR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "sha2.h"
+#include "curve25519.h"
+#include "devzat_matcher.h"
+
+// Number of hex digits at the start of the Devzat IDs that index the keys of
+// a reservoir, and number of keys kept for each of these prefixes
+#define RESERVOIR_PREFIX_DIGITS 4
+#define RESERVOIR_BUCKETS (1 << (4 * RESERVOIR_PREFIX_DIGITS))
+#define RESERVOIR_SLOTS 4
+
+// A key of the reservoir, with the words of its Devzat ID. Its state tells
+// what can be done with it:
+// - RESERVOIR_EMPTY: a process can claim it to write a key, by setting it
+//   to RESERVOIR_WRITING;
+// - RESERVOIR_READY: the key is written, a process can take it by setting it
+//   to RESERVOIR_TAKEN, after which it is wiped and made empty again.
+// The states only change with compare and swap, so that each key is written
+// by one process and given out by one process, once.
+typedef enum {
+	RESERVOIR_EMPTY,
+	RESERVOIR_WRITING,
+	RESERVOIR_READY,
+	RESERVOIR_TAKEN,
+} reservoir_state;
+
+typedef struct {
+	_Atomic uint32_t state;
+	uint32_t id[CF_SHA256_HASHSZ / 4];
+	uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+} reservoir_slot;
+
+typedef struct reservoir_header reservoir_header;
+
+// A file of private keys, sorted by the prefix of their Devzat ID, mapped in
+// memory and shared by all the processes that open it. It is made of a
+// header, the number of keys used in each bucket, which is a hint small
+// enough to stay in the cache, and the RESERVOIR_SLOTS slots of each bucket.
+// A process that stops while it writes a key leaves its slot in the
+// RESERVOIR_WRITING state for good.
+typedef struct {
+	void* map;
+	size_t size;
+	atomic_uchar* used;
+	reservoir_slot* slots;
+} reservoir;
+
+// Open the reservoir file, creating it if it does not exist yet. The file is
+// only readable by its owner as it holds private keys. Print an error and
+// return false if it can not be opened or is not a reservoir.
+bool reservoir_open(reservoir* store, const char* path);
+
+void reservoir_close(reservoir* store);
+
+// Bucket of the keys whose Devzat ID has these words
+static inline unsigned int reservoir_bucket(const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	return hash_words[0] >> (32 - 4 * RESERVOIR_PREFIX_DIGITS);
+}
+
+// Return true if the bucket of the ID seems to have room for a key. This is
+// cheap enough to be checked for each candidate.
+static inline bool reservoir_wants(const reservoir* store, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	return atomic_load_explicit(&store->used[reservoir_bucket(hash_words)], memory_order_relaxed) < RESERVOIR_SLOTS;
+}
+
+// Write the key in an empty slot of the bucket of its Devzat ID. Return
+// false if the bucket is full.
+bool reservoir_store(reservoir* store, const uint32_t hash_words[CF_SHA256_HASHSZ / 4], const uint8_t* privkey);
+
+// Take a key whose Devzat ID matches, copy it to privkey and remove it from
+// the reservoir. For a reference matched at the prefix, only the buckets
+// that can match are searched. Return false if there is none.
+bool reservoir_take(reservoir* store, const devzat_matcher* matcher, uint8_t* privkey);
+
+#endif
+
@@ -0,0 +1,72 @@
+#include "result_queue.h"
+#include <string.h>
+#include <unistd.h>
+#include "handy.h"
+
+void result_queue_init(result_queue* queue, uint64_t wanted) {
+	memset(queue, 0, sizeof(result_queue));
+	for (uint64_t i=0; i<RESULT_QUEUE_SIZE; i++) {
+		atomic_init(&queue->slot[i].sequence, i);
+	}
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->claimed, 0);
+	queue->wanted = wanted;
+}
+
+bool result_queue_claim(result_queue* queue) {
+	// The count never goes past the wanted number, so that a right given back
+	// can be reserved again
+	uint64_t claimed = atomic_load_explicit(&queue->claimed, memory_order_relaxed);
+	do {
+		if (queue->wanted && claimed >= queue->wanted) {
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&queue->claimed, &claimed, claimed + 1, memory_order_relaxed, memory_order_relaxed));
+	return true;
+}
+
+void result_queue_unclaim(result_queue* queue) {
+	atomic_fetch_sub_explicit(&queue->claimed, 1, memory_order_relaxed);
+}
+
+bool result_queue_try_push(result_queue* queue, const uint8_t* privkey) {
+	uint64_t position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	for (;;) {
+		uint64_t sequence = atomic_load_explicit(&queue->slot[position % RESULT_QUEUE_SIZE].sequence, memory_order_acquire);
+		int64_t lag = (int64_t) (sequence - position);
+		if (lag == 0) {
+			// The slot is free, take its position if no other producer did
+			if (atomic_compare_exchange_weak_explicit(&queue->head, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (lag < 0) {
+			// The writer has not read the slot of the previous lap yet
+			return false;
+		} else {
+			position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+		}
+	}
+	memcpy(queue->slot[position % RESULT_QUEUE_SIZE].privkey, privkey, CURVE_25519_PRIVATE_KEY_SIZE);
+	atomic_store_explicit(&queue->slot[position % RESULT_QUEUE_SIZE].sequence, position + 1, memory_order_release);
+	return true;
+}
+
+void result_queue_push(result_queue* queue, const uint8_t* privkey) {
+	while (!result_queue_try_push(queue, privkey)) {
+		usleep(1000);
+	}
+}
+
+bool result_queue_pop(result_queue* queue, uint8_t* privkey) {
+	uint64_t position = queue->tail;
+	uint64_t sequence = atomic_load_explicit(&queue->slot[position % RESULT_QUEUE_SIZE].sequence, memory_order_acquire);
+	if (sequence != position + 1) {
+		return false;
+	}
+	memcpy(privkey, queue->slot[position % RESULT_QUEUE_SIZE].privkey, CURVE_25519_PRIVATE_KEY_SIZE);
+	mem_clean(queue->slot[position % RESULT_QUEUE_SIZE].privkey, CURVE_25519_PRIVATE_KEY_SIZE);
+	atomic_store_explicit(&queue->slot[position % RESULT_QUEUE_SIZE].sequence, position + RESULT_QUEUE_SIZE, memory_order_release);
+	queue->tail = position + 1;
+	return true;
+}
+
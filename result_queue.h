@@ -0,0 +1,53 @@
+#ifndef _RESULT_QUEUE_H_
+#define _RESULT_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "curve25519.h"
+
+// Number of keys that can wait in the queue. It must be a power of 2.
+#define RESULT_QUEUE_SIZE 64
+
+// Size of a cache line. Data written by different threads is aligned on it
+// so that the threads do not have to take the line from each other.
+#define CACHE_LINE_SIZE 64
+
+// A bounded queue of private keys, pushed by the mining workers and popped by
+// a single writer, without locks. Each slot has a sequence number telling
+// whose turn it is: the producer that reserved the position of the slot, the
+// writer once the key is in, or the producer of the next lap once the writer
+// is done with it.
+typedef struct {
+	struct {
+		_Atomic uint64_t sequence;
+		uint8_t privkey[CURVE_25519_PRIVATE_KEY_SIZE];
+	} slot[RESULT_QUEUE_SIZE];
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head; // Next position to reserve by the producers
+	_Atomic uint64_t claimed; // Number of keys reserved by the producers
+	_Alignas(CACHE_LINE_SIZE) uint64_t tail; // Next position to read by the writer
+	uint64_t wanted;  // Number of keys to produce, 0 for no limit
+} result_queue;
+
+void result_queue_init(result_queue* queue, uint64_t wanted);
+
+// Reserve the right to push a key. Return false if the wanted number of keys
+// has already been reserved.
+bool result_queue_claim(result_queue* queue);
+
+// Give back a right reserved with result_queue_claim, for a key that is not
+// pushed
+void result_queue_unclaim(result_queue* queue);
+
+// Push a private key, waiting if the queue is full
+void result_queue_push(result_queue* queue, const uint8_t* privkey);
+
+// Same as result_queue_push, but return false at once if the queue is full
+bool result_queue_try_push(result_queue* queue, const uint8_t* privkey);
+
+// Pop a private key into privkey. Return false if the queue is empty. Only
+// one thread can pop.
+bool result_queue_pop(result_queue* queue, uint8_t* privkey);
+
+#endif
+
@@ -83,6 +83,92 @@ extern void cf_sha256_digest(const cf_sha256_context *ctx, uint8_t hash[CF_SHA25
  */
 extern void cf_sha256_digest_final(cf_sha256_context *ctx, uint8_t hash[CF_SHA256_HASHSZ]);
 
+/* .. c:macro:: CF_SHA256_ONEBLOCK_MAXSZ
+ * The longest message that fits in a single block with its padding: 55
+ * bytes. */
+#define CF_SHA256_ONEBLOCK_MAXSZ 55
+
+/* .. c:function:: $DECL
+ * Hashes the `nbytes` at `data` in one go, writing `CF_SHA256_HASHSZ` bytes
+ * to `hash`.  `nbytes` must not exceed `CF_SHA256_ONEBLOCK_MAXSZ`.
+ *
+ * Faster than the incremental interface for short messages: there is no
+ * context nor buffering, and the rounds are fully unrolled.
+ */
+extern void cf_sha256_oneblock(const void *data, size_t nbytes, uint8_t hash[CF_SHA256_HASHSZ]);
+
+/* .. c:macro:: CF_SHA256_PREFIXSZ
+ * The size of the constant prefix of the messages hashed with a
+ * :c:type:`cf_sha256_prefix_context`: 16 bytes, the first 4 message words. */
+#define CF_SHA256_PREFIXSZ 16
+
+/* .. c:type:: cf_sha256_prefix_context
+ * Precomputed hashing of single block messages of a fixed length, that all
+ * start with the same `CF_SHA256_PREFIXSZ` bytes.
+ *
+ * The first 4 rounds and parts of the first message schedule words only
+ * depend on the prefix: they are computed once by
+ * :c:func:`cf_sha256_prefix_init`.
+ *
+ * .. c:member:: cf_sha256_prefix_context.H
+ * State after the rounds that only read the prefix.
+ *
+ * .. c:member:: cf_sha256_prefix_context.block
+ * Padded message block, with the prefix and the length.
+ *
+ * .. c:member:: cf_sha256_prefix_context.W16
+ * Part of the first message schedule word past the block that only reads
+ * the prefix and the length.  Same for `W17` and `W18`.
+ *
+ * .. c:member:: cf_sha256_prefix_context.nbytes
+ * Length of the messages.
+ */
+typedef struct
+{
+  uint32_t H[8];
+  uint8_t block[CF_SHA256_BLOCKSZ];
+  uint32_t W16, W17, W18;
+  size_t nbytes;
+} cf_sha256_prefix_context;
+
+/* .. c:function:: $DECL
+ * Sets up `ctx` to hash messages of `nbytes` bytes starting with `prefix`.
+ * `nbytes` must be above `CF_SHA256_PREFIXSZ` and must not exceed
+ * `CF_SHA256_ONEBLOCK_MAXSZ`.
+ */
+extern void cf_sha256_prefix_init(cf_sha256_prefix_context *ctx,
+                                  const uint8_t prefix[CF_SHA256_PREFIXSZ],
+                                  size_t nbytes);
+
+/* .. c:function:: $DECL
+ * Writes to `hash` the digest of the prefix of `ctx` followed by the
+ * `nbytes - CF_SHA256_PREFIXSZ` bytes at `rest`.
+ */
+extern void cf_sha256_prefix_digest(const cf_sha256_prefix_context *ctx, const uint8_t *rest,
+                                    uint8_t hash[CF_SHA256_HASHSZ]);
+
+/* .. c:function:: $DECL
+ * Same as :c:func:`cf_sha256_prefix_digest` on 8 messages at once: writes to
+ * `hash[i]` the digest of the prefix followed by the bytes at `rest[i]`.
+ *
+ * With the SHA extensions, the messages are hashed two at a time to hide the
+ * latency of the instructions.  Otherwise they are hashed together in the 8
+ * lanes of AVX2 vectors when the CPU has AVX2.
+ */
+extern void cf_sha256_prefix_digest_x8(const cf_sha256_prefix_context *ctx,
+                                       const uint8_t *const rest[8],
+                                       uint8_t hash[8][CF_SHA256_HASHSZ]);
+
+/* .. c:function:: $DECL
+ * Same as :c:func:`cf_sha256_prefix_digest_x8`, but writes the digests as
+ * the 8 words of the final state, before they are serialised: `words[i][j]`
+ * is bytes `4j` to `4j + 3` of `hash[i]`, read in big endian.  This lets
+ * callers compare digests a word at a time.
+ */
+extern void cf_sha256_prefix_digest_words_x8(const cf_sha256_prefix_context *ctx,
+                                             const uint8_t *const rest[8],
+                                             uint32_t words[8][8]);
+
 /* .. c:var:: cf_sha256
  * Abstract interface to SHA256.  See :c:type:`cf_chash` for more information.
  */
@@ -151,6 +237,86 @@ extern void cf_sha512_digest(const cf_sha512_context *ctx, uint8_t hash[CF_SHA51
  */
 extern void cf_sha512_digest_final(cf_sha512_context *ctx, uint8_t hash[CF_SHA512_HASHSZ]);
 
+/* .. c:macro:: CF_SHA512_ONEBLOCK_MAXSZ
+ * The longest message that fits in a single block with its padding: 111
+ * bytes. */
+#define CF_SHA512_ONEBLOCK_MAXSZ 111
+
+/* .. c:function:: $DECL
+ * Hashes the `nbytes` at `data` in one go, writing `CF_SHA512_HASHSZ` bytes
+ * to `hash`.  `nbytes` must not exceed `CF_SHA512_ONEBLOCK_MAXSZ`.
+ *
+ * Faster than the incremental interface for short messages: there is no
+ * context nor buffering, and the rounds are fully unrolled.
+ */
+extern void cf_sha512_oneblock(const void *data, size_t nbytes, uint8_t hash[CF_SHA512_HASHSZ]);
+
+/* .. c:macro:: CF_SHA512_X4_MAXSZ
+ * The longest message accepted by :c:func:`cf_sha512_x4`. */
+#define CF_SHA512_X4_MAXSZ CF_SHA512_ONEBLOCK_MAXSZ
+
+/* .. c:function:: $DECL
+ * Hashes 4 independent messages of `nbytes` bytes each, writing their
+ * digests to `hash`.  `nbytes` must not exceed `CF_SHA512_X4_MAXSZ`.
+ *
+ * The 4 messages are hashed in parallel with AVX2 when the CPU supports it,
+ * one after the other otherwise.
+ */
+extern void cf_sha512_x4(const uint8_t *const msg[4], size_t nbytes,
+                         uint8_t hash[4][CF_SHA512_HASHSZ]);
+
+/* .. c:macro:: CF_SHA512_COUNTER_PREFIXSZ
+ * The size of the constant prefix of the messages hashed with a
+ * :c:type:`cf_sha512_counter_context`: 24 bytes. */
+#define CF_SHA512_COUNTER_PREFIXSZ 24
+
+/* .. c:type:: cf_sha512_counter_context
+ * Precomputed hashing of 32-byte messages made of a constant 24-byte prefix
+ * followed by a 64-bit big endian counter.
+ *
+ * The first 3 rounds and the first 2 message schedule words only depend on
+ * the prefix: they are computed once by :c:func:`cf_sha512_counter_init`.
+ *
+ * .. c:member:: cf_sha512_counter_context.H
+ * State after the rounds that only read the prefix.
+ *
+ * .. c:member:: cf_sha512_counter_context.W
+ * Message words, with the padding.  The counter word is left to zero.
+ *
+ * .. c:member:: cf_sha512_counter_context.W16
+ * First message schedule word past the block.
+ *
+ * .. c:member:: cf_sha512_counter_context.W17
+ * Second message schedule word past the block.
+ */
+typedef struct
+{
+  uint64_t H[8];
+  uint64_t W[16];
+  uint64_t W16, W17;
+} cf_sha512_counter_context;
+
+/* .. c:function:: $DECL
+ * Sets up `ctx` to hash the messages starting with `prefix`.
+ */
+extern void cf_sha512_counter_init(cf_sha512_counter_context *ctx,
+                                   const uint8_t prefix[CF_SHA512_COUNTER_PREFIXSZ]);
+
+/* .. c:function:: $DECL
+ * Writes to `hash` the digest of the prefix of `ctx` followed by the 8 big
+ * endian bytes of `counter`.
+ */
+extern void cf_sha512_counter_digest(const cf_sha512_counter_context *ctx, uint64_t counter,
+                                     uint8_t hash[CF_SHA512_HASHSZ]);
+
+/* .. c:function:: $DECL
+ * Same as :c:func:`cf_sha512_counter_digest`, for 4 counters at once.  The
+ * 4 messages are hashed in parallel with AVX2 when the CPU supports it.
+ */
+extern void cf_sha512_counter_digest_x4(const cf_sha512_counter_context *ctx,
+                                        const uint64_t counter[4],
+                                        uint8_t hash[4][CF_SHA512_HASHSZ]);
+
 /* .. c:var:: cf_sha512
  * Abstract interface to SHA512.  See :c:type:`cf_chash` for more information.
  */
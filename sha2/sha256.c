@@ -19,6 +19,13 @@
 #include "bitops.h"
 #include "handy.h"
 #include "tassert.h"
+#include "cpu_features.h"
+
+#if defined(__x86_64__) && !defined(NO_SIMD)
+#define USE_SHA_NI
+#define USE_AVX2
+#include <immintrin.h>
+#endif
 
 static const uint32_t K[64] = {
 	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
@@ -46,23 +53,106 @@ static const uint32_t K[64] = {
 # define SSIG0(x) (rotr32((x), 7) ^ rotr32((x), 18) ^ ((x) >> 3))
 # define SSIG1(x) (rotr32((x), 17) ^ rotr32((x), 19) ^ ((x) >> 10))
 
+static const uint32_t IV[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#ifdef USE_SHA_NI
+
+/* Rounds with the SHA extensions.  sha256rnds2 does 2 rounds on the state
+ * split as ABEF and CDGH, and sha256msg1/sha256msg2 compute 4 words of the
+ * message schedule. */
+#define SHA_NI __attribute__((target("sha,sse4.1")))
+
+/* Runs rounds `first` to 63 of the `n` blocks from the working variables
+ * `state`, and leaves the resulting working variables in `state`: the caller
+ * adds the chaining value.  `first` must be a multiple of 4, the rounds before
+ * it are taken as done.
+ *
+ * sha256rnds2 has a long latency, so the rounds of up to SHA_NI_LANES
+ * independent blocks are interleaved. */
+#define SHA_NI_LANES 2
+
+SHA_NI static inline __attribute__((always_inline)) void sha256_rounds_shani_n(uint32_t state[][8], const uint8_t block[][CF_SHA256_BLOCKSZ], size_t n, size_t first)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i abef[SHA_NI_LANES], cdgh[SHA_NI_LANES];
+	/* msg[j][i % 4] is W[4i..4i+3] of block j. */
+	__m128i msg[SHA_NI_LANES][4];
+
+	for (size_t j = 0; j < n; j++)
+	{
+		__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state[j]), 0xb1);
+		__m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (state[j] + 4)), 0x1b);
+		abef[j] = _mm_alignr_epi8(abcd, efgh, 8);
+		cdgh[j] = _mm_blend_epi16(efgh, abcd, 0xf0);
+		for (size_t i = 0; i < 4; i++)
+			msg[j][i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (block[j] + 16 * i)), bswap);
+	}
+
+#pragma GCC unroll 16
+	for (size_t i = first / 4; i < 16; i++)
+	{
+		__m128i k = _mm_loadu_si128((const __m128i *) (K + 4 * i));
+		for (size_t j = 0; j < n; j++)
+		{
+			if (i >= 4)
+			{
+				__m128i w = _mm_sha256msg1_epu32(msg[j][i % 4], msg[j][(i + 1) % 4]);
+				w = _mm_add_epi32(w, _mm_alignr_epi8(msg[j][(i + 3) % 4], msg[j][(i + 2) % 4], 4));
+				msg[j][i % 4] = _mm_sha256msg2_epu32(w, msg[j][(i + 3) % 4]);
+			}
+			__m128i wk = _mm_add_epi32(msg[j][i % 4], k);
+			cdgh[j] = _mm_sha256rnds2_epu32(cdgh[j], abef[j], wk);
+			abef[j] = _mm_sha256rnds2_epu32(abef[j], cdgh[j], _mm_shuffle_epi32(wk, 0x0e));
+		}
+	}
+
+	for (size_t j = 0; j < n; j++)
+	{
+		__m128i feba = _mm_shuffle_epi32(abef[j], 0x1b);
+		__m128i dchg = _mm_shuffle_epi32(cdgh[j], 0xb1);
+		_mm_storeu_si128((__m128i *) state[j], _mm_blend_epi16(feba, dchg, 0xf0));
+		_mm_storeu_si128((__m128i *) (state[j] + 4), _mm_alignr_epi8(dchg, feba, 8));
+	}
+}
+
+SHA_NI static void sha256_rounds_shani(uint32_t state[8], const uint8_t block[CF_SHA256_BLOCKSZ], size_t first)
+{
+	sha256_rounds_shani_n((uint32_t (*)[8]) state, (const uint8_t (*)[CF_SHA256_BLOCKSZ]) block, 1, first);
+}
+
+SHA_NI static void sha256_rounds_shani_x2(uint32_t state[2][8], const uint8_t block[2][CF_SHA256_BLOCKSZ], size_t first)
+{
+	sha256_rounds_shani_n(state, block, 2, first);
+}
+
+#endif /* USE_SHA_NI */
+
 void cf_sha256_init(cf_sha256_context *ctx)
 {
 	memset(ctx, 0, sizeof *ctx);
-	ctx->H[0] = 0x6a09e667;
-	ctx->H[1] = 0xbb67ae85;
-	ctx->H[2] = 0x3c6ef372;
-	ctx->H[3] = 0xa54ff53a;
-	ctx->H[4] = 0x510e527f;
-	ctx->H[5] = 0x9b05688c;
-	ctx->H[6] = 0x1f83d9ab;
-	ctx->H[7] = 0x5be0cd19;
+	memcpy(ctx->H, IV, sizeof IV);
 }
 
 static void sha256_update_block(void *vctx, const uint8_t *inp)
 {
 	cf_sha256_context *ctx = vctx;
 
+#ifdef USE_SHA_NI
+	if (cpu_has_sha_ni())
+	{
+		uint32_t state[8];
+		memcpy(state, ctx->H, sizeof state);
+		sha256_rounds_shani(state, inp, 0);
+		for (size_t i = 0; i < 8; i++)
+			ctx->H[i] += state[i];
+		ctx->blocks++;
+		return;
+	}
+#endif
+
 	/* This is a 16-word window into the whole W array. */
 	uint32_t W[16];
 
@@ -181,6 +271,283 @@ void cf_sha256_digest_final(cf_sha256_context *ctx, uint8_t hash[CF_SHA256_HASHS
 	memset(ctx, 0, sizeof *ctx);
 }
 
+/* Writes the digest of the single block message whose compression ends with
+ * the state a..h. */
+static void sha256_oneblock_final(const uint32_t state[8], uint8_t hash[CF_SHA256_HASHSZ])
+{
+	for (size_t i = 0; i < 8; i++)
+		write32_be(IV[i] + state[i], hash + 4 * i);
+}
+
+/* Fully unrolled rounds for the single block functions.  Instead of shifting
+ * the state at each round, the variables rotate through the arguments:
+ * round t uses the order of ROUNDS8 at position t % 8. */
+#define SCHEDULE(t) \
+	(W[(t) % 16] += SSIG1(W[((t) - 2) % 16]) + W[((t) - 7) % 16] + SSIG0(W[((t) - 15) % 16]))
+#define ROUND(a, b, c, d, e, f, g, h, t) \
+	do { \
+		uint32_t T1 = h + BSIG1(e) + CH(e, f, g) + K[t] + W[(t) % 16]; \
+		d += T1; \
+		h = T1 + BSIG0(a) + MAJ(a, b, c); \
+	} while (0)
+#define ROUND_S(a, b, c, d, e, f, g, h, t) \
+	do { SCHEDULE(t); ROUND(a, b, c, d, e, f, g, h, t); } while (0)
+#define ROUNDS8(R, t) \
+	R(a, b, c, d, e, f, g, h, (t)); R(h, a, b, c, d, e, f, g, (t) + 1); \
+	R(g, h, a, b, c, d, e, f, (t) + 2); R(f, g, h, a, b, c, d, e, (t) + 3); \
+	R(e, f, g, h, a, b, c, d, (t) + 4); R(d, e, f, g, h, a, b, c, (t) + 5); \
+	R(c, d, e, f, g, h, a, b, (t) + 6); R(b, c, d, e, f, g, h, a, (t) + 7)
+
+void cf_sha256_oneblock(const void *data, size_t nbytes, uint8_t hash[CF_SHA256_HASHSZ])
+{
+	assert(nbytes <= CF_SHA256_ONEBLOCK_MAXSZ);
+
+	uint8_t block[CF_SHA256_BLOCKSZ];
+	memcpy(block, data, nbytes);
+	memset(block + nbytes, 0, CF_SHA256_BLOCKSZ - nbytes);
+	block[nbytes] = 0x80;
+	write64_be((uint64_t) nbytes * 8, block + CF_SHA256_BLOCKSZ - 8);
+
+#ifdef USE_SHA_NI
+	if (cpu_has_sha_ni())
+	{
+		uint32_t state[8];
+		memcpy(state, IV, sizeof state);
+		sha256_rounds_shani(state, block, 0);
+		sha256_oneblock_final(state, hash);
+		mem_clean(block, sizeof block);
+		mem_clean(state, sizeof state);
+		return;
+	}
+#endif
+
+	uint32_t W[16];
+	for (size_t t = 0; t < 16; t++)
+		W[t] = read32_be(block + 4 * t);
+
+	uint32_t a = IV[0], b = IV[1], c = IV[2], d = IV[3],
+					 e = IV[4], f = IV[5], g = IV[6], h = IV[7];
+	ROUNDS8(ROUND, 0);
+	ROUNDS8(ROUND, 8);
+	ROUNDS8(ROUND_S, 16);
+	ROUNDS8(ROUND_S, 24);
+	ROUNDS8(ROUND_S, 32);
+	ROUNDS8(ROUND_S, 40);
+	ROUNDS8(ROUND_S, 48);
+	ROUNDS8(ROUND_S, 56);
+
+	uint32_t state[8] = { a, b, c, d, e, f, g, h };
+	sha256_oneblock_final(state, hash);
+	mem_clean(block, sizeof block);
+	mem_clean(W, sizeof W);
+	mem_clean(state, sizeof state);
+}
+
+/* Number of rounds of a prefix message that only read the prefix. */
+#define PREFIX_ROUNDS 4
+
+void cf_sha256_prefix_init(cf_sha256_prefix_context *ctx, const uint8_t prefix[CF_SHA256_PREFIXSZ], size_t nbytes)
+{
+	assert(nbytes > CF_SHA256_PREFIXSZ && nbytes <= CF_SHA256_ONEBLOCK_MAXSZ);
+
+	memset(ctx, 0, sizeof *ctx);
+	ctx->nbytes = nbytes;
+	memcpy(ctx->block, prefix, CF_SHA256_PREFIXSZ);
+	ctx->block[nbytes] = 0x80;
+	write64_be((uint64_t) nbytes * 8, ctx->block + CF_SHA256_BLOCKSZ - 8);
+
+	uint32_t W[16];
+	for (size_t t = 0; t < 16; t++)
+		W[t] = read32_be(ctx->block + 4 * t);
+
+	/* The parts of W16-W18 that do not read the rest of the message. */
+	ctx->W16 = SSIG1(W[14]) + SSIG0(W[1]) + W[0];
+	ctx->W17 = SSIG1(W[15]) + SSIG0(W[2]) + W[1];
+	ctx->W18 = SSIG0(W[3]) + W[2];
+
+	uint32_t a = IV[0], b = IV[1], c = IV[2], d = IV[3],
+					 e = IV[4], f = IV[5], g = IV[6], h = IV[7];
+	ROUND(a, b, c, d, e, f, g, h, 0);
+	ROUND(h, a, b, c, d, e, f, g, 1);
+	ROUND(g, h, a, b, c, d, e, f, 2);
+	ROUND(f, g, h, a, b, c, d, e, 3);
+
+	/* In the order of round 4, which is the usual a..h order. */
+	ctx->H[0] = e;
+	ctx->H[1] = f;
+	ctx->H[2] = g;
+	ctx->H[3] = h;
+	ctx->H[4] = a;
+	ctx->H[5] = b;
+	ctx->H[6] = c;
+	ctx->H[7] = d;
+}
+
+void cf_sha256_prefix_digest(const cf_sha256_prefix_context *ctx, const uint8_t *rest, uint8_t hash[CF_SHA256_HASHSZ])
+{
+	uint8_t block[CF_SHA256_BLOCKSZ];
+	memcpy(block, ctx->block, sizeof block);
+	memcpy(block + CF_SHA256_PREFIXSZ, rest, ctx->nbytes - CF_SHA256_PREFIXSZ);
+
+#ifdef USE_SHA_NI
+	if (cpu_has_sha_ni())
+	{
+		uint32_t state[8];
+		memcpy(state, ctx->H, sizeof state);
+		sha256_rounds_shani(state, block, PREFIX_ROUNDS);
+		sha256_oneblock_final(state, hash);
+		return;
+	}
+#endif
+
+	uint32_t W[16];
+	for (size_t t = 4; t < 16; t++)
+		W[t] = read32_be(block + 4 * t);
+
+	uint32_t e = ctx->H[0], f = ctx->H[1], g = ctx->H[2], h = ctx->H[3],
+					 a = ctx->H[4], b = ctx->H[5], c = ctx->H[6], d = ctx->H[7];
+	ROUND(e, f, g, h, a, b, c, d, 4);
+	ROUND(d, e, f, g, h, a, b, c, 5);
+	ROUND(c, d, e, f, g, h, a, b, 6);
+	ROUND(b, c, d, e, f, g, h, a, 7);
+	ROUNDS8(ROUND, 8);
+	/* W0-W3 are only read through the precomputed parts of W16-W19. */
+	W[0] = ctx->W16 + W[9];
+	ROUND(a, b, c, d, e, f, g, h, 16);
+	W[1] = ctx->W17 + W[10];
+	ROUND(h, a, b, c, d, e, f, g, 17);
+	W[2] = SSIG1(W[0]) + W[11] + ctx->W18;
+	ROUND(g, h, a, b, c, d, e, f, 18);
+	W[3] = read32_be(block + 12);
+	ROUND_S(f, g, h, a, b, c, d, e, 19);
+	ROUND_S(e, f, g, h, a, b, c, d, 20);
+	ROUND_S(d, e, f, g, h, a, b, c, 21);
+	ROUND_S(c, d, e, f, g, h, a, b, 22);
+	ROUND_S(b, c, d, e, f, g, h, a, 23);
+	ROUNDS8(ROUND_S, 24);
+	ROUNDS8(ROUND_S, 32);
+	ROUNDS8(ROUND_S, 40);
+	ROUNDS8(ROUND_S, 48);
+	ROUNDS8(ROUND_S, 56);
+
+	uint32_t state[8] = { a, b, c, d, e, f, g, h };
+	sha256_oneblock_final(state, hash);
+}
+
+#ifdef USE_AVX2
+
+/* Same as sha256_update_block, on the 8 lanes of 256-bit vectors. */
+#define AVX2 __attribute__((target("avx2")))
+#define SET8(x) _mm256_set1_epi32((int32_t) (x))
+#define ADD8(x, y) _mm256_add_epi32((x), (y))
+#define XOR8(x, y) _mm256_xor_si256((x), (y))
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define CH8(x, y, z) XOR8(_mm256_and_si256((x), (y)), _mm256_andnot_si256((x), (z)))
+#define MAJ8(x, y, z) _mm256_or_si256(_mm256_and_si256((x), (y)), _mm256_and_si256((z), _mm256_or_si256((x), (y))))
+#define BSIG08(x) XOR8(XOR8(ROTR8((x), 2), ROTR8((x), 13)), ROTR8((x), 22))
+#define BSIG18(x) XOR8(XOR8(ROTR8((x), 6), ROTR8((x), 11)), ROTR8((x), 25))
+#define SSIG08(x) XOR8(XOR8(ROTR8((x), 7), ROTR8((x), 18)), _mm256_srli_epi32((x), 3))
+#define SSIG18(x) XOR8(XOR8(ROTR8((x), 17), ROTR8((x), 19)), _mm256_srli_epi32((x), 10))
+
+AVX2 static void sha256_prefix_x8_avx2(const cf_sha256_prefix_context *ctx, const uint8_t block[8][CF_SHA256_BLOCKSZ], uint32_t words[8][8])
+{
+	__m256i W[16];
+	for (size_t t = 0; t < 16; t++)
+		W[t] = _mm256_set_epi32((int32_t) read32_be(block[7] + 4 * t), (int32_t) read32_be(block[6] + 4 * t),
+														(int32_t) read32_be(block[5] + 4 * t), (int32_t) read32_be(block[4] + 4 * t),
+														(int32_t) read32_be(block[3] + 4 * t), (int32_t) read32_be(block[2] + 4 * t),
+														(int32_t) read32_be(block[1] + 4 * t), (int32_t) read32_be(block[0] + 4 * t));
+
+	__m256i a = SET8(ctx->H[0]), b = SET8(ctx->H[1]), c = SET8(ctx->H[2]), d = SET8(ctx->H[3]),
+					e = SET8(ctx->H[4]), f = SET8(ctx->H[5]), g = SET8(ctx->H[6]), h = SET8(ctx->H[7]),
+					Wt;
+
+	for (size_t t = PREFIX_ROUNDS; t < 64; t++)
+	{
+		if (t < 16)
+		{
+			Wt = W[t];
+		} else {
+			Wt = ADD8(ADD8(SSIG18(W[(t - 2) % 16]), W[(t - 7) % 16]),
+								ADD8(SSIG08(W[(t - 15) % 16]), W[(t - 16) % 16]));
+			W[t % 16] = Wt;
+		}
+
+		__m256i T1 = ADD8(ADD8(h, BSIG18(e)),
+											ADD8(CH8(e, f, g), ADD8(SET8(K[t]), Wt)));
+		__m256i T2 = ADD8(BSIG08(a), MAJ8(a, b, c));
+		h = g;
+		g = f;
+		f = e;
+		e = ADD8(d, T1);
+		d = c;
+		c = b;
+		b = a;
+		a = ADD8(T1, T2);
+	}
+
+	__m256i state[8] = { a, b, c, d, e, f, g, h };
+	for (size_t i = 0; i < 8; i++)
+	{
+		uint32_t tmp[8];
+		_mm256_storeu_si256((__m256i *) tmp, ADD8(state[i], SET8(IV[i])));
+		for (size_t j = 0; j < 8; j++)
+			words[j][i] = tmp[j];
+	}
+}
+
+#endif /* USE_AVX2 */
+
+void cf_sha256_prefix_digest_words_x8(const cf_sha256_prefix_context *ctx, const uint8_t *const rest[8], uint32_t words[8][8])
+{
+	uint8_t block[8][CF_SHA256_BLOCKSZ];
+	for (size_t i = 0; i < 8; i++)
+	{
+		memcpy(block[i], ctx->block, CF_SHA256_BLOCKSZ);
+		memcpy(block[i] + CF_SHA256_PREFIXSZ, rest[i], ctx->nbytes - CF_SHA256_PREFIXSZ);
+	}
+
+#ifdef USE_SHA_NI
+	if (cpu_has_sha_ni())
+	{
+		for (size_t i = 0; i < 8; i += 2)
+		{
+			memcpy(words[i], ctx->H, sizeof words[i]);
+			memcpy(words[i + 1], ctx->H, sizeof words[i + 1]);
+			sha256_rounds_shani_x2(words + i, (const uint8_t (*)[CF_SHA256_BLOCKSZ]) block + i, PREFIX_ROUNDS);
+		}
+		for (size_t i = 0; i < 8; i++)
+			for (size_t j = 0; j < 8; j++)
+				words[i][j] += IV[j];
+		return;
+	}
+#endif
+#ifdef USE_AVX2
+	if (cpu_has_avx2())
+	{
+		sha256_prefix_x8_avx2(ctx, (const uint8_t (*)[CF_SHA256_BLOCKSZ]) block, words);
+		return;
+	}
+#endif
+
+	for (size_t i = 0; i < 8; i++)
+	{
+		uint8_t hash[CF_SHA256_HASHSZ];
+		cf_sha256_prefix_digest(ctx, rest[i], hash);
+		for (size_t j = 0; j < 8; j++)
+			words[i][j] = read32_be(hash + 4 * j);
+	}
+}
+
+void cf_sha256_prefix_digest_x8(const cf_sha256_prefix_context *ctx, const uint8_t *const rest[8], uint8_t hash[8][CF_SHA256_HASHSZ])
+{
+	uint32_t words[8][8];
+	cf_sha256_prefix_digest_words_x8(ctx, rest, words);
+	for (size_t i = 0; i < 8; i++)
+		for (size_t j = 0; j < 8; j++)
+			write32_be(words[i][j], hash[i] + 4 * j);
+}
+
 #ifdef CONFIG_MODULE_CRYPTO_HMAC
 const cf_chash cf_sha256 = {
 	.hashsz = CF_SHA256_HASHSZ,
@@ -19,6 +19,12 @@
 #include "bitops.h"
 #include "handy.h"
 #include "tassert.h"
+#include "cpu_features.h"
+
+#if defined(__x86_64__) && !defined(NO_SIMD)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
 
 static const uint64_t K[80] = {
 	UINT64_C(0x428a2f98d728ae22), UINT64_C(0x7137449123ef65cd),
@@ -70,17 +76,17 @@ static const uint64_t K[80] = {
 # define SSIG0(x) (rotr64((x), 1) ^ rotr64((x), 8) ^ ((x) >> 7))
 # define SSIG1(x) (rotr64((x), 19) ^ rotr64((x), 61) ^ ((x) >> 6))
 
+static const uint64_t IV[8] = {
+	UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
+	UINT64_C(0x3c6ef372fe94f82b), UINT64_C(0xa54ff53a5f1d36f1),
+	UINT64_C(0x510e527fade682d1), UINT64_C(0x9b05688c2b3e6c1f),
+	UINT64_C(0x1f83d9abfb41bd6b), UINT64_C(0x5be0cd19137e2179)
+};
+
 void cf_sha512_init(cf_sha512_context *ctx)
 {
 	memset(ctx, 0, sizeof *ctx);
-	ctx->H[0] = UINT64_C(0x6a09e667f3bcc908);
-	ctx->H[1] = UINT64_C(0xbb67ae8584caa73b);
-	ctx->H[2] = UINT64_C(0x3c6ef372fe94f82b);
-	ctx->H[3] = UINT64_C(0xa54ff53a5f1d36f1);
-	ctx->H[4] = UINT64_C(0x510e527fade682d1);
-	ctx->H[5] = UINT64_C(0x9b05688c2b3e6c1f);
-	ctx->H[6] = UINT64_C(0x1f83d9abfb41bd6b);
-	ctx->H[7] = UINT64_C(0x5be0cd19137e2179);
+	memcpy(ctx->H, IV, sizeof IV);
 }
 
 static void sha512_update_block(void *vctx, const uint8_t *inp)
@@ -198,6 +204,266 @@ void cf_sha512_digest_final(cf_sha512_context *ctx, uint8_t hash[CF_SHA512_HASHS
 	memset(ctx, 0, sizeof *ctx);
 }
 
+/* Writes the padded single block of a message of nbytes <= 111 bytes. */
+static void sha512_pad_block(uint8_t block[CF_SHA512_BLOCKSZ], const uint8_t *msg, size_t nbytes)
+{
+	memcpy(block, msg, nbytes);
+	memset(block + nbytes, 0, CF_SHA512_BLOCKSZ - nbytes);
+	block[nbytes] = 0x80;
+	write64_be((uint64_t) nbytes * 8, block + CF_SHA512_BLOCKSZ - 8);
+}
+
+/* Writes the digest of the single block message whose compression ends with
+ * the state a..h. */
+static void sha512_oneblock_final(const uint64_t state[8], uint8_t hash[CF_SHA512_HASHSZ])
+{
+	for (size_t i = 0; i < 8; i++)
+		write64_be(IV[i] + state[i], hash + 8 * i);
+}
+
+/* Fully unrolled rounds for the single block functions.  Instead of shifting
+ * the state at each round, the variables rotate through the arguments:
+ * round t uses the order of ROUNDS8 at position t % 8. */
+#define SCHEDULE(t) \
+	(W[(t) % 16] += SSIG1(W[((t) - 2) % 16]) + W[((t) - 7) % 16] + SSIG0(W[((t) - 15) % 16]))
+#define ROUND(a, b, c, d, e, f, g, h, t) \
+	do { \
+		uint64_t T1 = h + BSIG1(e) + CH(e, f, g) + K[t] + W[(t) % 16]; \
+		d += T1; \
+		h = T1 + BSIG0(a) + MAJ(a, b, c); \
+	} while (0)
+#define ROUND_S(a, b, c, d, e, f, g, h, t) \
+	do { SCHEDULE(t); ROUND(a, b, c, d, e, f, g, h, t); } while (0)
+#define ROUNDS8(R, t) \
+	R(a, b, c, d, e, f, g, h, (t)); R(h, a, b, c, d, e, f, g, (t) + 1); \
+	R(g, h, a, b, c, d, e, f, (t) + 2); R(f, g, h, a, b, c, d, e, (t) + 3); \
+	R(e, f, g, h, a, b, c, d, (t) + 4); R(d, e, f, g, h, a, b, c, (t) + 5); \
+	R(c, d, e, f, g, h, a, b, (t) + 6); R(b, c, d, e, f, g, h, a, (t) + 7)
+
+void cf_sha512_oneblock(const void *data, size_t nbytes, uint8_t hash[CF_SHA512_HASHSZ])
+{
+	assert(nbytes <= CF_SHA512_ONEBLOCK_MAXSZ);
+
+	uint8_t block[CF_SHA512_BLOCKSZ];
+	sha512_pad_block(block, data, nbytes);
+	uint64_t W[16];
+	for (size_t t = 0; t < 16; t++)
+		W[t] = read64_be(block + 8 * t);
+
+	uint64_t a = IV[0], b = IV[1], c = IV[2], d = IV[3],
+					 e = IV[4], f = IV[5], g = IV[6], h = IV[7];
+	ROUNDS8(ROUND, 0);
+	ROUNDS8(ROUND, 8);
+	ROUNDS8(ROUND_S, 16);
+	ROUNDS8(ROUND_S, 24);
+	ROUNDS8(ROUND_S, 32);
+	ROUNDS8(ROUND_S, 40);
+	ROUNDS8(ROUND_S, 48);
+	ROUNDS8(ROUND_S, 56);
+	ROUNDS8(ROUND_S, 64);
+	ROUNDS8(ROUND_S, 72);
+
+	uint64_t state[8] = { a, b, c, d, e, f, g, h };
+	sha512_oneblock_final(state, hash);
+	mem_clean(block, sizeof block);
+	mem_clean(W, sizeof W);
+	mem_clean(state, sizeof state);
+}
+
+/* Number of rounds of a counter message that only read the prefix. */
+#define COUNTER_ROUNDS 3
+
+void cf_sha512_counter_init(cf_sha512_counter_context *ctx, const uint8_t prefix[CF_SHA512_COUNTER_PREFIXSZ])
+{
+	memset(ctx, 0, sizeof *ctx);
+	uint64_t *W = ctx->W;
+	for (size_t t = 0; t < 3; t++)
+		W[t] = read64_be(prefix + 8 * t);
+	W[4] = UINT64_C(0x80) << 56;
+	W[15] = 32 * 8;
+
+	/* W16 and W17 read W0-W2, W9-W10 and W14-W15, but not the counter. */
+	ctx->W16 = SSIG1(W[14]) + W[9] + SSIG0(W[1]) + W[0];
+	ctx->W17 = SSIG1(W[15]) + W[10] + SSIG0(W[2]) + W[1];
+
+	uint64_t a = IV[0], b = IV[1], c = IV[2], d = IV[3],
+					 e = IV[4], f = IV[5], g = IV[6], h = IV[7];
+	ROUND(a, b, c, d, e, f, g, h, 0);
+	ROUND(h, a, b, c, d, e, f, g, 1);
+	ROUND(g, h, a, b, c, d, e, f, 2);
+
+	/* In the order of round 3. */
+	ctx->H[0] = f;
+	ctx->H[1] = g;
+	ctx->H[2] = h;
+	ctx->H[3] = a;
+	ctx->H[4] = b;
+	ctx->H[5] = c;
+	ctx->H[6] = d;
+	ctx->H[7] = e;
+}
+
+void cf_sha512_counter_digest(const cf_sha512_counter_context *ctx, uint64_t counter, uint8_t hash[CF_SHA512_HASHSZ])
+{
+	uint64_t W[16];
+	memcpy(W, ctx->W, sizeof W);
+	W[3] = counter;
+	/* W0 and W1 are only read by the first rounds and by W16 and W17. */
+	W[0] = ctx->W16;
+	W[1] = ctx->W17;
+
+	uint64_t f = ctx->H[0], g = ctx->H[1], h = ctx->H[2], a = ctx->H[3],
+					 b = ctx->H[4], c = ctx->H[5], d = ctx->H[6], e = ctx->H[7];
+	ROUND(f, g, h, a, b, c, d, e, 3);
+	ROUND(e, f, g, h, a, b, c, d, 4);
+	ROUND(d, e, f, g, h, a, b, c, 5);
+	ROUND(c, d, e, f, g, h, a, b, 6);
+	ROUND(b, c, d, e, f, g, h, a, 7);
+	ROUNDS8(ROUND, 8);
+	ROUND(a, b, c, d, e, f, g, h, 16);
+	ROUND(h, a, b, c, d, e, f, g, 17);
+	ROUND_S(g, h, a, b, c, d, e, f, 18);
+	ROUND_S(f, g, h, a, b, c, d, e, 19);
+	ROUND_S(e, f, g, h, a, b, c, d, 20);
+	ROUND_S(d, e, f, g, h, a, b, c, 21);
+	ROUND_S(c, d, e, f, g, h, a, b, 22);
+	ROUND_S(b, c, d, e, f, g, h, a, 23);
+	ROUNDS8(ROUND_S, 24);
+	ROUNDS8(ROUND_S, 32);
+	ROUNDS8(ROUND_S, 40);
+	ROUNDS8(ROUND_S, 48);
+	ROUNDS8(ROUND_S, 56);
+	ROUNDS8(ROUND_S, 64);
+	ROUNDS8(ROUND_S, 72);
+
+	uint64_t state[8] = { a, b, c, d, e, f, g, h };
+	sha512_oneblock_final(state, hash);
+	mem_clean(W, sizeof W);
+	mem_clean(state, sizeof state);
+}
+
+#ifdef USE_AVX2
+
+/* Same as sha512_update_block, on the 4 lanes of 256-bit vectors. */
+#define AVX2 __attribute__((target("avx2")))
+#define SET4(x) _mm256_set1_epi64x((int64_t) (x))
+#define ADD4(x, y) _mm256_add_epi64((x), (y))
+#define XOR4(x, y) _mm256_xor_si256((x), (y))
+#define ROTR4(x, n) _mm256_or_si256(_mm256_srli_epi64((x), (n)), _mm256_slli_epi64((x), 64 - (n)))
+#define CH4(x, y, z) XOR4(_mm256_and_si256((x), (y)), _mm256_andnot_si256((x), (z)))
+#define MAJ4(x, y, z) _mm256_or_si256(_mm256_and_si256((x), (y)), _mm256_and_si256((z), _mm256_or_si256((x), (y))))
+#define BSIG04(x) XOR4(XOR4(ROTR4((x), 28), ROTR4((x), 34)), ROTR4((x), 39))
+#define BSIG14(x) XOR4(XOR4(ROTR4((x), 14), ROTR4((x), 18)), ROTR4((x), 41))
+#define SSIG04(x) XOR4(XOR4(ROTR4((x), 1), ROTR4((x), 8)), _mm256_srli_epi64((x), 7))
+#define SSIG14(x) XOR4(XOR4(ROTR4((x), 19), ROTR4((x), 61)), _mm256_srli_epi64((x), 6))
+
+/* Compresses the single block messages W, from round `first` where all
+ * lanes have the state `start`, and writes the 4 digests. */
+AVX2 static void sha512_x4_avx2(const uint64_t start[8], size_t first, __m256i W[16], uint8_t hash[4][CF_SHA512_HASHSZ])
+{
+	__m256i a = SET4(start[0]), b = SET4(start[1]), c = SET4(start[2]), d = SET4(start[3]),
+					e = SET4(start[4]), f = SET4(start[5]), g = SET4(start[6]), h = SET4(start[7]),
+					Wt;
+
+	for (size_t t = first; t < 80; t++)
+	{
+		if (t < 16)
+		{
+			Wt = W[t];
+		} else {
+			Wt = ADD4(ADD4(SSIG14(W[(t - 2) % 16]), W[(t - 7) % 16]),
+								ADD4(SSIG04(W[(t - 15) % 16]), W[(t - 16) % 16]));
+			W[t % 16] = Wt;
+		}
+
+		__m256i T1 = ADD4(ADD4(h, BSIG14(e)),
+											ADD4(CH4(e, f, g), ADD4(SET4(K[t]), Wt)));
+		__m256i T2 = ADD4(BSIG04(a), MAJ4(a, b, c));
+		h = g;
+		g = f;
+		f = e;
+		e = ADD4(d, T1);
+		d = c;
+		c = b;
+		b = a;
+		a = ADD4(T1, T2);
+	}
+
+	__m256i state[8] = { a, b, c, d, e, f, g, h };
+	uint64_t lanes[4][8];
+	for (size_t i = 0; i < 8; i++)
+	{
+		uint64_t tmp[4];
+		_mm256_storeu_si256((__m256i *) tmp, state[i]);
+		for (size_t j = 0; j < 4; j++)
+			lanes[j][i] = tmp[j];
+	}
+	for (size_t j = 0; j < 4; j++)
+		sha512_oneblock_final(lanes[j], hash[j]);
+
+	mem_clean(state, sizeof state);
+	mem_clean(lanes, sizeof lanes);
+}
+
+AVX2 static void sha512_x4_blocks_avx2(const uint8_t block[4][CF_SHA512_BLOCKSZ], uint8_t hash[4][CF_SHA512_HASHSZ])
+{
+	__m256i W[16];
+	for (size_t t = 0; t < 16; t++)
+		W[t] = _mm256_set_epi64x((int64_t) read64_be(block[3] + 8 * t),
+														 (int64_t) read64_be(block[2] + 8 * t),
+														 (int64_t) read64_be(block[1] + 8 * t),
+														 (int64_t) read64_be(block[0] + 8 * t));
+	sha512_x4_avx2(IV, 0, W, hash);
+	mem_clean(W, sizeof W);
+}
+
+AVX2 static void sha512_counter_x4_avx2(const cf_sha512_counter_context *ctx, const uint64_t counter[4], uint8_t hash[4][CF_SHA512_HASHSZ])
+{
+	__m256i W[16];
+	for (size_t t = 0; t < 16; t++)
+		W[t] = SET4(ctx->W[t]);
+	W[3] = _mm256_set_epi64x((int64_t) counter[3], (int64_t) counter[2],
+													 (int64_t) counter[1], (int64_t) counter[0]);
+	sha512_x4_avx2(ctx->H, COUNTER_ROUNDS, W, hash);
+	mem_clean(W, sizeof W);
+}
+
+#endif /* USE_AVX2 */
+
+void cf_sha512_x4(const uint8_t *const msg[4], size_t nbytes, uint8_t hash[4][CF_SHA512_HASHSZ])
+{
+	assert(nbytes <= CF_SHA512_X4_MAXSZ);
+
+#ifdef USE_AVX2
+	if (cpu_has_avx2())
+	{
+		uint8_t block[4][CF_SHA512_BLOCKSZ];
+		for (size_t i = 0; i < 4; i++)
+			sha512_pad_block(block[i], msg[i], nbytes);
+		sha512_x4_blocks_avx2((const uint8_t (*)[CF_SHA512_BLOCKSZ]) block, hash);
+		mem_clean(block, sizeof block);
+		return;
+	}
+#endif
+
+	for (size_t i = 0; i < 4; i++)
+		cf_sha512_oneblock(msg[i], nbytes, hash[i]);
+}
+
+void cf_sha512_counter_digest_x4(const cf_sha512_counter_context *ctx, const uint64_t counter[4], uint8_t hash[4][CF_SHA512_HASHSZ])
+{
+#ifdef USE_AVX2
+	if (cpu_has_avx2())
+	{
+		sha512_counter_x4_avx2(ctx, counter, hash);
+		return;
+	}
+#endif
+
+	for (size_t i = 0; i < 4; i++)
+		cf_sha512_counter_digest(ctx, counter[i], hash[i]);
+}
+
 /*
 const cf_chash cf_sha384 = {
 	.hashsz = CF_SHA384_HASHSZ,
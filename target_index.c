@@ -0,0 +1,176 @@
+#include "target_index.h"
+#include "pattern.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// Maximum size of a line of the targets file
+#define MAX_LINE 4096
+
+// Number of hex digits of a Devzat ID
+#define ID_DIGITS (CF_SHA256_HASHSZ * 2)
+
+// Bits of the words of an ID, or of the masks or values of a target, that
+// select its bucket
+static unsigned int bucket_bits(match_position position, const uint32_t words[CF_SHA256_HASHSZ / 4]) {
+	if (position == MATCH_PREFIX) {
+		return words[0] >> (32 - TARGET_INDEX_BITS);
+	}
+	return words[CF_SHA256_HASHSZ / 4 - 1] & (TARGET_INDEX_BUCKETS - 1);
+}
+
+// Set the masks of the target for the reference. Return false if it is not a
+// hex number of at most ID_DIGITS digits.
+static bool compile_target(target* t, const char* reference, match_position position) {
+	size_t len = strlen(reference);
+	if (!len || len > ID_DIGITS) {
+		return false;
+	}
+	size_t first = position == MATCH_SUFFIX ? ID_DIGITS - len : 0;
+	for (size_t i=0; i<len; i++) {
+		uint64_t digit = pattern_symbol_set(reference[i], PATTERN_HEX, false);
+		if (!digit) {
+			return false;
+		}
+		size_t d = first + i;
+		int shift = 28 - 4 * (d % 8);
+		t->value[d / 8] |= (uint32_t) __builtin_ctzll(digit) << shift;
+		t->mask[d / 8] |= (uint32_t) 0xF << shift;
+	}
+	return true;
+}
+
+// Read the targets of the file in index->targets
+static bool read_targets(target_index* index, FILE* f, const char* path) {
+	int capacity = 0;
+	char line[MAX_LINE];
+	for (int line_number=1; fgets(line, sizeof(line), f); line_number++) {
+		if (!strchr(line, '\n') && !feof(f)) {
+			fprintf(stderr, "Error, line %d of %s is too long.\n", line_number, path);
+			return false;
+		}
+		char* reference = strtok(line, " \t\r\n");
+		if (!reference || reference[0] == '#') {
+			continue;
+		}
+		char* output = strtok(NULL, " \t\r\n");
+		if (strtok(NULL, " \t\r\n")) {
+			fprintf(stderr, "Error, line %d of %s should only have a reference and a file path.\n", line_number, path);
+			return false;
+		}
+
+		if (index->count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			index->targets = realloc(index->targets, capacity * sizeof(target));
+		}
+		target* t = &index->targets[index->count];
+		memset(t, 0, sizeof(target));
+		atomic_init(&t->found, false);
+		if (!compile_target(t, reference, index->position)) {
+			fprintf(stderr, "Error, the target on line %d of %s should be a valid hex number of at most %d digits.\n", line_number, path, ID_DIGITS);
+			return false;
+		}
+		t->reference = strdup(reference);
+		if (output) {
+			t->output = strdup(output);
+		} else {
+			t->output = malloc(strlen(reference) + sizeof(".key"));
+			sprintf(t->output, "%s.key", reference);
+		}
+		index->count++;
+	}
+	if (!index->count) {
+		fprintf(stderr, "Error, no target in %s.\n", path);
+		return false;
+	}
+	return true;
+}
+
+// Call add on each bucket that the target is in
+#define FOR_EACH_BUCKET(index, t, b, add) do { \
+	unsigned int known = bucket_bits((index)->position, (t)->mask); \
+	unsigned int wanted = bucket_bits((index)->position, (t)->value); \
+	if (known == TARGET_INDEX_BUCKETS - 1) { \
+		unsigned int b = wanted; \
+		add; \
+	} else { \
+		for (unsigned int b=0; b<TARGET_INDEX_BUCKETS; b++) { \
+			if (((b ^ wanted) & known) == 0) { \
+				add; \
+			} \
+		} \
+	} \
+} while (0)
+
+// Sort the targets in the buckets
+static void build_buckets(target_index* index) {
+	uint32_t* sizes = calloc(TARGET_INDEX_BUCKETS, sizeof(uint32_t));
+	size_t entries = 0;
+	for (int i=0; i<index->count; i++) {
+		FOR_EACH_BUCKET(index, &index->targets[i], b, {sizes[b]++; entries++;});
+	}
+	index->bucket_start = malloc((TARGET_INDEX_BUCKETS + 1) * sizeof(uint32_t));
+	index->entries = malloc(entries * sizeof(uint32_t));
+	index->bucket_start[0] = 0;
+	for (int b=0; b<TARGET_INDEX_BUCKETS; b++) {
+		index->bucket_start[b + 1] = index->bucket_start[b] + sizes[b];
+		sizes[b] = index->bucket_start[b];
+	}
+	for (int i=0; i<index->count; i++) {
+		FOR_EACH_BUCKET(index, &index->targets[i], b, {index->entries[sizes[b]++] = i;});
+	}
+	free(sizes);
+}
+
+bool target_index_load(target_index* index, const char* path, match_position position) {
+	memset(index, 0, sizeof(target_index));
+	index->position = position;
+	if (position == MATCH_ANYWHERE) {
+		fprintf(stderr, "Error, batch targets can only be matched as a prefix or a suffix.\n");
+		return false;
+	}
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Error, unable to open targets file %s.\n", path);
+		return false;
+	}
+	bool ok = read_targets(index, f, path);
+	fclose(f);
+	if (!ok) {
+		target_index_free(index);
+		return false;
+	}
+	build_buckets(index);
+	atomic_init(&index->remaining, index->count);
+	return true;
+}
+
+int target_index_match(const target_index* index, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]) {
+	unsigned int b = bucket_bits(index->position, hash_words);
+	for (uint32_t e=index->bucket_start[b]; e<index->bucket_start[b + 1]; e++) {
+		const target* t = &index->targets[index->entries[e]];
+		if (atomic_load_explicit(&t->found, memory_order_relaxed)) {
+			continue;
+		}
+		bool match = true;
+		for (int i=0; i<CF_SHA256_HASHSZ / 4; i++) {
+			match &= (hash_words[i] & t->mask[i]) == t->value[i];
+		}
+		if (match) {
+			return index->entries[e];
+		}
+	}
+	return -1;
+}
+
+void target_index_free(target_index* index) {
+	for (int i=0; i<index->count; i++) {
+		free(index->targets[i].reference);
+		free(index->targets[i].output);
+	}
+	free(index->targets);
+	free(index->bucket_start);
+	free(index->entries);
+	memset(index, 0, sizeof(target_index));
+}
+
@@ -0,0 +1,52 @@
+#ifndef _TARGET_INDEX_H_
+#define _TARGET_INDEX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "sha2.h"
+#include "match_position.h"
+
+// Number of bits at the start (or end) of the Devzat IDs used to find the
+// targets that an ID can match
+#define TARGET_INDEX_BITS 16
+#define TARGET_INDEX_BUCKETS (1 << TARGET_INDEX_BITS)
+
+// A Devzat ID reference to mine a key for, matched with masks as in
+// devzat_matcher
+typedef struct {
+	uint32_t value[CF_SHA256_HASHSZ / 4];
+	uint32_t mask[CF_SHA256_HASHSZ / 4];
+	char* reference;
+	char* output; // Path of the file where its key is written
+	atomic_bool found;
+} target;
+
+// All the targets of a batch, indexed by the bits of the IDs they accept so
+// that an ID is only compared to the few targets that it can match.
+// The targets of bucket b are entries[bucket_start[b]] to
+// entries[bucket_start[b + 1] - 1]. A target with less than
+// TARGET_INDEX_BITS bits is in all the buckets it accepts.
+typedef struct {
+	match_position position;
+	int count;
+	atomic_int remaining; // Number of targets not found yet
+	target* targets;
+	uint32_t* bucket_start;
+	uint32_t* entries;
+} target_index;
+
+// Read the targets of the file, one per line as a hex reference optionally
+// followed by the path of its key file, which defaults to the reference
+// followed by .key. Empty lines and lines starting with # are skipped.
+// Print an error and return false if a line is not valid or if there is no
+// target.
+bool target_index_load(target_index* index, const char* path, match_position position);
+
+// Return the index of a target not found yet that the hash matches, or -1
+int target_index_match(const target_index* index, const uint32_t hash_words[CF_SHA256_HASHSZ / 4]);
+
+void target_index_free(target_index* index);
+
+#endif
+
@@ -0,0 +1,80 @@
+#include "cpu_features.h"
+
+#if defined(__x86_64__) && !defined(NO_SIMD)
+
+#include <cpuid.h>
+#include <stdint.h>
+
+/* Bit 1 and 2 of XCR0: the OS saves the SSE and AVX registers. */
+#define XCR0_AVX_STATE 0x6
+
+static uint64_t xgetbv0(void)
+{
+	uint32_t eax, edx;
+	__asm__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return ((uint64_t) edx << 32) | eax;
+}
+
+static bool detect_avx2(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return false;
+	if ((xgetbv0() & XCR0_AVX_STATE) != XCR0_AVX_STATE)
+		return false;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	return ebx & bit_AVX2;
+}
+
+static bool detect_sha_ni(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+		return false;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	return ebx & bit_SHA;
+}
+
+/* `*cache` is -1 until the first call, then the result of detect(). */
+static bool cached_detection(int *cache, bool (*detect)(void))
+{
+	int ret = __atomic_load_n(cache, __ATOMIC_RELAXED);
+	if (ret < 0) {
+		ret = detect();
+		__atomic_store_n(cache, ret, __ATOMIC_RELAXED);
+	}
+	return ret;
+}
+
+static int has_avx2 = -1;
+static int has_sha_ni = -1;
+
+bool cpu_has_avx2(void)
+{
+	return cached_detection(&has_avx2, detect_avx2);
+}
+
+bool cpu_has_sha_ni(void)
+{
+	return cached_detection(&has_sha_ni, detect_sha_ni);
+}
+
+#else
+
+bool cpu_has_avx2(void)
+{
+	return false;
+}
+
+bool cpu_has_sha_ni(void)
+{
+	return false;
+}
+
+#endif
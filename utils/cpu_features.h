@@ -0,0 +1,20 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <stdbool.h>
+
+/*
+ * Runtime detection of the optional instruction sets used by the SIMD code.
+ *
+ * Everything returns false when compiled with NO_SIMD or on CPUs other than
+ * x86-64. The CPU is only queried on the first call, so the functions are
+ * cheap enough to be called before each use of the SIMD code.
+ */
+
+/* True if the CPU and the OS support AVX2. */
+bool cpu_has_avx2(void);
+
+/* True if the CPU has the SHA extensions, and the SSE4.1 used around them. */
+bool cpu_has_sha_ni(void);
+
+#endif